@@ -0,0 +1,318 @@
+//! Benchmarks of enumeration, descriptor parsing, string reads, bulk transfers and event
+//! handling.
+//!
+//! Run them with `cargo bench --bench usb`, optionally followed by `-- <filter>` to select
+//! benchmarks by name.
+//!
+//! Enumeration, descriptor parsing and event handling run against whatever devices are attached.
+//! String reads and bulk transfers need a loopback device, which echoes every bulk OUT transfer
+//! back on a bulk IN endpoint. It is selected with the `RUSB_BENCH_LOOPBACK` environment variable
+//! as `vid:pid[:out:in[:interface]]` in hexadecimal, and defaults to Gadget Zero,
+//! `0525:a4a0:01:81:0`.
+//!
+//! Without hardware, Gadget Zero can be run on the Linux `dummy_hcd` host controller, which
+//! emulates a USB bus in software:
+//!
+//! ```text
+//! modprobe dummy_hcd
+//! modprobe g_zero loopdefault=1
+//! ```
+//!
+//! This keeps the transport cost small and steady, so changes in the overhead of the wrapper
+//! show up in the results.
+
+use std::{
+    env,
+    hint::black_box,
+    time::{Duration, Instant},
+};
+
+use rusb::{Context, DeviceHandle, Transfer, UsbContext};
+
+const TIMEOUT: Duration = Duration::from_secs(1);
+
+/// Runs functions repeatedly and reports their median time per call.
+struct Bencher {
+    filter: Option<String>,
+    warm_up: Duration,
+    measure: Duration,
+}
+
+impl Bencher {
+    fn from_args() -> Self {
+        // `cargo bench` passes `--bench`; anything else is a filter.
+        let filter = env::args().skip(1).find(|arg| !arg.starts_with("--"));
+
+        Bencher {
+            filter,
+            warm_up: Duration::from_millis(200),
+            measure: Duration::from_secs(1),
+        }
+    }
+
+    /// Benchmarks `f`, which returns the number of bytes it moved.
+    fn run<F>(&self, name: &str, mut f: F)
+    where
+        F: FnMut() -> rusb::Result<usize>,
+    {
+        if let Some(ref filter) = self.filter {
+            if !name.contains(filter.as_str()) {
+                return;
+            }
+        }
+
+        let started = Instant::now();
+        while started.elapsed() < self.warm_up {
+            if let Err(err) = f() {
+                println!("{:<40} skipped: {}", name, err);
+                return;
+            }
+        }
+
+        let mut samples = Vec::new();
+        let mut bytes = 0;
+        let started = Instant::now();
+        while started.elapsed() < self.measure {
+            let start = Instant::now();
+            match f() {
+                Ok(len) => bytes += len,
+                Err(err) => {
+                    println!("{:<40} failed: {}", name, err);
+                    return;
+                }
+            }
+            samples.push(start.elapsed());
+        }
+
+        samples.sort();
+        let median = samples[samples.len() / 2];
+        let elapsed = samples.iter().sum::<Duration>().as_secs_f64();
+
+        if bytes > 0 {
+            println!(
+                "{:<40} {:>12?}/iter {:>10.1} MB/s ({} iterations)",
+                name,
+                median,
+                bytes as f64 / elapsed / 1e6,
+                samples.len()
+            );
+        } else {
+            println!(
+                "{:<40} {:>12?}/iter ({} iterations)",
+                name,
+                median,
+                samples.len()
+            );
+        }
+    }
+}
+
+/// A loopback device with bulk OUT and IN endpoints on one interface.
+struct Loopback {
+    handle: DeviceHandle<Context>,
+    out_endpoint: u8,
+    in_endpoint: u8,
+}
+
+impl Loopback {
+    fn open(context: &Context) -> Option<Self> {
+        let spec = env::var("RUSB_BENCH_LOOPBACK").unwrap_or_else(|_| "0525:a4a0".to_owned());
+        let fields = spec
+            .split(':')
+            .map(|field| u16::from_str_radix(field, 16))
+            .collect::<Result<Vec<_>, _>>()
+            .ok()?;
+
+        let (vid, pid) = match fields[..] {
+            [vid, pid, ..] => (vid, pid),
+            _ => return None,
+        };
+        let out_endpoint = fields.get(2).map_or(0x01, |&ep| ep as u8);
+        let in_endpoint = fields.get(3).map_or(0x81, |&ep| ep as u8);
+        let iface = fields.get(4).map_or(0, |&iface| iface as u8);
+
+        let handle = context.open_device_with_vid_pid(vid, pid)?;
+        let _ = handle.set_auto_detach_kernel_driver(true);
+        handle.claim_interface(iface).ok()?;
+
+        Some(Loopback {
+            handle,
+            out_endpoint,
+            in_endpoint,
+        })
+    }
+
+    fn round_trip(&self, out: &[u8], buf: &mut [u8]) -> rusb::Result<usize> {
+        let written = self.handle.write_bulk(self.out_endpoint, out, TIMEOUT)?;
+        let read = self.handle.read_bulk(self.in_endpoint, buf, TIMEOUT)?;
+        Ok(written + read)
+    }
+}
+
+fn bench_enumeration(b: &Bencher, context: &Context) {
+    b.run("enumeration/devices", || {
+        context.devices().map(|devices| {
+            black_box(devices.len());
+            0
+        })
+    });
+
+    b.run("enumeration/device_descriptors", || {
+        let devices = context.devices()?;
+        for device in devices.iter() {
+            device.device_descriptor()?;
+        }
+        Ok(0)
+    });
+}
+
+fn bench_descriptors(b: &Bencher, context: &Context) {
+    let devices = match context.devices() {
+        Ok(devices) => devices,
+        Err(err) => {
+            println!("descriptors skipped: {}", err);
+            return;
+        }
+    };
+
+    b.run("descriptors/config_descriptor", || {
+        let mut endpoints = 0;
+        for device in devices.iter() {
+            let config = match device.active_config_descriptor() {
+                Ok(config) => config,
+                Err(_) => continue,
+            };
+            for interface in config.interfaces() {
+                for setting in interface.descriptors() {
+                    endpoints += setting.endpoint_descriptors().count();
+                }
+            }
+        }
+        black_box(endpoints);
+        Ok(0)
+    });
+
+    b.run("descriptors/cached", || {
+        for device in devices.iter() {
+            device.descriptors()?;
+        }
+        Ok(0)
+    });
+}
+
+fn bench_strings(b: &Bencher, loopback: &Loopback) {
+    let handle = &loopback.handle;
+    let descriptor = match handle.device().device_descriptor() {
+        Ok(descriptor) => descriptor,
+        Err(err) => {
+            println!("strings skipped: {}", err);
+            return;
+        }
+    };
+    let language = match handle.read_languages(TIMEOUT) {
+        Ok(languages) if !languages.is_empty() => languages[0],
+        _ => {
+            println!("strings skipped: no languages");
+            return;
+        }
+    };
+
+    b.run("strings/uncached", || {
+        handle.read_manufacturer_string(language, &descriptor, TIMEOUT)?;
+        handle.read_product_string(language, &descriptor, TIMEOUT)?;
+        Ok(0)
+    });
+
+    b.run("strings/read_strings", || {
+        handle.clear_string_cache();
+        handle.read_strings(language, &descriptor, TIMEOUT)?;
+        Ok(0)
+    });
+
+    b.run("strings/cached", || {
+        handle.read_strings(language, &descriptor, TIMEOUT)?;
+        Ok(0)
+    });
+}
+
+fn bench_bulk(b: &Bencher, loopback: &Loopback) {
+    for &size in &[64, 512, 4096] {
+        let out = vec![0x5a; size];
+        let mut buf = vec![0; size];
+        b.run(&format!("bulk/sync_latency/{}", size), || {
+            loopback.round_trip(&out, &mut buf)
+        });
+    }
+
+    let size = 64 * 1024;
+    let out = vec![0x5a; size];
+    let mut buf = vec![0; size];
+    b.run("bulk/sync_throughput/65536", || {
+        loopback.round_trip(&out, &mut buf)
+    });
+
+    for &depth in &[1, 4, 8] {
+        let name = format!("bulk/async_throughput/65536x{}", depth);
+        let handle = &loopback.handle;
+
+        let transfers = (0..depth)
+            .map(|_| {
+                let write =
+                    Transfer::bulk(handle, loopback.out_endpoint, vec![0x5a; size], TIMEOUT)?;
+                let read = Transfer::bulk(handle, loopback.in_endpoint, vec![0; size], TIMEOUT)?;
+                Ok((write, read))
+            })
+            .collect::<rusb::Result<Vec<_>>>();
+        let mut transfers = match transfers {
+            Ok(transfers) => transfers,
+            Err(err) => {
+                println!("{:<40} skipped: {}", name, err);
+                continue;
+            }
+        };
+
+        b.run(&name, || {
+            for (write, read) in transfers.iter_mut() {
+                write.submit()?;
+                read.submit()?;
+            }
+            let mut bytes = 0;
+            for (write, read) in transfers.iter_mut() {
+                bytes += write.wait(None)?;
+                bytes += read.wait(None)?;
+            }
+            Ok(bytes)
+        });
+    }
+}
+
+fn bench_events(b: &Bencher, context: &Context) {
+    b.run("events/handle_events_idle", || {
+        context.handle_events(Some(Duration::from_secs(0)))?;
+        Ok(0)
+    });
+}
+
+fn main() {
+    let b = Bencher::from_args();
+
+    let context = match Context::new() {
+        Ok(context) => context,
+        Err(err) => {
+            println!("could not initialize libusb: {}", err);
+            return;
+        }
+    };
+
+    bench_enumeration(&b, &context);
+    bench_descriptors(&b, &context);
+    bench_events(&b, &context);
+
+    match Loopback::open(&context) {
+        Some(loopback) => {
+            bench_strings(&b, &loopback);
+            bench_bulk(&b, &loopback);
+        }
+        None => println!("no loopback device found, skipping string and bulk benchmarks"),
+    }
+}
@@ -19,6 +19,9 @@ fn get_api_version(libusb_source: &Path) {
                         if api_version >= 0x01000108 {
                             println!("cargo:rustc-cfg=libusb_hotplug_get_user_data");
                         }
+                        if api_version >= 0x0100010A {
+                            println!("cargo:rustc-cfg=libusb_init_context");
+                        }
                     }
                     break;
                 }
@@ -28,6 +31,9 @@ fn get_api_version(libusb_source: &Path) {
 }
 
 fn main() {
+    println!("cargo:rustc-check-cfg=cfg(libusb_hotplug_get_user_data)");
+    println!("cargo:rustc-check-cfg=cfg(libusb_init_context)");
+
     if let Ok(include_path) = std::env::var("DEP_USB_1.0_INCLUDE") {
         let path = PathBuf::from(include_path);
         get_api_version(path.join("libusb.h").as_path());
@@ -69,32 +69,17 @@ fn read_device<T: UsbContext>(
     handle.reset()?;
 
     let timeout = Duration::from_secs(1);
-    let languages = handle.read_languages(timeout)?;
+    let languages = handle.read_languages_cached(timeout)?;
 
     println!("Active configuration: {}", handle.active_configuration()?);
     println!("Languages: {:?}", languages);
 
     if languages.len() > 0 {
-        let language = languages[0];
-
-        println!(
-            "Manufacturer: {:?}",
-            handle
-                .read_manufacturer_string(language, device_desc, timeout)
-                .ok()
-        );
-        println!(
-            "Product: {:?}",
-            handle
-                .read_product_string(language, device_desc, timeout)
-                .ok()
-        );
-        println!(
-            "Serial Number: {:?}",
-            handle
-                .read_serial_number_string(language, device_desc, timeout)
-                .ok()
-        );
+        let strings = handle.read_strings(languages[0], device_desc, timeout)?;
+
+        println!("Manufacturer: {:?}", strings.manufacturer());
+        println!("Product: {:?}", strings.product());
+        println!("Serial Number: {:?}", strings.serial_number());
     }
 
     match find_readable_endpoint(device, device_desc, TransferType::Interrupt) {
@@ -0,0 +1,605 @@
+//! Measures throughput, latency and CPU usage of transfers to a device.
+//!
+//! The endpoints of one interface are swept over transfer sizes and queue depths, comparing
+//! synchronous reads and writes with queued asynchronous transfers and, for bulk IN, with a
+//! `BulkReader` stream. Results are printed as a table, or as JSON with `--json` so they can be
+//! compared across releases of rusb or of the device firmware.
+//!
+//! Latency is measured per transfer, from submission until the completion is seen. With a queue
+//! depth above one it includes the time spent waiting behind the transfers queued before it. For
+//! streams it is the time each buffer was waited for.
+//!
+//! The device has to keep the endpoints busy: IN endpoints should always have data, and OUT
+//! endpoints should accept it. Gadget Zero in source/sink mode does both.
+
+use std::{
+    collections::VecDeque,
+    env,
+    io::BufRead,
+    process,
+    time::{Duration, Instant},
+};
+
+use rusb::{Context, DeviceHandle, Direction, Transfer, TransferType, UsbContext};
+
+const TIMEOUT: Duration = Duration::from_secs(1);
+
+const USAGE: &str = "usage: usb_bench <vid>:<pid> [options]
+
+vid and pid are hexadecimal.
+
+options:
+    --interface <n>        interface to claim (default 0)
+    --bulk-in <ep>         bulk IN endpoint, in hexadecimal
+    --bulk-out <ep>        bulk OUT endpoint
+    --interrupt-in <ep>    interrupt IN endpoint
+    --iso-in <ep>          isochronous IN endpoint
+    --sizes <n,...>        transfer sizes in bytes (default 512,4096,16384,65536)
+    --depths <n,...>       queue depths of asynchronous transfers (default 1,4,16)
+    --duration <ms>        time spent on each case (default 1000)
+    --json                 print the results as JSON
+
+Endpoints that are not given are looked up in the interface's descriptors.";
+
+struct Options {
+    vid: u16,
+    pid: u16,
+    interface: u8,
+    bulk_in: Option<u8>,
+    bulk_out: Option<u8>,
+    interrupt_in: Option<u8>,
+    iso_in: Option<u8>,
+    sizes: Vec<usize>,
+    depths: Vec<usize>,
+    duration: Duration,
+    json: bool,
+}
+
+impl Options {
+    fn parse() -> Result<Self, String> {
+        let mut args = env::args().skip(1);
+
+        let device = args.next().ok_or("missing device")?;
+        let (vid, pid) = match device.split(':').collect::<Vec<_>>()[..] {
+            [vid, pid] => (hex(vid)?, hex(pid)?),
+            _ => return Err(format!("invalid device {:?}", device)),
+        };
+
+        let mut options = Options {
+            vid,
+            pid,
+            interface: 0,
+            bulk_in: None,
+            bulk_out: None,
+            interrupt_in: None,
+            iso_in: None,
+            sizes: vec![512, 4096, 16384, 65536],
+            depths: vec![1, 4, 16],
+            duration: Duration::from_secs(1),
+            json: false,
+        };
+
+        while let Some(arg) = args.next() {
+            if arg == "--json" {
+                options.json = true;
+                continue;
+            }
+
+            let value = args.next().ok_or(format!("missing value for {}", arg))?;
+            match arg.as_str() {
+                "--interface" => options.interface = number(&value)? as u8,
+                "--bulk-in" => options.bulk_in = Some(hex(&value)? as u8),
+                "--bulk-out" => options.bulk_out = Some(hex(&value)? as u8),
+                "--interrupt-in" => options.interrupt_in = Some(hex(&value)? as u8),
+                "--iso-in" => options.iso_in = Some(hex(&value)? as u8),
+                "--sizes" => options.sizes = list(&value)?,
+                "--depths" => options.depths = list(&value)?,
+                "--duration" => options.duration = Duration::from_millis(number(&value)? as u64),
+                _ => return Err(format!("unknown option {}", arg)),
+            }
+        }
+
+        Ok(options)
+    }
+}
+
+fn hex(value: &str) -> Result<u16, String> {
+    u16::from_str_radix(value.trim_start_matches("0x"), 16)
+        .map_err(|_| format!("invalid hexadecimal number {:?}", value))
+}
+
+fn number(value: &str) -> Result<usize, String> {
+    value
+        .parse()
+        .map_err(|_| format!("invalid number {:?}", value))
+}
+
+fn list(value: &str) -> Result<Vec<usize>, String> {
+    value
+        .split(',')
+        .map(number)
+        .filter(|n| n != &Ok(0))
+        .collect()
+}
+
+/// An endpoint on the claimed interface, with the alternate setting that declares it.
+#[derive(Clone, Copy)]
+struct Endpoint {
+    address: u8,
+    setting: u8,
+    max_packet_size: usize,
+}
+
+fn find_endpoint<T: UsbContext>(
+    handle: &DeviceHandle<T>,
+    interface: u8,
+    given: Option<u8>,
+    direction: Direction,
+    transfer_type: TransferType,
+) -> Option<Endpoint> {
+    let config = handle.device().active_config_descriptor().ok()?;
+
+    for iface in config.interfaces().filter(|i| i.number() == interface) {
+        for setting in iface.descriptors() {
+            for endpoint in setting.endpoint_descriptors() {
+                let matches = match given {
+                    Some(address) => endpoint.address() == address,
+                    None => endpoint.direction() == direction,
+                };
+                if matches && endpoint.transfer_type() == transfer_type {
+                    return Some(Endpoint {
+                        address: endpoint.address(),
+                        setting: setting.setting_number(),
+                        max_packet_size: endpoint.max_packet_size() as usize & 0x7ff,
+                    });
+                }
+            }
+        }
+    }
+
+    None
+}
+
+/// CPU time used by this process so far, if the platform reports it.
+#[cfg(unix)]
+fn cpu_time() -> Option<Duration> {
+    let mut usage: libc::rusage = unsafe { std::mem::zeroed() };
+    if unsafe { libc::getrusage(libc::RUSAGE_SELF, &mut usage) } != 0 {
+        return None;
+    }
+
+    let micros = |tv: libc::timeval| tv.tv_sec as u64 * 1_000_000 + tv.tv_usec as u64;
+    Some(Duration::from_micros(
+        micros(usage.ru_utime) + micros(usage.ru_stime),
+    ))
+}
+
+#[cfg(not(unix))]
+fn cpu_time() -> Option<Duration> {
+    None
+}
+
+/// Collects the samples of one case.
+struct Recorder {
+    started: Instant,
+    cpu_started: Option<Duration>,
+    latencies: Vec<Duration>,
+    bytes: usize,
+}
+
+impl Recorder {
+    fn new() -> Self {
+        Recorder {
+            started: Instant::now(),
+            cpu_started: cpu_time(),
+            latencies: Vec::new(),
+            bytes: 0,
+        }
+    }
+
+    fn running(&self, duration: Duration) -> bool {
+        self.started.elapsed() < duration
+    }
+
+    fn record(&mut self, started: Instant, bytes: usize) {
+        self.latencies.push(started.elapsed());
+        self.bytes += bytes;
+    }
+
+    fn finish(mut self, case: Case) -> Sample {
+        let elapsed = self.started.elapsed();
+        let cpu = match (self.cpu_started, cpu_time()) {
+            (Some(start), Some(end)) => {
+                Some((end.saturating_sub(start)).as_secs_f64() / elapsed.as_secs_f64() * 100.0)
+            }
+            _ => None,
+        };
+
+        self.latencies.sort();
+        let latencies = &self.latencies;
+        let quantile = |q: f64| {
+            if latencies.is_empty() {
+                Duration::from_secs(0)
+            } else {
+                let rank = (q * latencies.len() as f64).ceil() as usize;
+                latencies[rank.max(1).min(latencies.len()) - 1]
+            }
+        };
+
+        Sample {
+            case,
+            transfers: latencies.len(),
+            bytes: self.bytes,
+            elapsed,
+            p50: quantile(0.5),
+            p99: quantile(0.99),
+            p999: quantile(0.999),
+            cpu,
+        }
+    }
+}
+
+/// What was measured.
+struct Case {
+    kind: &'static str,
+    mode: &'static str,
+    endpoint: u8,
+    size: usize,
+    depth: usize,
+}
+
+/// The results of one case.
+struct Sample {
+    case: Case,
+    transfers: usize,
+    bytes: usize,
+    elapsed: Duration,
+    p50: Duration,
+    p99: Duration,
+    p999: Duration,
+    cpu: Option<f64>,
+}
+
+impl Sample {
+    fn megabytes_per_second(&self) -> f64 {
+        self.bytes as f64 / self.elapsed.as_secs_f64() / 1e6
+    }
+}
+
+type Outcome = Result<Sample, (Case, rusb::Error)>;
+
+/// Runs synchronous transfers of `size` bytes back to back.
+fn run_sync<F>(case: Case, duration: Duration, mut transfer: F) -> Outcome
+where
+    F: FnMut() -> rusb::Result<usize>,
+{
+    let mut recorder = Recorder::new();
+    while recorder.running(duration) {
+        let started = Instant::now();
+        match transfer() {
+            Ok(len) => recorder.record(started, len),
+            Err(err) => return Err((case, err)),
+        }
+    }
+    Ok(recorder.finish(case))
+}
+
+/// Keeps `case.depth` transfers created by `make` in flight, resubmitting each as it completes.
+fn run_queued<'d, T, F>(case: Case, duration: Duration, mut make: F) -> Outcome
+where
+    T: UsbContext + 'd,
+    F: FnMut() -> rusb::Result<Transfer<'d, T>>,
+{
+    let mut queue = VecDeque::with_capacity(case.depth);
+    for _ in 0..case.depth {
+        let submitted = make().and_then(|mut transfer| {
+            transfer.submit()?;
+            Ok(transfer)
+        });
+        match submitted {
+            Ok(transfer) => queue.push_back((transfer, Instant::now())),
+            Err(err) => return Err((case, err)),
+        }
+    }
+
+    let mut recorder = Recorder::new();
+    let mut result = Ok(());
+    while recorder.running(duration) {
+        // Transfers on one endpoint complete in submission order.
+        let (mut transfer, started) = queue.pop_front().unwrap();
+        match transfer.wait(Some(TIMEOUT)) {
+            Ok(len) => recorder.record(started, len),
+            Err(err) => {
+                result = Err(err);
+                queue.push_back((transfer, started));
+                break;
+            }
+        }
+
+        if let Err(err) = transfer.submit() {
+            result = Err(err);
+            break;
+        }
+        queue.push_back((transfer, Instant::now()));
+    }
+
+    // Bring back the transfers still in flight before they are dropped.
+    for (transfer, _) in queue.iter() {
+        let _ = transfer.cancel();
+    }
+    for (transfer, _) in queue.iter_mut() {
+        if transfer.is_pending() {
+            let _ = transfer.wait(Some(TIMEOUT));
+        }
+    }
+
+    match result {
+        Ok(()) => Ok(recorder.finish(case)),
+        Err(err) => Err((case, err)),
+    }
+}
+
+/// Reads from a `BulkReader` with `case.depth` transfers of `case.size` bytes.
+fn run_stream<T: UsbContext>(handle: &DeviceHandle<T>, case: Case, duration: Duration) -> Outcome {
+    let mut reader =
+        match rusb::BulkReader::new(handle, case.endpoint, case.depth, case.size, TIMEOUT) {
+            Ok(reader) => reader,
+            Err(err) => return Err((case, err)),
+        };
+
+    let mut recorder = Recorder::new();
+    while recorder.running(duration) {
+        let started = Instant::now();
+        let len = match reader.fill_buf() {
+            Ok(buf) => buf.len(),
+            Err(_) => return Err((case, rusb::Error::Io)),
+        };
+        reader.consume(len);
+        recorder.record(started, len);
+    }
+    Ok(recorder.finish(case))
+}
+
+fn bench<T: UsbContext>(handle: &mut DeviceHandle<T>, options: &Options) -> Vec<Outcome> {
+    let iface = options.interface;
+    let duration = options.duration;
+    let mut outcomes = Vec::new();
+
+    let endpoints = [
+        (
+            "bulk_in",
+            options.bulk_in,
+            Direction::In,
+            TransferType::Bulk,
+        ),
+        (
+            "bulk_out",
+            options.bulk_out,
+            Direction::Out,
+            TransferType::Bulk,
+        ),
+        (
+            "interrupt_in",
+            options.interrupt_in,
+            Direction::In,
+            TransferType::Interrupt,
+        ),
+        (
+            "iso_in",
+            options.iso_in,
+            Direction::In,
+            TransferType::Isochronous,
+        ),
+    ];
+
+    for &(kind, given, direction, transfer_type) in endpoints.iter() {
+        let endpoint = match find_endpoint(handle, iface, given, direction, transfer_type) {
+            Some(endpoint) => endpoint,
+            None => continue,
+        };
+        if handle
+            .set_alternate_setting(iface, endpoint.setting)
+            .is_err()
+        {
+            continue;
+        }
+
+        let handle = &*handle;
+        let address = endpoint.address;
+        let case = |mode, size, depth| Case {
+            kind,
+            mode,
+            endpoint: address,
+            size,
+            depth,
+        };
+
+        match transfer_type {
+            TransferType::Bulk | TransferType::Interrupt => {
+                let interrupt = transfer_type == TransferType::Interrupt;
+                // Interrupt transfers are not sped up by size, so one packet is enough.
+                let sizes = if interrupt {
+                    vec![endpoint.max_packet_size]
+                } else {
+                    options.sizes.clone()
+                };
+
+                for &size in sizes.iter() {
+                    let mut buf = vec![0x5a; size];
+                    outcomes.push(run_sync(case("sync", size, 1), duration, || {
+                        match (direction, interrupt) {
+                            (Direction::In, false) => handle.read_bulk(address, &mut buf, TIMEOUT),
+                            (Direction::Out, false) => handle.write_bulk(address, &buf, TIMEOUT),
+                            (Direction::In, true) => {
+                                handle.read_interrupt(address, &mut buf, TIMEOUT)
+                            }
+                            (Direction::Out, true) => {
+                                handle.write_interrupt(address, &buf, TIMEOUT)
+                            }
+                        }
+                    }));
+
+                    for &depth in options.depths.iter() {
+                        outcomes.push(run_queued(case("async", size, depth), duration, || {
+                            let buf = handle.alloc_buffer(size)?;
+                            if interrupt {
+                                Transfer::interrupt(handle, address, buf, TIMEOUT)
+                            } else {
+                                Transfer::bulk(handle, address, buf, TIMEOUT)
+                            }
+                        }));
+
+                        if direction == Direction::In && !interrupt {
+                            outcomes.push(run_stream(
+                                handle,
+                                case("stream", size, depth),
+                                duration,
+                            ));
+                        }
+                    }
+                }
+            }
+            TransferType::Isochronous => {
+                let packet_size = match handle.device().max_iso_packet_size(address) {
+                    Ok(size) if size > 0 => size,
+                    _ => continue,
+                };
+
+                for &size in options.sizes.iter() {
+                    let packets = (size / packet_size).max(1);
+                    let size = packets * packet_size;
+
+                    for &depth in options.depths.iter() {
+                        outcomes.push(run_queued(case("async", size, depth), duration, || {
+                            let buf = handle.alloc_buffer(size)?;
+                            Transfer::isochronous(handle, address, buf, packets, TIMEOUT)
+                        }));
+                    }
+                }
+            }
+            TransferType::Control => {}
+        }
+    }
+
+    let _ = handle.set_alternate_setting(iface, 0);
+    outcomes
+}
+
+fn print_table(outcomes: &[Outcome]) {
+    println!(
+        "{:<13} {:<6} {:>4} {:>7} {:>5} {:>10} {:>10} {:>10} {:>10} {:>6}",
+        "endpoint", "mode", "ep", "size", "depth", "MB/s", "p50", "p99", "p99.9", "cpu%"
+    );
+
+    for outcome in outcomes {
+        match outcome {
+            Ok(s) => println!(
+                "{:<13} {:<6} {:>4x} {:>7} {:>5} {:>10.2} {:>10?} {:>10?} {:>10?} {:>6}",
+                s.case.kind,
+                s.case.mode,
+                s.case.endpoint,
+                s.case.size,
+                s.case.depth,
+                s.megabytes_per_second(),
+                s.p50,
+                s.p99,
+                s.p999,
+                s.cpu.map_or("-".to_owned(), |cpu| format!("{:.1}", cpu)),
+            ),
+            Err((case, err)) => println!(
+                "{:<13} {:<6} {:>4x} {:>7} {:>5} failed: {}",
+                case.kind, case.mode, case.endpoint, case.size, case.depth, err
+            ),
+        }
+    }
+}
+
+fn print_json(options: &Options, outcomes: &[Outcome]) {
+    let (major, minor, micro) = {
+        let version = rusb::version();
+        (version.major(), version.minor(), version.micro())
+    };
+
+    println!("{{");
+    println!("  \"device\": \"{:04x}:{:04x}\",", options.vid, options.pid);
+    println!("  \"interface\": {},", options.interface);
+    println!("  \"libusb\": \"{}.{}.{}\",", major, minor, micro);
+    println!("  \"duration_ms\": {},", options.duration.as_millis());
+    println!("  \"results\": [");
+
+    for (i, outcome) in outcomes.iter().enumerate() {
+        let separator = if i + 1 < outcomes.len() { "," } else { "" };
+        let case = match outcome {
+            Ok(sample) => &sample.case,
+            Err((case, _)) => case,
+        };
+        let head = format!(
+            "\"kind\": \"{}\", \"mode\": \"{}\", \"endpoint\": {}, \"size\": {}, \"depth\": {}",
+            case.kind, case.mode, case.endpoint, case.size, case.depth
+        );
+
+        match outcome {
+            Ok(s) => println!(
+                "    {{{}, \"transfers\": {}, \"bytes\": {}, \"elapsed_us\": {}, \
+                 \"mb_per_s\": {:.3}, \"p50_us\": {}, \"p99_us\": {}, \"p999_us\": {}, \
+                 \"cpu_percent\": {}}}{}",
+                head,
+                s.transfers,
+                s.bytes,
+                s.elapsed.as_micros(),
+                s.megabytes_per_second(),
+                s.p50.as_micros(),
+                s.p99.as_micros(),
+                s.p999.as_micros(),
+                s.cpu.map_or("null".to_owned(), |cpu| format!("{:.1}", cpu)),
+                separator
+            ),
+            Err((_, err)) => println!("    {{{}, \"error\": \"{}\"}}{}", head, err, separator),
+        }
+    }
+
+    println!("  ]");
+    println!("}}");
+}
+
+fn main() {
+    let options = match Options::parse() {
+        Ok(options) => options,
+        Err(err) => {
+            eprintln!("{}\n\n{}", err, USAGE);
+            process::exit(2);
+        }
+    };
+
+    let context = Context::new().expect("could not initialize libusb");
+    let mut handle = match context.open_device_with_vid_pid(options.vid, options.pid) {
+        Some(handle) => handle,
+        None => {
+            eprintln!(
+                "could not open device {:04x}:{:04x}",
+                options.vid, options.pid
+            );
+            process::exit(1);
+        }
+    };
+
+    let _ = handle.set_auto_detach_kernel_driver(true);
+    if let Err(err) = handle.claim_interface(options.interface) {
+        eprintln!("could not claim interface {}: {}", options.interface, err);
+        process::exit(1);
+    }
+
+    let outcomes = bench(&mut handle, &options);
+    let _ = handle.release_interface(options.interface);
+
+    if options.json {
+        print_json(&options, &outcomes);
+    } else if outcomes.is_empty() {
+        println!(
+            "no bulk, interrupt or isochronous endpoints on interface {}",
+            options.interface
+        );
+    } else {
+        print_table(&outcomes);
+    }
+}
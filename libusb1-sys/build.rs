@@ -91,7 +91,17 @@ fn make_source() {
     base_config.include(libusb_source.join("libusb"));
 
     base_config.define("PRINTF_FORMAT(a, b)", Some(""));
-    base_config.define("ENABLE_LOGGING", Some("1"));
+    if !cfg!(feature = "vendored-no-logging") {
+        base_config.define("ENABLE_LOGGING", Some("1"));
+    }
+
+    if cfg!(feature = "vendored-lto") {
+        if base_config.get_compiler().is_like_clang() {
+            base_config.flag("-flto=thin");
+        } else {
+            println!("cargo:warning=vendored-lto requires clang, building without LTO");
+        }
+    }
 
     if std::env::var("CARGO_CFG_TARGET_ENV") == Ok("msvc".into()) {
         fs::copy(
@@ -131,14 +141,16 @@ fn make_source() {
             Some("__attribute__((visibility(\"default\")))"),
         );
 
-        match pkg_config::probe_library("libudev") {
-            Ok(_lib) => {
-                base_config.define("USE_UDEV", Some("1"));
-                base_config.define("HAVE_LIBUDEV", Some("1"));
-                base_config.file(libusb_source.join("libusb/os/linux_udev.c"));
-            }
-            _ => {}
-        };
+        if !cfg!(feature = "vendored-no-udev") {
+            match pkg_config::probe_library("libudev") {
+                Ok(_lib) => {
+                    base_config.define("USE_UDEV", Some("1"));
+                    base_config.define("HAVE_LIBUDEV", Some("1"));
+                    base_config.file(libusb_source.join("libusb/os/linux_udev.c"));
+                }
+                _ => {}
+            };
+        }
 
         println!("Including posix!");
         base_config.file(libusb_source.join("libusb/os/events_posix.c"));
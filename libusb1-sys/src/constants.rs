@@ -86,6 +86,12 @@ pub const LIBUSB_DT_HUB: u8 = 0x29;
 pub const LIBUSB_DT_SUPERSPEED_HUB: u8 = 0x2A;
 pub const LIBUSB_DT_SS_ENDPOINT_COMPANION: u8 = 0x30;
 
+// libusb_bos_type
+pub const LIBUSB_BT_WIRELESS_USB_DEVICE_CAPABILITY: u8 = 0x01;
+pub const LIBUSB_BT_USB_2_0_EXTENSION: u8 = 0x02;
+pub const LIBUSB_BT_SS_USB_DEVICE_CAPABILITY: u8 = 0x03;
+pub const LIBUSB_BT_CONTAINER_ID: u8 = 0x04;
+
 // libusb_endpoint_direction
 pub const LIBUSB_ENDPOINT_ADDRESS_MASK: u8 = 0x0F;
 pub const LIBUSB_ENDPOINT_DIR_MASK: u8 = 0x80;
@@ -149,6 +155,8 @@ pub const LIBUSB_HOTPLUG_MATCH_ANY: c_int = -1;
 
 pub const LIBUSB_OPTION_LOG_LEVEL: u32 = 0x00;
 pub const LIBUSB_OPTION_USE_USBDK: u32 = 0x01;
+pub const LIBUSB_OPTION_NO_DEVICE_DISCOVERY: u32 = 0x02;
+pub const LIBUSB_OPTION_WEAK_AUTHORITY: u32 = LIBUSB_OPTION_NO_DEVICE_DISCOVERY;
 
 // libusb_log_cb_mode
 pub const LIBUSB_LOG_CB_GLOBAL: libusb_log_cb_mode = 1 << 0;
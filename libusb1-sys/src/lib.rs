@@ -3,7 +3,7 @@
 pub mod constants;
 
 use self::constants::*;
-use libc::{c_char, c_int, c_short, c_uchar, c_uint, c_void, ssize_t, timeval};
+use libc::{c_char, c_int, c_short, c_uchar, c_uint, c_void, intptr_t, size_t, ssize_t, timeval};
 
 #[repr(C)]
 pub struct libusb_context {
@@ -126,6 +126,7 @@ pub struct libusb_bos_dev_capability_descriptor {
     pub bLength: u8,
     pub bDescriptorType: u8,
     pub bDevCapabilityType: u8,
+    pub dev_capability_data: [u8; 0],
 }
 
 #[allow(non_snake_case)]
@@ -135,6 +136,7 @@ pub struct libusb_bos_descriptor {
     pub bDescriptorType: u8,
     pub wTotalLength: u16,
     pub bNumDeviceCaps: u8,
+    pub dev_capability: [*mut libusb_bos_dev_capability_descriptor; 0],
 }
 
 #[allow(non_snake_case)]
@@ -218,7 +220,21 @@ pub type libusb_hotplug_callback_fn = extern "system" fn(
     user_data: *mut c_void,
 ) -> c_int;
 
-pub type libusb_log_cb = extern "system" fn(context: *mut libusb_context, c_int, *mut c_void);
+pub type libusb_log_cb = extern "system" fn(context: *mut libusb_context, c_int, *const c_char);
+
+#[repr(C)]
+#[derive(Clone, Copy)]
+pub union libusb_init_option_value {
+    pub ival: c_int,
+    pub log_cbval: Option<libusb_log_cb>,
+}
+
+#[repr(C)]
+#[derive(Clone, Copy)]
+pub struct libusb_init_option {
+    pub option: u32,
+    pub value: libusb_init_option_value,
+}
 
 extern "system" {
     pub fn libusb_get_version() -> *const libusb_version;
@@ -228,6 +244,12 @@ extern "system" {
     pub fn libusb_strerror(errcode: c_int) -> *const c_char;
 
     pub fn libusb_init(context: *mut *mut libusb_context) -> c_int;
+    // Since libusb 1.0.27.
+    pub fn libusb_init_context(
+        context: *mut *mut libusb_context,
+        options: *const libusb_init_option,
+        num_options: c_int,
+    ) -> c_int;
     pub fn libusb_exit(context: *mut libusb_context);
     pub fn libusb_set_debug(context: *mut libusb_context, level: c_int);
     pub fn libusb_set_log_cb(context: *mut libusb_context, cb: Option<libusb_log_cb>, mode: c_int);
@@ -277,7 +299,7 @@ extern "system" {
 
     pub fn libusb_wrap_sys_device(
         context: *mut libusb_context,
-        sys_dev: *mut c_int,
+        sys_dev: intptr_t,
         handle: *mut *mut libusb_device_handle,
     ) -> c_int;
     pub fn libusb_open(dev: *const libusb_device, handle: *mut *mut libusb_device_handle) -> c_int;
@@ -300,6 +322,15 @@ extern "system" {
         endpoints: *mut c_uchar,
         num_endpoints: c_int,
     ) -> c_int;
+    pub fn libusb_dev_mem_alloc(
+        dev_handle: *mut libusb_device_handle,
+        length: size_t,
+    ) -> *mut c_uchar;
+    pub fn libusb_dev_mem_free(
+        dev_handle: *mut libusb_device_handle,
+        buffer: *mut c_uchar,
+        length: size_t,
+    ) -> c_int;
     pub fn libusb_get_string_descriptor_ascii(
         dev_handle: *mut libusb_device_handle,
         desc_index: u8,
@@ -435,10 +466,12 @@ extern "system" {
     pub fn libusb_lock_event_waiters(context: *mut libusb_context);
     pub fn libusb_unlock_event_waiters(context: *mut libusb_context);
     pub fn libusb_wait_for_event(context: *mut libusb_context, tv: *const timeval) -> c_int;
+    pub fn libusb_interrupt_event_handler(context: *mut libusb_context);
 
     pub fn libusb_pollfds_handle_timeouts(context: *mut libusb_context) -> c_int;
     pub fn libusb_get_next_timeout(context: *mut libusb_context, tv: *mut timeval) -> c_int;
     pub fn libusb_get_pollfds(context: *mut libusb_context) -> *const *mut libusb_pollfd;
+    pub fn libusb_free_pollfds(pollfds: *const *mut libusb_pollfd);
     pub fn libusb_set_pollfd_notifiers(
         context: *mut libusb_context,
         added_cb: Option<libusb_pollfd_added_cb>,
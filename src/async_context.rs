@@ -0,0 +1,254 @@
+use std::{
+    fmt::{self, Debug},
+    os::unix::io::RawFd,
+    ptr::{self, NonNull},
+    sync::Mutex,
+    time::Duration,
+};
+
+use libc::{c_int, c_short, c_void, timeval};
+use libusb1_sys::{constants::*, *};
+
+use crate::{
+    context::timeval_from_duration,
+    error::{self, Error},
+    UsbContext,
+};
+
+/// A file descriptor that libusb needs to be polled.
+#[derive(Debug, Copy, Clone, Eq, PartialEq, Hash)]
+pub struct PollFd {
+    fd: RawFd,
+    events: c_short,
+}
+
+impl PollFd {
+    /// Returns the file descriptor.
+    pub fn fd(&self) -> RawFd {
+        self.fd
+    }
+
+    /// Returns true if events should be handled when the descriptor becomes readable.
+    pub fn readable(&self) -> bool {
+        self.events & libc::POLLIN != 0
+    }
+
+    /// Returns true if events should be handled when the descriptor becomes writable.
+    pub fn writable(&self) -> bool {
+        self.events & libc::POLLOUT != 0
+    }
+
+    /// Returns the `poll(2)` event flags to wait for.
+    pub fn events(&self) -> c_short {
+        self.events
+    }
+}
+
+/// A change to the set of file descriptors returned by
+/// [`AsyncContext::pollfds`](struct.AsyncContext.html#method.pollfds).
+#[derive(Debug, Copy, Clone, Eq, PartialEq, Hash)]
+pub enum PollFdEvent {
+    /// Libusb started using a file descriptor, for example because a device was opened.
+    Added(PollFd),
+
+    /// Libusb stopped using a file descriptor. It should be deregistered from the reactor.
+    Removed(RawFd),
+}
+
+type Notifier = Box<dyn FnMut(PollFdEvent) + Send>;
+
+/// Event handling for a context driven by an external reactor.
+///
+/// Instead of dedicating a thread that blocks in libusb, the file descriptors libusb waits on are
+/// registered with the reactor of an async runtime or an event loop built on `epoll` or `poll`.
+/// Whenever one of them is ready, [`handle_events`](#method.handle_events) dispatches the
+/// completions without blocking, which wakes any
+/// [`TransferFuture`](struct.TransferFuture.html)s that have finished.
+///
+/// libusb adds and removes descriptors over the lifetime of the context, so a reactor should
+/// register a notifier with [`set_notifier`](#method.set_notifier) before taking the initial
+/// set from [`pollfds`](#method.pollfds). If [`handles_timeouts`](#method.handles_timeouts) is
+/// false, the reactor must also call `handle_events` once
+/// [`next_timeout`](#method.next_timeout) expires, or transfer timeouts are never reported.
+///
+/// The context should not be driven by an [`EventThread`](struct.EventThread.html) or
+/// [`UsbContext::handle_events`](trait.UsbContext.html#method.handle_events) at the same time.
+pub struct AsyncContext<T: UsbContext> {
+    context: T,
+    notifier: NonNull<Mutex<Option<Notifier>>>,
+}
+
+unsafe impl<T: UsbContext> Send for AsyncContext<T> {}
+unsafe impl<T: UsbContext> Sync for AsyncContext<T> {}
+
+impl<T: UsbContext> AsyncContext<T> {
+    /// Takes over event notifications for `context`.
+    pub fn new(context: T) -> Self {
+        let notifier = Box::into_raw(Box::new(Mutex::new(None)));
+        unsafe {
+            libusb_set_pollfd_notifiers(
+                context.as_raw(),
+                Some(pollfd_added),
+                Some(pollfd_removed),
+                notifier as *mut c_void,
+            );
+        }
+
+        AsyncContext {
+            context,
+            notifier: unsafe { NonNull::new_unchecked(notifier) },
+        }
+    }
+
+    /// Returns the context whose events are handled.
+    pub fn context(&self) -> &T {
+        &self.context
+    }
+
+    /// Returns the file descriptors that libusb currently needs to be polled.
+    ///
+    /// ## Errors
+    ///
+    /// * `NotSupported` if the platform does not expose file descriptors, as on Windows.
+    pub fn pollfds(&self) -> crate::Result<Vec<PollFd>> {
+        let list = unsafe { libusb_get_pollfds(self.context.as_raw()) };
+        if list.is_null() {
+            return Err(Error::NotSupported);
+        }
+
+        let mut pollfds = Vec::new();
+        unsafe {
+            let mut entry = list;
+            while !(*entry).is_null() {
+                pollfds.push(PollFd {
+                    fd: (**entry).fd,
+                    events: (**entry).events,
+                });
+                entry = entry.add(1);
+            }
+            libusb_free_pollfds(list);
+        }
+        Ok(pollfds)
+    }
+
+    /// Sets a function that is called whenever libusb adds or removes a file descriptor.
+    ///
+    /// It is called from within libusb, possibly on another thread, and must not call back into
+    /// this context.
+    pub fn set_notifier<F>(&self, notifier: F)
+    where
+        F: FnMut(PollFdEvent) + Send + 'static,
+    {
+        *self.notifier().lock().unwrap() = Some(Box::new(notifier));
+    }
+
+    /// Removes the function set with [`set_notifier`](#method.set_notifier).
+    pub fn clear_notifier(&self) {
+        self.notifier().lock().unwrap().take();
+    }
+
+    /// Returns true if timeouts are reported through the file descriptors, so that
+    /// [`next_timeout`](#method.next_timeout) does not need to be tracked.
+    pub fn handles_timeouts(&self) -> bool {
+        unsafe { libusb_pollfds_handle_timeouts(self.context.as_raw()) != 0 }
+    }
+
+    /// Returns how long until libusb needs to handle a pending timeout, or `None` if there is
+    /// none.
+    ///
+    /// A zero duration means that a timeout has already expired.
+    pub fn next_timeout(&self) -> crate::Result<Option<Duration>> {
+        let mut tv = timeval {
+            tv_sec: 0,
+            tv_usec: 0,
+        };
+        match unsafe { libusb_get_next_timeout(self.context.as_raw(), &mut tv) } {
+            0 => Ok(None),
+            n if n < 0 => Err(error::from_libusb(n)),
+            _ => Ok(Some(
+                Duration::from_secs(tv.tv_sec as u64) + Duration::from_micros(tv.tv_usec as u64),
+            )),
+        }
+    }
+
+    /// Handles any pending events without blocking.
+    ///
+    /// This should be called when one of the file descriptors is ready or the next timeout has
+    /// expired. Spurious calls are harmless.
+    pub fn handle_events(&self) -> crate::Result<()> {
+        let tv = timeval_from_duration(Duration::from_secs(0));
+        let n = unsafe {
+            libusb_handle_events_timeout_completed(self.context.as_raw(), &tv, ptr::null_mut())
+        };
+        if n < 0 && n != LIBUSB_ERROR_INTERRUPTED {
+            Err(error::from_libusb(n))
+        } else {
+            Ok(())
+        }
+    }
+
+    fn notifier(&self) -> &Mutex<Option<Notifier>> {
+        unsafe { self.notifier.as_ref() }
+    }
+}
+
+impl<T: UsbContext> Drop for AsyncContext<T> {
+    /// Restores libusb's default notifications.
+    fn drop(&mut self) {
+        unsafe {
+            libusb_set_pollfd_notifiers(self.context.as_raw(), None, None, ptr::null_mut());
+        }
+        // Wait for a notifier that might be running on another thread.
+        drop(self.notifier().lock());
+        unsafe { drop(Box::from_raw(self.notifier.as_ptr())) };
+    }
+}
+
+impl<T: UsbContext> Debug for AsyncContext<T> {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.debug_struct("AsyncContext")
+            .field("context", &self.context.as_raw())
+            .finish()
+    }
+}
+
+fn notify(user_data: *mut c_void, event: PollFdEvent) {
+    let notifier = unsafe { &*(user_data as *const Mutex<Option<Notifier>>) };
+    if let Some(notifier) = notifier
+        .lock()
+        .unwrap_or_else(|err| err.into_inner())
+        .as_mut()
+    {
+        notifier(event);
+    }
+}
+
+extern "system" fn pollfd_added(fd: c_int, events: c_short, user_data: *mut c_void) {
+    notify(user_data, PollFdEvent::Added(PollFd { fd, events }));
+}
+
+extern "system" fn pollfd_removed(fd: c_int, user_data: *mut c_void) {
+    notify(user_data, PollFdEvent::Removed(fd));
+}
+
+#[cfg(test)]
+mod test {
+    use super::PollFd;
+
+    #[test]
+    fn it_interprets_poll_events() {
+        let fd = PollFd {
+            fd: 3,
+            events: libc::POLLIN,
+        };
+        assert!(fd.readable());
+        assert!(!fd.writable());
+
+        let fd = PollFd {
+            fd: 4,
+            events: libc::POLLIN | libc::POLLOUT,
+        };
+        assert!(fd.readable());
+        assert!(fd.writable());
+    }
+}
@@ -0,0 +1,251 @@
+use std::{fmt, slice};
+
+use libusb1_sys::{constants::*, *};
+
+/// Describes the device-level capabilities of a device, read from its Binary Object Store.
+///
+/// Devices of USB 2.1 and later provide this descriptor. It tells, for instance, which speeds a
+/// SuperSpeed device supports and its link power management exit latencies.
+pub struct BosDescriptor {
+    descriptor: *const libusb_bos_descriptor,
+}
+
+impl Drop for BosDescriptor {
+    fn drop(&mut self) {
+        unsafe {
+            libusb_free_bos_descriptor(self.descriptor as *mut _);
+        }
+    }
+}
+
+unsafe impl Sync for BosDescriptor {}
+unsafe impl Send for BosDescriptor {}
+
+impl BosDescriptor {
+    /// Returns the number of device capabilities.
+    pub fn num_device_caps(&self) -> u8 {
+        unsafe { (*self.descriptor).bNumDeviceCaps }
+    }
+
+    /// Returns the device capabilities.
+    pub fn capabilities(&self) -> impl Iterator<Item = BosCapability<'_>> {
+        let capabilities = unsafe {
+            slice::from_raw_parts(
+                (*self.descriptor).dev_capability.as_ptr(),
+                (*self.descriptor).bNumDeviceCaps as usize,
+            )
+        };
+
+        capabilities.iter().map(|&capability| unsafe {
+            // libusb keeps every capability as the raw descriptor it was read as.
+            BosCapability {
+                data: slice::from_raw_parts(
+                    capability as *const u8,
+                    (*capability).bLength as usize,
+                ),
+            }
+        })
+    }
+
+    /// Returns the USB 2.0 extension capability, if the device has one.
+    pub fn usb_2_0_extension(&self) -> Option<Usb2ExtensionCapability> {
+        self.capabilities()
+            .find_map(|capability| capability.usb_2_0_extension())
+    }
+
+    /// Returns the SuperSpeed USB device capability, if the device has one.
+    pub fn ss_usb_device_capability(&self) -> Option<SsUsbDeviceCapability> {
+        self.capabilities()
+            .find_map(|capability| capability.ss_usb_device_capability())
+    }
+
+    /// Returns the container ID, a UUID shared by all functions of one physical device, if the
+    /// device has one.
+    pub fn container_id(&self) -> Option<[u8; 16]> {
+        self.capabilities()
+            .find_map(|capability| capability.container_id())
+    }
+}
+
+impl fmt::Debug for BosDescriptor {
+    fn fmt(&self, fmt: &mut fmt::Formatter) -> fmt::Result {
+        let mut debug = fmt.debug_struct("BosDescriptor");
+
+        let descriptor = unsafe { &*self.descriptor };
+
+        debug.field("bLength", &descriptor.bLength);
+        debug.field("bDescriptorType", &descriptor.bDescriptorType);
+        debug.field("wTotalLength", &descriptor.wTotalLength);
+        debug.field("bNumDeviceCaps", &descriptor.bNumDeviceCaps);
+
+        debug.finish()
+    }
+}
+
+/// A device capability descriptor in a [`BosDescriptor`].
+#[derive(Debug, Copy, Clone)]
+pub struct BosCapability<'a> {
+    data: &'a [u8],
+}
+
+impl<'a> BosCapability<'a> {
+    /// Returns the type of the capability, one of the `LIBUSB_BT_*` constants.
+    pub fn capability_type(&self) -> u8 {
+        self.data[2]
+    }
+
+    /// Returns the type-specific data following the descriptor header.
+    pub fn data(&self) -> &'a [u8] {
+        &self.data[3..]
+    }
+
+    /// Interprets the capability as a USB 2.0 extension.
+    pub fn usb_2_0_extension(&self) -> Option<Usb2ExtensionCapability> {
+        match *self.data {
+            [7, _, LIBUSB_BT_USB_2_0_EXTENSION, a, b, c, d] => Some(Usb2ExtensionCapability {
+                attributes: u32::from_le_bytes([a, b, c, d]),
+            }),
+            _ => None,
+        }
+    }
+
+    /// Interprets the capability as a SuperSpeed USB device capability.
+    pub fn ss_usb_device_capability(&self) -> Option<SsUsbDeviceCapability> {
+        match *self.data {
+            [10, _, LIBUSB_BT_SS_USB_DEVICE_CAPABILITY, attributes, s0, s1, functionality, u1, u2_0, u2_1] => {
+                Some(SsUsbDeviceCapability {
+                    attributes,
+                    speeds_supported: u16::from_le_bytes([s0, s1]),
+                    functionality_support: functionality,
+                    u1_exit_latency: u1,
+                    u2_exit_latency: u16::from_le_bytes([u2_0, u2_1]),
+                })
+            }
+            _ => None,
+        }
+    }
+
+    /// Interprets the capability as a container ID.
+    pub fn container_id(&self) -> Option<[u8; 16]> {
+        if self.data.len() == 20 && self.capability_type() == LIBUSB_BT_CONTAINER_ID {
+            let mut id = [0; 16];
+            id.copy_from_slice(&self.data[4..20]);
+            Some(id)
+        } else {
+            None
+        }
+    }
+}
+
+/// Describes the USB 2.0 link power management capabilities of a device.
+#[derive(Debug, Copy, Clone, Eq, PartialEq)]
+pub struct Usb2ExtensionCapability {
+    attributes: u32,
+}
+
+impl Usb2ExtensionCapability {
+    /// Returns the raw `bmAttributes` bit map.
+    pub fn attributes(&self) -> u32 {
+        self.attributes
+    }
+
+    /// Indicates if the device supports Link Power Management.
+    pub fn lpm_supported(&self) -> bool {
+        self.attributes & 0x02 != 0
+    }
+}
+
+/// Describes the SuperSpeed capabilities of a device.
+#[derive(Debug, Copy, Clone, Eq, PartialEq)]
+pub struct SsUsbDeviceCapability {
+    attributes: u8,
+    speeds_supported: u16,
+    functionality_support: u8,
+    u1_exit_latency: u8,
+    u2_exit_latency: u16,
+}
+
+impl SsUsbDeviceCapability {
+    /// Indicates if the device can generate Latency Tolerance Messages.
+    pub fn ltm_capable(&self) -> bool {
+        self.attributes & 0x02 != 0
+    }
+
+    /// Returns the bit map of supported speeds: bit 0 for low speed, 1 for full speed, 2 for
+    /// high speed and 3 for SuperSpeed (5 Gbps).
+    pub fn speeds_supported(&self) -> u16 {
+        self.speeds_supported
+    }
+
+    /// Indicates if the device operates at SuperSpeed.
+    pub fn supports_super_speed(&self) -> bool {
+        self.speeds_supported & 0x08 != 0
+    }
+
+    /// Returns the lowest speed at which all of the device's functionality is available, as a
+    /// bit number of [`speeds_supported`](#method.speeds_supported).
+    pub fn functionality_support(&self) -> u8 {
+        self.functionality_support
+    }
+
+    /// Returns the U1 device exit latency in microseconds.
+    pub fn u1_exit_latency(&self) -> u8 {
+        self.u1_exit_latency
+    }
+
+    /// Returns the U2 device exit latency in microseconds.
+    pub fn u2_exit_latency(&self) -> u16 {
+        self.u2_exit_latency
+    }
+}
+
+#[doc(hidden)]
+pub(crate) unsafe fn from_libusb(bos: *const libusb_bos_descriptor) -> BosDescriptor {
+    BosDescriptor { descriptor: bos }
+}
+
+#[cfg(test)]
+mod test {
+    use super::BosCapability;
+
+    #[test]
+    fn it_parses_usb_2_0_extension() {
+        let capability = BosCapability {
+            data: &[7, 0x10, 0x02, 0x06, 0, 0, 0],
+        };
+
+        let extension = capability.usb_2_0_extension().unwrap();
+        assert!(extension.lpm_supported());
+        assert_eq!(6, extension.attributes());
+        assert!(capability.ss_usb_device_capability().is_none());
+    }
+
+    #[test]
+    fn it_parses_ss_usb_device_capability() {
+        let capability = BosCapability {
+            data: &[10, 0x10, 0x03, 0x00, 0x0e, 0x00, 0x01, 0x0a, 0xff, 0x07],
+        };
+
+        let ss = capability.ss_usb_device_capability().unwrap();
+        assert!(!ss.ltm_capable());
+        assert!(ss.supports_super_speed());
+        assert_eq!(0x0e, ss.speeds_supported());
+        assert_eq!(1, ss.functionality_support());
+        assert_eq!(10, ss.u1_exit_latency());
+        assert_eq!(2047, ss.u2_exit_latency());
+    }
+
+    #[test]
+    fn it_parses_container_id() {
+        let mut data = vec![20, 0x10, 0x04, 0];
+        data.extend(1..=16);
+        let capability = BosCapability { data: &data };
+
+        assert_eq!(0x04, capability.capability_type());
+        assert_eq!(
+            Some([1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16]),
+            capability.container_id()
+        );
+        assert!(capability.usb_2_0_extension().is_none());
+    }
+}
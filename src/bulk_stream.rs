@@ -0,0 +1,384 @@
+use std::{
+    cmp,
+    collections::VecDeque,
+    io::{self, BufRead, Read, Write},
+    time::{Duration, Instant},
+};
+
+use libusb1_sys::constants::*;
+
+use crate::{device_handle::DeviceHandle, error::Error, transfer::Transfer, UsbContext};
+
+/// Throughput counters of a [`BulkReader`] or [`BulkWriter`].
+#[derive(Debug, Copy, Clone)]
+pub struct StreamStats {
+    bytes: u64,
+    transfers: u64,
+    started: Instant,
+}
+
+impl StreamStats {
+    fn new() -> Self {
+        StreamStats {
+            bytes: 0,
+            transfers: 0,
+            started: Instant::now(),
+        }
+    }
+
+    fn record(&mut self, len: usize) {
+        self.bytes += len as u64;
+        self.transfers += 1;
+    }
+
+    /// Returns the number of bytes moved over the endpoint.
+    pub fn bytes(&self) -> u64 {
+        self.bytes
+    }
+
+    /// Returns the number of transfers that completed.
+    pub fn transfers(&self) -> u64 {
+        self.transfers
+    }
+
+    /// Returns the time since the stream was created.
+    pub fn elapsed(&self) -> Duration {
+        self.started.elapsed()
+    }
+
+    /// Returns the average throughput since the stream was created, in bytes per second.
+    pub fn bytes_per_second(&self) -> f64 {
+        let secs = self.elapsed().as_secs_f64();
+        if secs > 0.0 {
+            self.bytes as f64 / secs
+        } else {
+            0.0
+        }
+    }
+}
+
+/// A pipelined reader for a bulk IN endpoint.
+///
+/// The reader owns a fixed ring of transfers which are all kept submitted, so the host controller
+/// always has buffers queued for the endpoint even while the caller is busy. Completed buffers are
+/// handed back in submission order through [`BufRead`] or [`Read`], and each buffer is resubmitted
+/// as soon as it has been consumed.
+///
+/// Events are handled on the calling thread while it waits for data, unless another thread is
+/// already handling events for the context.
+pub struct BulkReader<'d, T: UsbContext> {
+    // Submitted transfers, oldest first.
+    transfers: VecDeque<Transfer<'d, T>>,
+    // Completed transfer whose data is being consumed.
+    current: Option<Transfer<'d, T>>,
+    consumed: usize,
+    stats: StreamStats,
+}
+
+impl<'d, T: UsbContext> BulkReader<'d, T> {
+    /// Creates a reader for `endpoint` and submits `num_transfers` transfers of `transfer_size`
+    /// bytes each.
+    ///
+    /// Reads that need data block until the oldest transfer completes. `timeout` applies to each
+    /// transfer individually.
+    ///
+    /// ## Errors
+    ///
+    /// * `InvalidParam` if the endpoint is not an input endpoint, or `num_transfers` or
+    ///   `transfer_size` is zero.
+    /// * Any error returned while allocating or submitting the transfers.
+    pub fn new(
+        handle: &'d DeviceHandle<T>,
+        endpoint: u8,
+        num_transfers: usize,
+        transfer_size: usize,
+        timeout: Duration,
+    ) -> crate::Result<Self> {
+        if endpoint & LIBUSB_ENDPOINT_DIR_MASK != LIBUSB_ENDPOINT_IN
+            || num_transfers == 0
+            || transfer_size == 0
+        {
+            return Err(Error::InvalidParam);
+        }
+
+        let mut transfers = VecDeque::with_capacity(num_transfers);
+        for _ in 0..num_transfers {
+            let mut transfer = Transfer::bulk(
+                handle,
+                endpoint,
+                handle.alloc_buffer(transfer_size)?,
+                timeout,
+            )?;
+            transfer.submit()?;
+            transfers.push_back(transfer);
+        }
+
+        Ok(BulkReader {
+            transfers,
+            current: None,
+            consumed: 0,
+            stats: StreamStats::new(),
+        })
+    }
+
+    /// Returns the throughput counters of this reader.
+    pub fn stats(&self) -> StreamStats {
+        self.stats
+    }
+
+    /// Returns the number of transfers currently queued on the endpoint.
+    pub fn in_flight(&self) -> usize {
+        self.transfers.iter().filter(|t| t.is_pending()).count()
+    }
+
+    /// Waits for the oldest transfer to complete, leaving it in `current`.
+    fn next_transfer(&mut self) -> crate::Result<()> {
+        let mut transfer = self.transfers.pop_front().ok_or(Error::Other)?;
+
+        if !transfer.is_pending() && !transfer.is_completed() {
+            // An earlier resubmission failed; retry it so the error surfaces here.
+            if let Err(err) = transfer.submit() {
+                self.transfers.push_front(transfer);
+                return Err(err);
+            }
+        }
+
+        let result = match transfer.wait(None) {
+            // A timed out transfer may still have received data.
+            Err(Error::Timeout) if transfer.actual_length() > 0 => Ok(transfer.actual_length()),
+            result => result,
+        };
+
+        match result {
+            Ok(len) => {
+                self.stats.record(len);
+                self.current = Some(transfer);
+                self.consumed = 0;
+                Ok(())
+            }
+            Err(err) => {
+                let _ = transfer.submit();
+                self.transfers.push_back(transfer);
+                Err(err)
+            }
+        }
+    }
+}
+
+impl<'d, T: UsbContext> BufRead for BulkReader<'d, T> {
+    fn fill_buf(&mut self) -> io::Result<&[u8]> {
+        loop {
+            let available = match self.current {
+                Some(ref current) => current.actual_length() - self.consumed,
+                None => 0,
+            };
+            if available > 0 {
+                break;
+            }
+
+            if let Some(mut current) = self.current.take() {
+                let _ = current.submit();
+                self.transfers.push_back(current);
+            }
+            self.next_transfer()?;
+        }
+
+        let current = self.current.as_ref().unwrap();
+        Ok(&current.buffer()[self.consumed..current.actual_length()])
+    }
+
+    fn consume(&mut self, amt: usize) {
+        self.consumed += amt;
+    }
+}
+
+impl<'d, T: UsbContext> Read for BulkReader<'d, T> {
+    fn read(&mut self, buf: &mut [u8]) -> io::Result<usize> {
+        if buf.is_empty() {
+            return Ok(0);
+        }
+
+        let n = {
+            let data = self.fill_buf()?;
+            let n = cmp::min(data.len(), buf.len());
+            buf[..n].copy_from_slice(&data[..n]);
+            n
+        };
+        self.consume(n);
+        Ok(n)
+    }
+}
+
+/// A pipelined writer for a bulk OUT endpoint.
+///
+/// Written data is gathered into a fixed ring of transfer buffers. Every full buffer is submitted
+/// immediately, and writes only block when all buffers are in flight. [`flush`](#method.flush)
+/// submits a partially filled buffer and waits until all queued data has been sent.
+///
+/// Dropping the writer flushes it, ignoring any error.
+pub struct BulkWriter<'d, T: UsbContext> {
+    // Transfers that are neither queued nor being filled.
+    idle: Vec<Transfer<'d, T>>,
+    // Submitted transfers, oldest first.
+    transfers: VecDeque<Transfer<'d, T>>,
+    // Transfer being filled and how many bytes it holds.
+    current: Option<Transfer<'d, T>>,
+    filled: usize,
+    stats: StreamStats,
+}
+
+impl<'d, T: UsbContext> Drop for BulkWriter<'d, T> {
+    fn drop(&mut self) {
+        let _ = self.flush();
+    }
+}
+
+impl<'d, T: UsbContext> BulkWriter<'d, T> {
+    /// Creates a writer for `endpoint` with `num_transfers` buffers of `transfer_size` bytes
+    /// each.
+    ///
+    /// `timeout` applies to each transfer individually.
+    ///
+    /// ## Errors
+    ///
+    /// * `InvalidParam` if the endpoint is not an output endpoint, or `num_transfers` or
+    ///   `transfer_size` is zero.
+    /// * Any error returned while allocating the transfers.
+    pub fn new(
+        handle: &'d DeviceHandle<T>,
+        endpoint: u8,
+        num_transfers: usize,
+        transfer_size: usize,
+        timeout: Duration,
+    ) -> crate::Result<Self> {
+        if endpoint & LIBUSB_ENDPOINT_DIR_MASK != LIBUSB_ENDPOINT_OUT
+            || num_transfers == 0
+            || transfer_size == 0
+        {
+            return Err(Error::InvalidParam);
+        }
+
+        let idle = (0..num_transfers)
+            .map(|_| {
+                Transfer::bulk(
+                    handle,
+                    endpoint,
+                    handle.alloc_buffer(transfer_size)?,
+                    timeout,
+                )
+            })
+            .collect::<crate::Result<Vec<_>>>()?;
+
+        Ok(BulkWriter {
+            idle,
+            transfers: VecDeque::with_capacity(num_transfers),
+            current: None,
+            filled: 0,
+            stats: StreamStats::new(),
+        })
+    }
+
+    /// Returns the throughput counters of this writer.
+    pub fn stats(&self) -> StreamStats {
+        self.stats
+    }
+
+    /// Returns the number of transfers currently queued on the endpoint.
+    pub fn in_flight(&self) -> usize {
+        self.transfers.len()
+    }
+
+    /// Waits for the oldest queued transfer to complete and makes it idle.
+    fn reap(&mut self) -> crate::Result<()> {
+        let mut transfer = match self.transfers.pop_front() {
+            Some(transfer) => transfer,
+            None => return Ok(()),
+        };
+        let result = transfer.wait(None);
+        self.idle.push(transfer);
+
+        let len = result?;
+        self.stats.record(len);
+        Ok(())
+    }
+
+    /// Submits the transfer being filled, if it holds any data.
+    fn submit_current(&mut self) -> crate::Result<()> {
+        if let Some(mut transfer) = self.current.take() {
+            if self.filled == 0 {
+                self.idle.push(transfer);
+                return Ok(());
+            }
+
+            transfer.set_length(self.filled)?;
+            self.filled = 0;
+            if let Err(err) = transfer.submit() {
+                self.idle.push(transfer);
+                return Err(err);
+            }
+            self.transfers.push_back(transfer);
+        }
+        Ok(())
+    }
+}
+
+impl<'d, T: UsbContext> Write for BulkWriter<'d, T> {
+    fn write(&mut self, buf: &[u8]) -> io::Result<usize> {
+        if buf.is_empty() {
+            return Ok(0);
+        }
+
+        if self.current.is_none() {
+            if self.idle.is_empty() {
+                self.reap()?;
+            }
+            self.current = self.idle.pop();
+            self.filled = 0;
+        }
+
+        let n = {
+            let transfer = self.current.as_mut().unwrap();
+            let space = &mut transfer.buffer_mut()[self.filled..];
+            let n = cmp::min(space.len(), buf.len());
+            space[..n].copy_from_slice(&buf[..n]);
+            n
+        };
+        self.filled += n;
+
+        if self.filled == self.current.as_ref().unwrap().buffer().len() {
+            self.submit_current()?;
+        }
+        Ok(n)
+    }
+
+    fn flush(&mut self) -> io::Result<()> {
+        self.submit_current()?;
+
+        let mut result = Ok(());
+        while !self.transfers.is_empty() {
+            if let Err(err) = self.reap() {
+                if result.is_ok() {
+                    result = Err(err);
+                }
+            }
+        }
+        result.map_err(io::Error::from)
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::StreamStats;
+
+    #[test]
+    fn it_counts_bytes_and_transfers() {
+        let mut stats = StreamStats::new();
+        stats.record(512);
+        stats.record(0);
+        stats.record(1024);
+
+        assert_eq!(1536, stats.bytes());
+        assert_eq!(3, stats.transfers());
+        assert!(stats.bytes_per_second() >= 0.0);
+    }
+}
@@ -0,0 +1,138 @@
+use std::{
+    collections::HashSet,
+    fmt::{self, Debug},
+    ptr::NonNull,
+    sync::{Arc, Mutex, MutexGuard},
+};
+
+use libusb1_sys::*;
+
+use crate::error::Error;
+
+#[derive(Default)]
+struct TokenState {
+    cancelled: bool,
+    // Transfers submitted under the token, registered until they are freed.
+    transfers: HashSet<usize>,
+}
+
+/// Cancels every [`Transfer`](struct.Transfer.html) submitted under it at once.
+///
+/// A token is attached to transfers with
+/// [`Transfer::set_cancellation_token`](struct.Transfer.html#method.set_cancellation_token).
+/// Every [`DeviceHandle`](struct.DeviceHandle.html) also has a token of its own, which covers all
+/// transfers created for it. Clones share the same state, so a token can be cancelled from any
+/// thread.
+///
+/// Once cancelled, the transfers in flight complete with
+/// [`TransferStatus::Cancelled`](enum.TransferStatus.html#variant.Cancelled) as soon as `libusb`
+/// has processed the cancellation, regardless of their timeouts, and further submissions fail
+/// with `Interrupted` until the token is [`reset`](#method.reset).
+#[derive(Clone, Default)]
+pub struct CancellationToken {
+    state: Arc<Mutex<TokenState>>,
+}
+
+impl CancellationToken {
+    /// Creates a token that is not cancelled.
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Cancels all transfers in flight under this token and refuses new submissions.
+    pub fn cancel(&self) {
+        let mut state = self.state();
+        state.cancelled = true;
+        for &transfer in state.transfers.iter() {
+            // Transfers that are not in flight report `NotFound`, which is harmless.
+            unsafe { libusb_cancel_transfer(transfer as *mut libusb_transfer) };
+        }
+    }
+
+    /// Returns `true` if the token has been cancelled and not reset since.
+    pub fn is_cancelled(&self) -> bool {
+        self.state().cancelled
+    }
+
+    /// Allows submissions under this token again.
+    pub fn reset(&self) {
+        self.state().cancelled = false;
+    }
+
+    /// Registers `transfer` and runs `submit` for it, unless the token is cancelled.
+    ///
+    /// The lock is held while submitting, so that a concurrent `cancel` either sees the transfer
+    /// in flight or prevents its submission.
+    pub(crate) fn submit<F>(
+        &self,
+        transfer: NonNull<libusb_transfer>,
+        submit: F,
+    ) -> crate::Result<()>
+    where
+        F: FnOnce() -> crate::Result<()>,
+    {
+        let mut state = self.state();
+        if state.cancelled {
+            return Err(Error::Interrupted);
+        }
+        state.transfers.insert(transfer.as_ptr() as usize);
+        submit()
+    }
+
+    /// Forgets `transfer`, which is about to be freed.
+    pub(crate) fn unregister(&self, transfer: NonNull<libusb_transfer>) {
+        self.state().transfers.remove(&(transfer.as_ptr() as usize));
+    }
+
+    fn state(&self) -> MutexGuard<'_, TokenState> {
+        self.state.lock().unwrap_or_else(|err| err.into_inner())
+    }
+}
+
+impl Debug for CancellationToken {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        let state = self.state();
+        f.debug_struct("CancellationToken")
+            .field("cancelled", &state.cancelled)
+            .field("transfers", &state.transfers.len())
+            .finish()
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use std::ptr::NonNull;
+
+    use super::CancellationToken;
+    use crate::Error;
+
+    #[test]
+    fn it_refuses_submissions_once_cancelled() {
+        let token = CancellationToken::new();
+        let transfer = NonNull::dangling();
+
+        let mut submitted = 0;
+        assert_eq!(
+            Ok(()),
+            token.submit(transfer, || {
+                submitted += 1;
+                Ok(())
+            })
+        );
+        token.unregister(transfer);
+
+        token.cancel();
+        assert!(token.clone().is_cancelled());
+        assert_eq!(
+            Err(Error::Interrupted),
+            token.submit(transfer, || {
+                submitted += 1;
+                Ok(())
+            })
+        );
+        assert_eq!(1, submitted);
+
+        token.reset();
+        assert!(!token.is_cancelled());
+    }
+}
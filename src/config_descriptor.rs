@@ -1,18 +1,26 @@
-use std::{fmt, slice};
+use std::{fmt, ptr, slice};
 
-use libusb1_sys::*;
+use libc::c_int;
+use libusb1_sys::{constants::*, *};
 
-use crate::interface_descriptor::{self, Interface};
+use crate::{
+    error::Error,
+    interface_descriptor::{self, Interface},
+};
 
 /// Describes a configuration.
 pub struct ConfigDescriptor {
     descriptor: *const libusb_config_descriptor,
+    // Set if the descriptor was parsed by this crate rather than allocated by libusb.
+    owned: Option<Box<OwnedConfig>>,
 }
 
 impl Drop for ConfigDescriptor {
     fn drop(&mut self) {
-        unsafe {
-            libusb_free_config_descriptor(self.descriptor);
+        if self.owned.is_none() {
+            unsafe {
+                libusb_free_config_descriptor(self.descriptor);
+            }
         }
     }
 }
@@ -125,7 +133,299 @@ impl<'a> Iterator for Interfaces<'a> {
 
 #[doc(hidden)]
 pub(crate) unsafe fn from_libusb(config: *const libusb_config_descriptor) -> ConfigDescriptor {
-    ConfigDescriptor { descriptor: config }
+    ConfigDescriptor {
+        descriptor: config,
+        owned: None,
+    }
+}
+
+/// A descriptor tree laid out like libusb's, in memory owned by this crate.
+///
+/// The pointers in the structures point into the other fields, whose heap allocations do not
+/// move with the `OwnedConfig`.
+struct OwnedConfig {
+    config: Box<libusb_config_descriptor>,
+    _interfaces: Vec<libusb_interface>,
+    _settings: Vec<Vec<libusb_interface_descriptor>>,
+    _endpoints: Vec<Vec<libusb_endpoint_descriptor>>,
+    // The raw descriptor, which the extra bytes point into.
+    _raw: Vec<u8>,
+}
+
+/// Returns the end of the descriptors at `pos` that are not of one of the `stop` types.
+fn skip_extra(raw: &[u8], mut pos: usize, stop: &[u8]) -> crate::Result<usize> {
+    while pos + 2 <= raw.len() {
+        let len = raw[pos] as usize;
+        if len < 2 || pos + len > raw.len() {
+            return Err(Error::BadDescriptor);
+        }
+        if stop.contains(&raw[pos + 1]) {
+            break;
+        }
+        pos += len;
+    }
+    Ok(pos)
+}
+
+/// Returns the `len` byte descriptor at `pos`, checking its type and minimum length.
+fn descriptor_at(raw: &[u8], pos: usize, kind: u8, min_len: usize) -> crate::Result<&[u8]> {
+    if pos + 2 > raw.len() || raw[pos + 1] != kind {
+        return Err(Error::BadDescriptor);
+    }
+    let len = raw[pos] as usize;
+    if len < min_len || pos + len > raw.len() {
+        return Err(Error::BadDescriptor);
+    }
+    Ok(&raw[pos..pos + len])
+}
+
+fn extra_ptr(raw: &[u8], start: usize, end: usize) -> (*const u8, c_int) {
+    if end > start {
+        (raw[start..end].as_ptr(), (end - start) as c_int)
+    } else {
+        (ptr::null(), 0)
+    }
+}
+
+const CONFIG_SIZE: usize = 9;
+const INTERFACE_SIZE: usize = 9;
+const ENDPOINT_SIZE: usize = 7;
+// Endpoint descriptors of audio devices carry bRefresh and bSynchAddress.
+const ENDPOINT_AUDIO_SIZE: usize = 9;
+
+// Descriptors that end the extra bytes of an interface or endpoint.
+const STOP: [u8; 4] = [
+    LIBUSB_DT_ENDPOINT,
+    LIBUSB_DT_INTERFACE,
+    LIBUSB_DT_CONFIG,
+    LIBUSB_DT_DEVICE,
+];
+
+/// Parses a configuration descriptor as sent by a device, including all descriptors that follow
+/// it within `wTotalLength`.
+///
+/// Descriptors are grouped into interfaces, alternate settings and endpoints, and unknown
+/// descriptors become the extra bytes of the preceding one, as libusb does.
+pub(crate) fn from_raw(raw: &[u8]) -> crate::Result<ConfigDescriptor> {
+    let header = descriptor_at(raw, 0, LIBUSB_DT_CONFIG, CONFIG_SIZE)?;
+    let total = u16::from_le_bytes([header[2], header[3]]) as usize;
+    if total < header.len() || total > raw.len() {
+        return Err(Error::BadDescriptor);
+    }
+    let raw = raw[..total].to_vec();
+
+    // (interface descriptor, extra range, endpoints), grouped by interface number.
+    type Setting = (
+        libusb_interface_descriptor,
+        (usize, usize),
+        Vec<libusb_endpoint_descriptor>,
+    );
+    let mut groups: Vec<Vec<Setting>> = Vec::new();
+
+    let mut pos = raw[0] as usize;
+    let config_extra = (pos, skip_extra(&raw, pos, &[LIBUSB_DT_INTERFACE])?);
+    pos = config_extra.1;
+
+    while pos < total {
+        let d = descriptor_at(&raw, pos, LIBUSB_DT_INTERFACE, INTERFACE_SIZE)?;
+        let mut setting = libusb_interface_descriptor {
+            bLength: d[0],
+            bDescriptorType: d[1],
+            bInterfaceNumber: d[2],
+            bAlternateSetting: d[3],
+            bNumEndpoints: d[4],
+            bInterfaceClass: d[5],
+            bInterfaceSubClass: d[6],
+            bInterfaceProtocol: d[7],
+            iInterface: d[8],
+            endpoint: ptr::null(),
+            extra: ptr::null(),
+            extra_length: 0,
+        };
+        pos += d.len();
+        let setting_extra = (pos, skip_extra(&raw, pos, &STOP)?);
+        pos = setting_extra.1;
+
+        let mut endpoints = Vec::with_capacity(setting.bNumEndpoints as usize);
+        for _ in 0..setting.bNumEndpoints {
+            let d = descriptor_at(&raw, pos, LIBUSB_DT_ENDPOINT, ENDPOINT_SIZE)?;
+            let audio = d.len() >= ENDPOINT_AUDIO_SIZE;
+            let start = pos + d.len();
+            let end = skip_extra(&raw, start, &STOP)?;
+            let (extra, extra_length) = extra_ptr(&raw, start, end);
+            endpoints.push(libusb_endpoint_descriptor {
+                bLength: d[0],
+                bDescriptorType: d[1],
+                bEndpointAddress: d[2],
+                bmAttributes: d[3],
+                wMaxPacketSize: u16::from_le_bytes([d[4], d[5]]),
+                bInterval: d[6],
+                bRefresh: if audio { d[7] } else { 0 },
+                bSynchAddress: if audio { d[8] } else { 0 },
+                extra,
+                extra_length,
+            });
+            pos = end;
+        }
+        setting.bNumEndpoints = endpoints.len() as u8;
+
+        match groups.last_mut() {
+            Some(group) if group[0].0.bInterfaceNumber == setting.bInterfaceNumber => {
+                group.push((setting, setting_extra, endpoints))
+            }
+            _ => groups.push(vec![(setting, setting_extra, endpoints)]),
+        }
+    }
+
+    let mut settings = Vec::with_capacity(groups.len());
+    let mut all_endpoints = Vec::new();
+    for group in groups {
+        let mut group_settings = Vec::with_capacity(group.len());
+        for (mut setting, (start, end), endpoints) in group {
+            let (extra, extra_length) = extra_ptr(&raw, start, end);
+            setting.extra = extra;
+            setting.extra_length = extra_length;
+            setting.endpoint = if endpoints.is_empty() {
+                ptr::null()
+            } else {
+                endpoints.as_ptr()
+            };
+            group_settings.push(setting);
+            all_endpoints.push(endpoints);
+        }
+        settings.push(group_settings);
+    }
+
+    let interfaces = settings
+        .iter()
+        .map(|group| libusb_interface {
+            altsetting: group.as_ptr(),
+            num_altsetting: group.len() as c_int,
+        })
+        .collect::<Vec<_>>();
+
+    let (extra, extra_length) = extra_ptr(&raw, config_extra.0, config_extra.1);
+    let config = Box::new(libusb_config_descriptor {
+        bLength: raw[0],
+        bDescriptorType: raw[1],
+        wTotalLength: total as u16,
+        bNumInterfaces: interfaces.len() as u8,
+        bConfigurationValue: raw[5],
+        iConfiguration: raw[6],
+        bmAttributes: raw[7],
+        bMaxPower: raw[8],
+        interface: if interfaces.is_empty() {
+            ptr::null()
+        } else {
+            interfaces.as_ptr()
+        },
+        extra,
+        extra_length,
+    });
+
+    let owned = Box::new(OwnedConfig {
+        config,
+        _interfaces: interfaces,
+        _settings: settings,
+        _endpoints: all_endpoints,
+        _raw: raw,
+    });
+    Ok(ConfigDescriptor {
+        descriptor: &*owned.config,
+        owned: Some(owned),
+    })
+}
+
+unsafe fn extra_bytes<'a>(extra: *const u8, len: c_int) -> &'a [u8] {
+    if extra.is_null() || len <= 0 {
+        &[]
+    } else {
+        slice::from_raw_parts(extra, len as usize)
+    }
+}
+
+/// Appends `config` to `out` in the layout a device sends it in, which
+/// [`from_raw`](fn.from_raw.html) reads back.
+pub(crate) fn write_raw(config: &ConfigDescriptor, out: &mut Vec<u8>) {
+    let start = out.len();
+    unsafe {
+        let c = &*config.descriptor;
+        out.extend_from_slice(&[
+            CONFIG_SIZE as u8,
+            LIBUSB_DT_CONFIG,
+            0,
+            0,
+            c.bNumInterfaces,
+            c.bConfigurationValue,
+            c.iConfiguration,
+            c.bmAttributes,
+            c.bMaxPower,
+        ]);
+        out.extend_from_slice(extra_bytes(c.extra, c.extra_length));
+
+        let interfaces = if c.interface.is_null() {
+            &[][..]
+        } else {
+            slice::from_raw_parts(c.interface, c.bNumInterfaces as usize)
+        };
+        for interface in interfaces {
+            let settings = if interface.altsetting.is_null() {
+                &[][..]
+            } else {
+                slice::from_raw_parts(interface.altsetting, interface.num_altsetting as usize)
+            };
+            for s in settings {
+                out.extend_from_slice(&[
+                    INTERFACE_SIZE as u8,
+                    LIBUSB_DT_INTERFACE,
+                    s.bInterfaceNumber,
+                    s.bAlternateSetting,
+                    s.bNumEndpoints,
+                    s.bInterfaceClass,
+                    s.bInterfaceSubClass,
+                    s.bInterfaceProtocol,
+                    s.iInterface,
+                ]);
+                out.extend_from_slice(extra_bytes(s.extra, s.extra_length));
+
+                let endpoints = if s.endpoint.is_null() {
+                    &[][..]
+                } else {
+                    slice::from_raw_parts(s.endpoint, s.bNumEndpoints as usize)
+                };
+                for e in endpoints {
+                    let [lo, hi] = e.wMaxPacketSize.to_le_bytes();
+                    if e.bLength >= ENDPOINT_AUDIO_SIZE as u8 {
+                        out.extend_from_slice(&[
+                            ENDPOINT_AUDIO_SIZE as u8,
+                            LIBUSB_DT_ENDPOINT,
+                            e.bEndpointAddress,
+                            e.bmAttributes,
+                            lo,
+                            hi,
+                            e.bInterval,
+                            e.bRefresh,
+                            e.bSynchAddress,
+                        ]);
+                    } else {
+                        out.extend_from_slice(&[
+                            ENDPOINT_SIZE as u8,
+                            LIBUSB_DT_ENDPOINT,
+                            e.bEndpointAddress,
+                            e.bmAttributes,
+                            lo,
+                            hi,
+                            e.bInterval,
+                        ]);
+                    }
+                    out.extend_from_slice(extra_bytes(e.extra, e.extra_length));
+                }
+            }
+        }
+    }
+
+    let total = ((out.len() - start) as u16).to_le_bytes();
+    out[start + 2..start + 4].copy_from_slice(&total);
 }
 
 #[cfg(test)]
@@ -218,4 +518,90 @@ mod test {
             assert_eq!(vec![1], interface_numbers);
         });
     }
+
+    // A configuration with a class descriptor after it, a HID interface whose class descriptor
+    // precedes its endpoint, and an interface with two alternate settings.
+    const RAW: [u8; 55] = [
+        0x09, 0x02, 0x37, 0x00, 0x02, 0x01, 0x04, 0x80, 0x32, // configuration
+        0x03, 0x24, 0x01, // class descriptor
+        0x09, 0x04, 0x00, 0x00, 0x01, 0x03, 0x00, 0x00, 0x05, // interface 0
+        0x09, 0x21, 0x11, 0x01, 0x00, 0x01, 0x22, 0x20, 0x00, // HID descriptor
+        0x07, 0x05, 0x81, 0x03, 0x40, 0x00, 0x0a, // endpoint 0x81
+        0x09, 0x04, 0x01, 0x00, 0x00, 0xff, 0x00, 0x00, 0x00, // interface 1
+        0x09, 0x04, 0x01, 0x01, 0x00, 0xff, 0x00, 0x00, 0x00, // interface 1, alternate 1
+    ];
+
+    #[test]
+    fn it_parses_raw_descriptors() {
+        let config = super::from_raw(&RAW).unwrap();
+
+        assert_eq!(1, config.number());
+        assert_eq!(Some(4), config.description_string_index());
+        assert_eq!(Some(&[0x03, 0x24, 0x01][..]), config.extra());
+        assert_eq!(2, config.num_interfaces());
+
+        let interfaces = config.interfaces().collect::<Vec<_>>();
+        assert_eq!(1, interfaces[0].descriptors().count());
+        assert_eq!(2, interfaces[1].descriptors().count());
+
+        let setting = interfaces[0].descriptors().next().unwrap();
+        assert_eq!(Some(5), setting.description_string_index());
+        assert_eq!(Some(&RAW[21..30]), setting.extra());
+
+        let endpoint = setting.endpoint_descriptors().next().unwrap();
+        assert_eq!(0x81, endpoint.address());
+        assert_eq!(64, endpoint.max_packet_size());
+        assert_eq!(10, endpoint.interval());
+    }
+
+    #[test]
+    fn it_writes_raw_descriptors_back() {
+        let config = super::from_raw(&RAW).unwrap();
+
+        let mut raw = vec![0xee];
+        super::write_raw(&config, &mut raw);
+        assert_eq!(&RAW[..], &raw[1..]);
+
+        let endpoint =
+            endpoint_descriptor!(bEndpointAddress: 0x02, bmAttributes: 0x02, wMaxPacketSize: 512);
+        with_config!(config: config_descriptor!(interface!(interface_descriptor!(endpoint))) => {
+            let mut raw = Vec::new();
+            super::write_raw(&config, &mut raw);
+            assert_eq!(25, raw.len());
+            assert_eq!([25, 0], raw[2..4]);
+
+            let parsed = super::from_raw(&raw).unwrap();
+            let interface = parsed.interfaces().next().unwrap();
+            let setting = interface.descriptors().next().unwrap();
+            let endpoint = setting.endpoint_descriptors().next().unwrap();
+            assert_eq!(0x02, endpoint.address());
+            assert_eq!(512, endpoint.max_packet_size());
+        });
+    }
+
+    #[test]
+    fn it_rejects_malformed_raw_descriptors() {
+        use crate::Error;
+
+        // Truncated below wTotalLength.
+        assert_eq!(
+            Some(Error::BadDescriptor),
+            super::from_raw(&RAW[..40]).err()
+        );
+        // Not a configuration descriptor.
+        assert_eq!(
+            Some(Error::BadDescriptor),
+            super::from_raw(&RAW[12..]).err()
+        );
+
+        // A zero length descriptor.
+        let mut raw = RAW;
+        raw[9] = 0;
+        assert_eq!(Some(Error::BadDescriptor), super::from_raw(&raw).err());
+
+        // Interface 0 declares two endpoints.
+        let mut raw = RAW;
+        raw[16] = 2;
+        assert_eq!(Some(Error::BadDescriptor), super::from_raw(&raw).err());
+    }
 }
@@ -1,8 +1,23 @@
-use libc::{c_int, c_void, timeval};
-
-use std::{mem, ptr, sync::Arc, sync::Once, time::Duration};
-
-use crate::{device::Device, device_handle::DeviceHandle, device_list::DeviceList, error};
+use libc::{c_int, c_uint, c_void, timeval};
+
+#[cfg(unix)]
+use std::os::unix::io::RawFd;
+use std::{
+    mem, ptr,
+    sync::atomic::{AtomicI32, Ordering},
+    sync::Arc,
+    sync::Once,
+    time::{Duration, Instant},
+};
+
+use crate::{
+    device::Device,
+    device_handle::DeviceHandle,
+    device_list::DeviceList,
+    error,
+    hotplug::HotplugBuilder,
+    log_callback::{self, LogCallback},
+};
 use libusb1_sys::{constants::*, *};
 
 #[cfg(windows)]
@@ -15,6 +30,86 @@ type Seconds = ::libc::time_t;
 #[cfg(not(windows))]
 type MicroSeconds = ::libc::suseconds_t;
 
+#[doc(hidden)]
+pub(crate) fn timeval_from_duration(t: Duration) -> timeval {
+    timeval {
+        tv_sec: t.as_secs() as Seconds,
+        tv_usec: t.subsec_nanos() as MicroSeconds / 1000,
+    }
+}
+
+/// Converts `t` into a transfer timeout in milliseconds.
+///
+/// `libusb` treats a timeout of 0 as unlimited, so non-zero timeouts are rounded up to at least
+/// one millisecond instead of being truncated to 0. Timeouts that do not fit saturate.
+pub(crate) fn millis_from_duration(t: Duration) -> c_uint {
+    let millis = t.as_nanos().div_ceil(1_000_000);
+    millis.min(c_uint::MAX as u128) as c_uint
+}
+
+/// Returns the time left until `deadline`, or `Timeout` if it has passed.
+pub(crate) fn remaining(deadline: Instant) -> crate::Result<Duration> {
+    let now = Instant::now();
+    if now >= deadline {
+        return Err(error::Error::Timeout);
+    }
+    Ok(deadline - now)
+}
+
+/// Blocks until `completed` is set by a transfer callback or `deadline` passes.
+///
+/// While another thread is handling events, for instance an
+/// [`EventThread`](struct.EventThread.html), this only waits to be woken by it instead of
+/// contending for the event lock. Otherwise events are handled on the calling thread.
+pub(crate) fn wait_for_completion(
+    context: *mut libusb_context,
+    completed: &AtomicI32,
+    deadline: Option<Instant>,
+) -> crate::Result<()> {
+    let completed_ptr = completed as *const AtomicI32 as *mut c_int;
+
+    while completed.load(Ordering::Acquire) == 0 {
+        let tv = match deadline {
+            Some(deadline) => {
+                let now = Instant::now();
+                if now >= deadline {
+                    return Err(error::Error::Timeout);
+                }
+                Some(timeval_from_duration(deadline - now))
+            }
+            None => None,
+        };
+
+        unsafe {
+            if libusb_event_handler_active(context) != 0 {
+                // libusb signals the waiters under this lock after every completion callback,
+                // so checking the flag while holding it can not miss a wakeup.
+                libusb_lock_event_waiters(context);
+                if completed.load(Ordering::Acquire) == 0
+                    && libusb_event_handler_active(context) != 0
+                {
+                    libusb_wait_for_event(
+                        context,
+                        tv.as_ref().map_or(ptr::null(), |tv| tv as *const timeval),
+                    );
+                }
+                libusb_unlock_event_waiters(context);
+            } else {
+                let n = match tv {
+                    Some(ref tv) => {
+                        libusb_handle_events_timeout_completed(context, tv, completed_ptr)
+                    }
+                    None => libusb_handle_events_completed(context, completed_ptr),
+                };
+                if n < 0 && n != LIBUSB_ERROR_INTERRUPTED {
+                    return Err(error::from_libusb(n));
+                }
+            }
+        }
+    }
+    Ok(())
+}
+
 #[derive(Copy, Clone, Eq, PartialEq, Default)]
 pub struct GlobalContext {}
 
@@ -32,6 +127,7 @@ struct ContextInner {
 impl Drop for ContextInner {
     /// Closes the `libusb` context.
     fn drop(&mut self) {
+        log_callback::remove_context_callback(self.inner.as_ptr());
         unsafe {
             libusb_exit(self.inner.as_ptr());
         }
@@ -105,6 +201,17 @@ pub trait UsbContext: Clone + Sized + Send + Sync {
         }
     }
 
+    /// Routes the messages `libusb` logs for this context to `callback` instead of printing
+    /// them, or back to `stderr` if `callback` is `None`.
+    ///
+    /// Messages are only produced up to the log level set with
+    /// [`set_log_level`](#method.set_log_level), so the callback costs nothing while logging is
+    /// off. Messages are passed without their trailing newline and may be produced on any thread
+    /// handling events.
+    fn set_log_callback(&mut self, callback: Option<LogCallback>) {
+        log_callback::set_context_callback(self.as_raw(), callback);
+    }
+
     fn register_callback(
         &self,
         vendor_id: Option<u16>,
@@ -112,49 +219,57 @@ pub trait UsbContext: Clone + Sized + Send + Sync {
         class: Option<u8>,
         callback: Box<dyn Hotplug<Self>>,
     ) -> crate::Result<Registration<Self>> {
-        let mut handle: libusb_hotplug_callback_handle = 0;
-        let callback = CallbackData {
-            context: self.clone(),
-            hotplug: callback,
-        };
-        let to = Box::new(callback);
-        let n = unsafe {
-            libusb_hotplug_register_callback(
-                self.as_raw(),
-                LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT,
-                LIBUSB_HOTPLUG_NO_FLAGS,
-                vendor_id
-                    .map(c_int::from)
-                    .unwrap_or(LIBUSB_HOTPLUG_MATCH_ANY),
-                product_id
-                    .map(c_int::from)
-                    .unwrap_or(LIBUSB_HOTPLUG_MATCH_ANY),
-                class.map(c_int::from).unwrap_or(LIBUSB_HOTPLUG_MATCH_ANY),
-                hotplug_callback::<Self>,
-                Box::into_raw(to) as *mut c_void,
-                &mut handle,
-            )
-        };
-        if n < 0 {
-            Err(error::from_libusb(n))
-        } else {
-            Ok(Registration {
-                context: self.clone(),
-                handle,
-            })
+        let mut builder = HotplugBuilder::new();
+        if let Some(vendor_id) = vendor_id {
+            builder.vendor_id(vendor_id);
         }
+        if let Some(product_id) = product_id {
+            builder.product_id(product_id);
+        }
+        if let Some(class) = class {
+            builder.class(class);
+        }
+        builder.register(self, callback)
     }
 
     fn unregister_callback(&self, _reg: Registration<Self>) {}
 
+    /// Opens a device from a file descriptor obtained elsewhere, without enumerating devices.
+    ///
+    /// On Linux and Android `fd` is an open usbfs device node, for instance one passed in by
+    /// the Android USB manager or a privileged broker process. The descriptor is not closed
+    /// when the handle is dropped. Combined with
+    /// [`UsbOption::no_device_discovery`](struct.UsbOption.html#method.no_device_discovery), no
+    /// access to the rest of the bus is needed.
+    ///
+    /// ## Errors
+    ///
+    /// * `NotSupported` if the platform can not wrap file descriptors.
+    /// * `Io` or `Access` if `fd` can not be used.
+    ///
+    /// # Safety
+    ///
+    /// `fd` must be a valid file descriptor for a USB device node, and must stay open for the
+    /// lifetime of the returned handle.
+    #[cfg(unix)]
+    unsafe fn wrap_sys_device(&self, fd: RawFd) -> crate::Result<DeviceHandle<Self>> {
+        let mut handle = mem::MaybeUninit::<*mut libusb_device_handle>::uninit();
+
+        try_unsafe!(libusb_wrap_sys_device(
+            self.as_raw(),
+            fd as libc::intptr_t,
+            handle.as_mut_ptr()
+        ));
+
+        let ptr = ptr::NonNull::new(handle.assume_init()).ok_or(error::Error::NoDevice)?;
+        Ok(DeviceHandle::from_libusb(self.clone(), ptr))
+    }
+
     fn handle_events(&self, timeout: Option<Duration>) -> crate::Result<()> {
         let n = unsafe {
             match timeout {
                 Some(t) => {
-                    let tv = timeval {
-                        tv_sec: t.as_secs() as Seconds,
-                        tv_usec: t.subsec_nanos() as MicroSeconds / 1000,
-                    };
+                    let tv = timeval_from_duration(t);
                     libusb_handle_events_timeout_completed(self.as_raw(), &tv, ptr::null_mut())
                 }
                 None => libusb_handle_events_completed(self.as_raw(), ptr::null_mut()),
@@ -218,15 +333,99 @@ impl Context {
     }
 
     /// Creates a new `libusb` context and sets runtime options.
+    ///
+    /// The options only affect the new context.
+    ///
+    /// ## Errors
+    ///
+    /// * `NotSupported` if an option has to be given while the context is initialized, such as
+    ///   [`UsbOption::no_device_discovery`](struct.UsbOption.html#method.no_device_discovery),
+    ///   and libusb is older than 1.0.27. Such options can still be applied to the whole process
+    ///   with [`UsbOption::set_process_default`](struct.UsbOption.html#method.set_process_default).
     pub fn with_options(opts: &[crate::UsbOption]) -> crate::Result<Self> {
-        let mut this = Self::new()?;
+        let mut this = Self::init_with(opts)?;
 
-        for opt in opts {
+        for opt in opts.iter().filter(|opt| !opt.before_init()) {
             opt.apply(&mut this)?;
         }
 
         Ok(this)
     }
+
+    #[cfg(libusb_init_context)]
+    fn init_with(opts: &[crate::UsbOption]) -> crate::Result<Self> {
+        let options = opts
+            .iter()
+            .filter(|opt| opt.before_init())
+            .map(|opt| opt.init_option())
+            .collect::<Vec<_>>();
+        let mut context = mem::MaybeUninit::<*mut libusb_context>::uninit();
+
+        try_unsafe!(libusb_init_context(
+            context.as_mut_ptr(),
+            options.as_ptr(),
+            options.len() as c_int
+        ));
+
+        Ok(Context {
+            context: unsafe {
+                Arc::new(ContextInner {
+                    inner: ptr::NonNull::new_unchecked(context.assume_init()),
+                })
+            },
+        })
+    }
+
+    #[cfg(not(libusb_init_context))]
+    fn init_with(opts: &[crate::UsbOption]) -> crate::Result<Self> {
+        if opts.iter().any(|opt| opt.before_init()) {
+            return Err(error::Error::NotSupported);
+        }
+        Self::new()
+    }
+}
+
+/// Registers `callback` for the hotplug `events` and `flags` on devices matching the IDs.
+pub(crate) fn register_hotplug<T: UsbContext>(
+    context: &T,
+    events: c_int,
+    flags: c_int,
+    vendor_id: Option<u16>,
+    product_id: Option<u16>,
+    class: Option<u8>,
+    callback: Box<dyn Hotplug<T>>,
+) -> crate::Result<Registration<T>> {
+    let mut handle: libusb_hotplug_callback_handle = 0;
+    let callback = CallbackData {
+        context: context.clone(),
+        hotplug: callback,
+    };
+    let to = Box::new(callback);
+    let n = unsafe {
+        libusb_hotplug_register_callback(
+            context.as_raw(),
+            events,
+            flags,
+            vendor_id
+                .map(c_int::from)
+                .unwrap_or(LIBUSB_HOTPLUG_MATCH_ANY),
+            product_id
+                .map(c_int::from)
+                .unwrap_or(LIBUSB_HOTPLUG_MATCH_ANY),
+            class.map(c_int::from).unwrap_or(LIBUSB_HOTPLUG_MATCH_ANY),
+            hotplug_callback::<T>,
+            Box::into_raw(to) as *mut c_void,
+            &mut handle,
+        )
+    };
+    if n < 0 {
+        Err(error::from_libusb(n))
+    } else {
+        Ok(Registration {
+            context: context.clone(),
+            handle,
+        })
+    }
 }
 
 extern "system" fn hotplug_callback<T: UsbContext>(
@@ -256,7 +455,7 @@ extern "system" fn hotplug_callback<T: UsbContext>(
 }
 
 /// Library logging levels.
-#[derive(Clone, Copy)]
+#[derive(Debug, Clone, Copy, Eq, PartialEq)]
 pub enum LogLevel {
     /// No messages are printed by `libusb` (default).
     None,
@@ -286,4 +485,40 @@ impl LogLevel {
             LogLevel::Debug => LIBUSB_LOG_LEVEL_DEBUG,
         }
     }
+
+    pub(crate) fn from_c_int(level: c_int) -> LogLevel {
+        match level {
+            LIBUSB_LOG_LEVEL_ERROR => LogLevel::Error,
+            LIBUSB_LOG_LEVEL_WARNING => LogLevel::Warning,
+            LIBUSB_LOG_LEVEL_INFO => LogLevel::Info,
+            LIBUSB_LOG_LEVEL_DEBUG => LogLevel::Debug,
+            _ => LogLevel::None,
+        }
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use std::time::{Duration, Instant};
+
+    use super::{millis_from_duration, remaining};
+    use crate::Error;
+
+    #[test]
+    fn it_rounds_timeouts_up_to_whole_milliseconds() {
+        assert_eq!(0, millis_from_duration(Duration::from_secs(0)));
+        assert_eq!(1, millis_from_duration(Duration::from_micros(1)));
+        assert_eq!(1, millis_from_duration(Duration::from_millis(1)));
+        assert_eq!(2, millis_from_duration(Duration::from_micros(1500)));
+        assert_eq!(
+            u32::MAX,
+            millis_from_duration(Duration::from_secs(u64::MAX))
+        );
+    }
+
+    #[test]
+    fn it_times_out_past_deadlines() {
+        assert_eq!(Err(Error::Timeout), remaining(Instant::now()));
+        assert!(remaining(Instant::now() + Duration::from_secs(1)).is_ok());
+    }
 }
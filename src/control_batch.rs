@@ -0,0 +1,177 @@
+use std::{
+    collections::VecDeque,
+    fmt::{self, Debug},
+    time::Duration,
+};
+
+use libusb1_sys::constants::*;
+
+use crate::{device_handle::DeviceHandle, error::Error, transfer::Transfer, UsbContext};
+
+/// A sequence of control requests that are queued on the default control endpoint together.
+///
+/// Issuing many small requests with [`DeviceHandle::write_control`] costs a full round trip
+/// each, because the next request is only sent once the previous one has completed. A batch
+/// submits all of its requests as asynchronous transfers up front, so the host controller sends
+/// them back to back. Requests on one endpoint are processed in order, so the device sees them
+/// in the order they were added.
+///
+/// The transfers are kept after [`execute`](#method.execute), so the same batch can be run again
+/// without allocating.
+///
+/// [`DeviceHandle::write_control`]: struct.DeviceHandle.html#method.write_control
+pub struct ControlBatch<'d, T: UsbContext> {
+    handle: &'d DeviceHandle<T>,
+    timeout: Duration,
+    transfers: Vec<Transfer<'d, T>>,
+}
+
+impl<'d, T: UsbContext> ControlBatch<'d, T> {
+    /// Creates an empty batch for `handle` whose requests each time out after `timeout`.
+    pub fn new(handle: &'d DeviceHandle<T>, timeout: Duration) -> Self {
+        ControlBatch {
+            handle,
+            timeout,
+            transfers: Vec::new(),
+        }
+    }
+
+    /// Appends a request that reads up to `len` bytes.
+    ///
+    /// The parameters are the same as for
+    /// [`DeviceHandle::read_control`](struct.DeviceHandle.html#method.read_control).
+    ///
+    /// ## Errors
+    ///
+    /// * `InvalidParam` if `request_type` does not specify a read transfer, or `len` does not
+    ///   fit a setup packet.
+    pub fn read(
+        &mut self,
+        request_type: u8,
+        request: u8,
+        value: u16,
+        index: u16,
+        len: usize,
+    ) -> crate::Result<&mut Self> {
+        if request_type & LIBUSB_ENDPOINT_DIR_MASK != LIBUSB_ENDPOINT_IN {
+            return Err(Error::InvalidParam);
+        }
+        self.push(request_type, request, value, index, vec![0; len])
+    }
+
+    /// Appends a request that writes `data`.
+    ///
+    /// The parameters are the same as for
+    /// [`DeviceHandle::write_control`](struct.DeviceHandle.html#method.write_control).
+    ///
+    /// ## Errors
+    ///
+    /// * `InvalidParam` if `request_type` does not specify a write transfer, or `data` does not
+    ///   fit a setup packet.
+    pub fn write(
+        &mut self,
+        request_type: u8,
+        request: u8,
+        value: u16,
+        index: u16,
+        data: &[u8],
+    ) -> crate::Result<&mut Self> {
+        if request_type & LIBUSB_ENDPOINT_DIR_MASK != LIBUSB_ENDPOINT_OUT {
+            return Err(Error::InvalidParam);
+        }
+        self.push(request_type, request, value, index, data.to_vec())
+    }
+
+    fn push(
+        &mut self,
+        request_type: u8,
+        request: u8,
+        value: u16,
+        index: u16,
+        data: Vec<u8>,
+    ) -> crate::Result<&mut Self> {
+        let transfer = Transfer::control(
+            self.handle,
+            request_type,
+            request,
+            value,
+            index,
+            data,
+            self.timeout,
+        )?;
+        self.transfers.push(transfer);
+        Ok(self)
+    }
+
+    /// Returns the number of requests in the batch.
+    pub fn len(&self) -> usize {
+        self.transfers.len()
+    }
+
+    /// Returns true if the batch holds no requests.
+    pub fn is_empty(&self) -> bool {
+        self.transfers.is_empty()
+    }
+
+    /// Removes all requests from the batch.
+    pub fn clear(&mut self) {
+        self.transfers.clear();
+    }
+
+    /// Submits all requests and waits for them to complete.
+    ///
+    /// Returns the result of every request in the order they were added: the number of bytes
+    /// transferred, or the error the request failed with. A failed request does not stop the
+    /// requests after it, since they are already queued. If libusb runs out of resources to
+    /// queue more requests, the oldest ones are waited for first.
+    pub fn execute(&mut self) -> Vec<crate::Result<usize>> {
+        let mut results = Vec::with_capacity(self.transfers.len());
+        let mut in_flight = VecDeque::with_capacity(self.transfers.len());
+        let mut next = 0;
+
+        // Requests complete in order, so results are produced in order as well.
+        while next < self.transfers.len() || !in_flight.is_empty() {
+            if next < self.transfers.len() {
+                match self.transfers[next].submit() {
+                    Ok(()) => {
+                        in_flight.push_back(next);
+                        next += 1;
+                        continue;
+                    }
+                    Err(err) if in_flight.is_empty() => {
+                        results.push(Err(err));
+                        next += 1;
+                        continue;
+                    }
+                    Err(_) => {}
+                }
+            }
+
+            let oldest = in_flight.pop_front().unwrap();
+            results.push(self.transfers[oldest].wait(None));
+        }
+
+        results
+    }
+
+    /// Returns the data stage of request `index` after the batch has been executed.
+    ///
+    /// For read requests these are the bytes received from the device.
+    ///
+    /// # Panics
+    ///
+    /// Panics if `index` is out of bounds.
+    pub fn data(&self, index: usize) -> &[u8] {
+        let transfer = &self.transfers[index];
+        &transfer.buffer()[..transfer.actual_length()]
+    }
+}
+
+impl<'d, T: UsbContext> Debug for ControlBatch<'d, T> {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.debug_struct("ControlBatch")
+            .field("requests", &self.transfers.len())
+            .field("timeout", &self.timeout)
+            .finish()
+    }
+}
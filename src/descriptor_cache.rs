@@ -0,0 +1,220 @@
+use std::{
+    collections::{HashMap, HashSet},
+    fmt::{self, Debug},
+    ptr::NonNull,
+    sync::{Arc, Mutex},
+};
+
+use crate::{
+    config_descriptor::ConfigDescriptor, device::Device, device_descriptor::DeviceDescriptor,
+    device_list::DeviceList, UsbContext,
+};
+
+/// The device descriptor and all configuration descriptors of a device.
+///
+/// Each configuration descriptor holds the whole tree of interfaces, alternate settings and
+/// endpoints parsed by libusb, including their extra bytes. The tree is immutable, so it can be
+/// shared between threads in an `Arc` and walked as often as needed without going back to
+/// libusb.
+pub struct Descriptors {
+    device: DeviceDescriptor,
+    configs: Vec<ConfigDescriptor>,
+}
+
+impl Descriptors {
+    /// Reads all descriptors of `device`.
+    pub(crate) fn read<T: UsbContext>(device: &Device<T>) -> crate::Result<Self> {
+        let descriptor = device.device_descriptor()?;
+        let configs = (0..descriptor.num_configurations())
+            .map(|index| device.config_descriptor(index))
+            .collect::<crate::Result<Vec<_>>>()?;
+
+        Ok(Descriptors {
+            device: descriptor,
+            configs,
+        })
+    }
+
+    pub(crate) fn new(device: DeviceDescriptor, configs: Vec<ConfigDescriptor>) -> Self {
+        Descriptors { device, configs }
+    }
+
+    /// Returns the device descriptor.
+    pub fn device_descriptor(&self) -> &DeviceDescriptor {
+        &self.device
+    }
+
+    /// Returns the configuration descriptors, in index order.
+    pub fn config_descriptors(&self) -> &[ConfigDescriptor] {
+        &self.configs
+    }
+
+    /// Returns the configuration descriptor with configuration value `number`.
+    pub fn config_descriptor_by_number(&self, number: u8) -> Option<&ConfigDescriptor> {
+        self.configs.iter().find(|config| config.number() == number)
+    }
+}
+
+impl Debug for Descriptors {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.debug_struct("Descriptors")
+            .field("device", &self.device)
+            .field("configs", &self.configs)
+            .finish()
+    }
+}
+
+struct Entry<T: UsbContext> {
+    // Keeps the device referenced, so its address can not be reused by another device while the
+    // entry exists.
+    _device: Device<T>,
+    descriptors: Arc<Descriptors>,
+}
+
+/// A cache of [`Descriptors`] keyed by device.
+///
+/// Code that enumerates devices repeatedly, for instance to match them against a list of
+/// supported interfaces, reads the descriptors of each device only the first time it is seen.
+/// The cache keeps a reference to every device in it, so entries for devices that are gone
+/// should be dropped with [`retain`](#method.retain) after each enumeration.
+pub struct DescriptorCache<T: UsbContext> {
+    entries: Mutex<HashMap<usize, Entry<T>>>,
+}
+
+impl<T: UsbContext> DescriptorCache<T> {
+    /// Creates an empty cache.
+    pub fn new() -> Self {
+        DescriptorCache {
+            entries: Mutex::new(HashMap::new()),
+        }
+    }
+
+    /// Returns the descriptors of `device`, reading them if they are not cached yet.
+    pub fn get(&self, device: &Device<T>) -> crate::Result<Arc<Descriptors>> {
+        let key = device.as_raw() as usize;
+        if let Some(entry) = self.entries.lock().unwrap().get(&key) {
+            return Ok(entry.descriptors.clone());
+        }
+
+        // Read without holding the lock, so lookups of other devices are not blocked.
+        let descriptors = Arc::new(Descriptors::read(device)?);
+
+        let mut entries = self.entries.lock().unwrap();
+        let entry = entries.entry(key).or_insert_with(|| Entry {
+            _device: unsafe {
+                Device::from_libusb(
+                    device.context().clone(),
+                    NonNull::new_unchecked(device.as_raw()),
+                )
+            },
+            descriptors,
+        });
+        Ok(entry.descriptors.clone())
+    }
+
+    /// Caches `descriptors` for `device`, replacing any previous entry.
+    ///
+    /// This lets descriptors restored from a [`Snapshot`](struct.Snapshot.html) be served
+    /// without reading them from the device.
+    pub fn insert(&self, device: &Device<T>, descriptors: Arc<Descriptors>) {
+        let entry = Entry {
+            _device: unsafe {
+                Device::from_libusb(
+                    device.context().clone(),
+                    NonNull::new_unchecked(device.as_raw()),
+                )
+            },
+            descriptors,
+        };
+        self.entries
+            .lock()
+            .unwrap()
+            .insert(device.as_raw() as usize, entry);
+    }
+
+    /// Drops the entries of all devices that are not in `devices`.
+    pub fn retain(&self, devices: &DeviceList<T>) {
+        let present = devices
+            .iter()
+            .map(|device| device.as_raw() as usize)
+            .collect::<HashSet<_>>();
+        self.entries
+            .lock()
+            .unwrap()
+            .retain(|key, _| present.contains(key));
+    }
+
+    /// Drops the entry of `device`, if any.
+    pub fn remove(&self, device: &Device<T>) {
+        self.entries
+            .lock()
+            .unwrap()
+            .remove(&(device.as_raw() as usize));
+    }
+
+    /// Drops all entries.
+    pub fn clear(&self) {
+        self.entries.lock().unwrap().clear();
+    }
+
+    /// Returns the number of cached devices.
+    pub fn len(&self) -> usize {
+        self.entries.lock().unwrap().len()
+    }
+
+    /// Returns true if no devices are cached.
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+}
+
+impl<T: UsbContext> Default for DescriptorCache<T> {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl<T: UsbContext> Debug for DescriptorCache<T> {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.debug_struct("DescriptorCache")
+            .field("len", &self.len())
+            .finish()
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use std::mem;
+
+    use super::Descriptors;
+    use crate::{config_descriptor, device_descriptor};
+
+    #[test]
+    fn it_finds_configs_by_number() {
+        let configs = [
+            config_descriptor!(bConfigurationValue: 1),
+            config_descriptor!(bConfigurationValue: 2),
+        ];
+        let descriptors = Descriptors {
+            device: device_descriptor::from_libusb(device_descriptor!(bNumConfigurations: 2)),
+            configs: configs
+                .iter()
+                .map(|config| unsafe { config_descriptor::from_libusb(config) })
+                .collect(),
+        };
+
+        assert_eq!(2, descriptors.config_descriptors().len());
+        assert_eq!(
+            Some(2),
+            descriptors
+                .config_descriptor_by_number(2)
+                .map(|c| c.number())
+        );
+        assert!(descriptors.config_descriptor_by_number(3).is_none());
+
+        // The configs point into the array above instead of memory owned by libusb.
+        for config in descriptors.configs {
+            mem::forget(config);
+        }
+    }
+}
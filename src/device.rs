@@ -1,27 +1,68 @@
 use std::{
     fmt::{self, Debug},
+    hash::{Hash, Hasher},
     mem,
     ptr::NonNull,
+    sync::Arc,
 };
 
 use libusb1_sys::*;
 
 use crate::{
     config_descriptor::{self, ConfigDescriptor},
+    descriptor_cache::Descriptors,
     device_descriptor::{self, DeviceDescriptor},
     device_handle::DeviceHandle,
+    device_watcher::PortPath,
     error,
     fields::{self, Speed},
     Error, UsbContext,
 };
 
 /// A reference to a USB device.
+///
+/// Two references are equal, and hash the same, if they refer to the same `libusb_device`.
 #[derive(Eq, PartialEq)]
 pub struct Device<T: UsbContext> {
     context: T,
     device: NonNull<libusb_device>,
 }
 
+/// Identifies a connected device by its bus number and address.
+///
+/// No two devices connected at the same time have the same ID, but the address of a device
+/// that is unplugged may be reused for the next one on the bus. It is small and `Copy`, so it
+/// makes a cheap key for maps of devices; [`PortPath`](struct.PortPath.html) is the key to use
+/// to recognise a device replugged into the same port.
+#[derive(Debug, Copy, Clone, Eq, PartialEq, Hash, Ord, PartialOrd)]
+pub struct DeviceId {
+    bus: u8,
+    address: u8,
+}
+
+impl DeviceId {
+    /// Creates the ID of the device at `address` on bus `bus`.
+    pub fn new(bus: u8, address: u8) -> Self {
+        DeviceId { bus, address }
+    }
+
+    /// Returns the bus number.
+    pub fn bus_number(&self) -> u8 {
+        self.bus
+    }
+
+    /// Returns the address on the bus.
+    pub fn address(&self) -> u8 {
+        self.address
+    }
+}
+
+impl<T: UsbContext> Hash for Device<T> {
+    fn hash<H: Hasher>(&self, state: &mut H) {
+        self.device.hash(state);
+    }
+}
+
 impl<T: UsbContext> Drop for Device<T> {
     /// Releases the device reference.
     fn drop(&mut self) {
@@ -31,6 +72,13 @@ impl<T: UsbContext> Drop for Device<T> {
     }
 }
 
+impl<T: UsbContext> Clone for Device<T> {
+    /// Returns another reference to the same device.
+    fn clone(&self) -> Self {
+        unsafe { Device::from_libusb(self.context.clone(), self.device) }
+    }
+}
+
 unsafe impl<T: UsbContext> Send for Device<T> {}
 unsafe impl<T: UsbContext> Sync for Device<T> {}
 
@@ -114,6 +162,15 @@ impl<T: UsbContext> Device<T> {
         Ok(unsafe { config_descriptor::from_libusb(config.assume_init()) })
     }
 
+    /// Reads the device descriptor and all configuration descriptors at once.
+    ///
+    /// The result can be kept and shared between threads instead of reading, and for
+    /// configurations parsing, the descriptors again on every access. See also
+    /// [`DescriptorCache`](struct.DescriptorCache.html).
+    pub fn descriptors(&self) -> crate::Result<Arc<Descriptors>> {
+        Descriptors::read(self).map(Arc::new)
+    }
+
     /// Returns the number of the bus that the device is connected to.
     pub fn bus_number(&self) -> u8 {
         unsafe { libusb_get_bus_number(self.device.as_ptr()) }
@@ -124,11 +181,42 @@ impl<T: UsbContext> Device<T> {
         unsafe { libusb_get_device_address(self.device.as_ptr()) }
     }
 
+    /// Returns the bus number and address of the device.
+    pub fn id(&self) -> DeviceId {
+        DeviceId::new(self.bus_number(), self.address())
+    }
+
+    /// Returns the bus number and the ports leading to the device, without allocating.
+    pub fn port_path(&self) -> PortPath {
+        PortPath::of(self)
+    }
+
     /// Returns the device's connection speed.
     pub fn speed(&self) -> Speed {
         fields::speed_from_libusb(unsafe { libusb_get_device_speed(self.device.as_ptr()) })
     }
 
+    /// Returns the maximum packet size of `endpoint` in the active configuration.
+    pub fn max_packet_size(&self, endpoint: u8) -> crate::Result<u16> {
+        match unsafe { libusb_get_max_packet_size(self.device.as_ptr(), endpoint) } {
+            n if n >= 0 => Ok(n as u16),
+            err => Err(error::from_libusb(err)),
+        }
+    }
+
+    /// Returns the maximum number of bytes `endpoint` can move in one service interval, in the
+    /// active configuration and alternate setting 0.
+    ///
+    /// This accounts for additional transactions of high-bandwidth endpoints and for the burst
+    /// and multiplier of SuperSpeed endpoints, so it is the packet size to use for isochronous
+    /// transfers.
+    pub fn max_iso_packet_size(&self, endpoint: u8) -> crate::Result<usize> {
+        match unsafe { libusb_get_max_iso_packet_size(self.device.as_ptr(), endpoint) } {
+            n if n >= 0 => Ok(n as usize),
+            err => Err(error::from_libusb(err)),
+        }
+    }
+
     /// Opens the device.
     pub fn open(&self) -> crate::Result<DeviceHandle<T>> {
         let mut handle = mem::MaybeUninit::<*mut libusb_device_handle>::uninit();
@@ -157,16 +245,54 @@ impl<T: UsbContext> Device<T> {
     pub fn port_numbers(&self) -> Result<Vec<u8>, Error> {
         // As per the USB 3.0 specs, the current maximum limit for the depth is 7.
         let mut ports = [0; 7];
+        Ok(self.port_numbers_into(&mut ports)?.to_vec())
+    }
 
-        let result = unsafe {
-            libusb_get_port_numbers(self.device.as_ptr(), ports.as_mut_ptr(), ports.len() as i32)
-        };
+    /// Writes the port numbers from root for the specified device into `ports` without
+    /// allocating, and returns the part of `ports` that was filled.
+    ///
+    /// A buffer of 7 bytes always suffices. Returns `Error::Overflow` if `ports` is too small.
+    pub fn port_numbers_into<'b>(&self, ports: &'b mut [u8]) -> Result<&'b [u8], Error> {
+        let len = ports.len().min(i32::MAX as usize) as i32;
+
+        let result =
+            unsafe { libusb_get_port_numbers(self.device.as_ptr(), ports.as_mut_ptr(), len) };
 
-        let ports_number = if result < 0 {
+        if result < 0 {
             return Err(error::from_libusb(result));
-        } else {
-            result
-        };
-        Ok(ports[0..ports_number as usize].to_vec())
+        }
+        Ok(&ports[..result as usize])
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::DeviceId;
+    use std::collections::HashSet;
+
+    #[test]
+    fn it_orders_and_hashes_ids_by_bus_then_address() {
+        let ids = vec![
+            DeviceId::new(2, 1),
+            DeviceId::new(1, 7),
+            DeviceId::new(1, 3),
+        ];
+
+        let mut sorted = ids.clone();
+        sorted.sort();
+        assert_eq!(
+            vec![
+                DeviceId::new(1, 3),
+                DeviceId::new(1, 7),
+                DeviceId::new(2, 1)
+            ],
+            sorted
+        );
+
+        let set = ids.into_iter().collect::<HashSet<_>>();
+        assert!(set.contains(&DeviceId::new(1, 7)));
+        assert!(!set.contains(&DeviceId::new(7, 1)));
+        assert_eq!(2, DeviceId::new(2, 1).bus_number());
+        assert_eq!(1, DeviceId::new(2, 1).address());
     }
 }
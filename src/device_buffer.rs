@@ -0,0 +1,202 @@
+use std::{
+    alloc::{self, Layout},
+    fmt::{self, Debug},
+    marker::PhantomData,
+    ops::{Deref, DerefMut},
+    ptr::NonNull,
+    slice,
+};
+
+use libc::size_t;
+use libusb1_sys::*;
+
+/// Alignment of heap allocated device buffers.
+const PAGE_SIZE: usize = 4096;
+
+enum Storage {
+    /// Memory from `libusb_dev_mem_alloc`, freed with the handle it was allocated for.
+    Device(NonNull<libusb_device_handle>),
+
+    /// Page aligned heap memory.
+    Heap(Layout),
+
+    /// Memory of a `Vec<u8>` with the given capacity.
+    Vec(usize),
+}
+
+/// A data buffer for transfers on a device.
+///
+/// Buffers allocated with [`DeviceHandle::alloc_buffer`](struct.DeviceHandle.html#method.alloc_buffer)
+/// come from `libusb_dev_mem_alloc` where the platform supports it. On Linux this memory is
+/// mapped for DMA by usbfs, so transfers on it skip the copy through a kernel bounce buffer.
+/// Elsewhere, page aligned heap memory is used instead.
+///
+/// A buffer can also be created from a `Vec<u8>`. It dereferences to a byte slice, so it can be
+/// passed to the synchronous transfer methods of [`DeviceHandle`](struct.DeviceHandle.html) as well
+/// as used for asynchronous [`Transfer`](struct.Transfer.html)s.
+pub struct DeviceBuffer<'d> {
+    ptr: NonNull<u8>,
+    len: usize,
+    storage: Storage,
+    _handle: PhantomData<&'d libusb_device_handle>,
+}
+
+unsafe impl<'d> Send for DeviceBuffer<'d> {}
+unsafe impl<'d> Sync for DeviceBuffer<'d> {}
+
+impl<'d> Drop for DeviceBuffer<'d> {
+    /// Releases the buffer's memory.
+    fn drop(&mut self) {
+        unsafe {
+            match self.storage {
+                Storage::Device(handle) => {
+                    libusb_dev_mem_free(handle.as_ptr(), self.ptr.as_ptr(), self.len as size_t);
+                }
+                Storage::Heap(layout) => {
+                    if layout.size() > 0 {
+                        alloc::dealloc(self.ptr.as_ptr(), layout);
+                    }
+                }
+                Storage::Vec(capacity) => {
+                    drop(Vec::from_raw_parts(self.ptr.as_ptr(), self.len, capacity));
+                }
+            }
+        }
+    }
+}
+
+impl<'d> Debug for DeviceBuffer<'d> {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.debug_struct("DeviceBuffer")
+            .field("len", &self.len)
+            .field("device_memory", &self.is_device_memory())
+            .finish()
+    }
+}
+
+impl<'d> DeviceBuffer<'d> {
+    /// Allocates `len` bytes of device memory for `handle`, falling back to the heap.
+    pub(crate) fn new(handle: NonNull<libusb_device_handle>, len: usize) -> crate::Result<Self> {
+        if len > 0 {
+            let ptr = unsafe { libusb_dev_mem_alloc(handle.as_ptr(), len as size_t) };
+            if let Some(ptr) = NonNull::new(ptr) {
+                return Ok(DeviceBuffer {
+                    ptr,
+                    len,
+                    storage: Storage::Device(handle),
+                    _handle: PhantomData,
+                });
+            }
+        }
+
+        Self::with_len(len)
+    }
+
+    /// Allocates `len` bytes of zeroed, page aligned heap memory.
+    pub fn with_len(len: usize) -> crate::Result<Self> {
+        let layout =
+            Layout::from_size_align(len, PAGE_SIZE).map_err(|_| crate::Error::InvalidParam)?;
+        let ptr = if len > 0 {
+            NonNull::new(unsafe { alloc::alloc_zeroed(layout) }).ok_or(crate::Error::NoMem)?
+        } else {
+            NonNull::dangling()
+        };
+
+        Ok(DeviceBuffer {
+            ptr,
+            len,
+            storage: Storage::Heap(layout),
+            _handle: PhantomData,
+        })
+    }
+
+    /// Returns true if the buffer is device memory from `libusb_dev_mem_alloc`.
+    pub fn is_device_memory(&self) -> bool {
+        matches!(self.storage, Storage::Device(_))
+    }
+
+    /// Copies the buffer into a `Vec<u8>`, without copying if it was created from one.
+    pub fn into_vec(self) -> Vec<u8> {
+        match self.storage {
+            Storage::Vec(capacity) => {
+                let vec = unsafe { Vec::from_raw_parts(self.ptr.as_ptr(), self.len, capacity) };
+                std::mem::forget(self);
+                vec
+            }
+            _ => self.to_vec(),
+        }
+    }
+}
+
+impl<'d> From<Vec<u8>> for DeviceBuffer<'d> {
+    fn from(vec: Vec<u8>) -> Self {
+        let mut vec = std::mem::ManuallyDrop::new(vec);
+
+        DeviceBuffer {
+            ptr: unsafe { NonNull::new_unchecked(vec.as_mut_ptr()) },
+            len: vec.len(),
+            storage: Storage::Vec(vec.capacity()),
+            _handle: PhantomData,
+        }
+    }
+}
+
+impl<'d> Deref for DeviceBuffer<'d> {
+    type Target = [u8];
+
+    fn deref(&self) -> &[u8] {
+        unsafe { slice::from_raw_parts(self.ptr.as_ptr(), self.len) }
+    }
+}
+
+impl<'d> DerefMut for DeviceBuffer<'d> {
+    fn deref_mut(&mut self) -> &mut [u8] {
+        unsafe { slice::from_raw_parts_mut(self.ptr.as_ptr(), self.len) }
+    }
+}
+
+impl<'d> AsRef<[u8]> for DeviceBuffer<'d> {
+    fn as_ref(&self) -> &[u8] {
+        self
+    }
+}
+
+impl<'d> AsMut<[u8]> for DeviceBuffer<'d> {
+    fn as_mut(&mut self) -> &mut [u8] {
+        self
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::{DeviceBuffer, PAGE_SIZE};
+
+    #[test]
+    fn it_allocates_aligned_zeroed_heap_memory() {
+        let buffer = DeviceBuffer::with_len(10000).unwrap();
+
+        assert_eq!(10000, buffer.len());
+        assert_eq!(0, buffer.as_ptr() as usize % PAGE_SIZE);
+        assert!(buffer.iter().all(|&b| b == 0));
+        assert!(!buffer.is_device_memory());
+    }
+
+    #[test]
+    fn it_handles_empty_buffers() {
+        assert_eq!(0, DeviceBuffer::with_len(0).unwrap().len());
+        assert_eq!(0, DeviceBuffer::from(Vec::new()).len());
+    }
+
+    #[test]
+    fn it_round_trips_vec_without_copying() {
+        let vec = vec![1u8, 2, 3];
+        let ptr = vec.as_ptr();
+
+        let mut buffer = DeviceBuffer::from(vec);
+        buffer[0] = 42;
+
+        let vec = buffer.into_vec();
+        assert_eq!(ptr, vec.as_ptr());
+        assert_eq!(vec![42, 2, 3], vec);
+    }
+}
@@ -1,8 +1,8 @@
 use std::fmt;
 
-use libusb1_sys::*;
+use libusb1_sys::{constants::*, *};
 
-use crate::fields::Version;
+use crate::{error::Error, fields::Version};
 
 /// Describes a device.
 pub struct DeviceDescriptor {
@@ -108,6 +108,62 @@ pub fn from_libusb(device: libusb_device_descriptor) -> DeviceDescriptor {
     DeviceDescriptor { descriptor: device }
 }
 
+/// Size of a device descriptor as sent by a device.
+pub(crate) const RAW_SIZE: usize = 18;
+
+/// Returns `device` in the layout a device sends it in.
+pub(crate) fn to_raw(device: &DeviceDescriptor) -> [u8; RAW_SIZE] {
+    let d = &device.descriptor;
+    let [usb_lo, usb_hi] = d.bcdUSB.to_le_bytes();
+    let [vid_lo, vid_hi] = d.idVendor.to_le_bytes();
+    let [pid_lo, pid_hi] = d.idProduct.to_le_bytes();
+    let [dev_lo, dev_hi] = d.bcdDevice.to_le_bytes();
+    [
+        RAW_SIZE as u8,
+        LIBUSB_DT_DEVICE,
+        usb_lo,
+        usb_hi,
+        d.bDeviceClass,
+        d.bDeviceSubClass,
+        d.bDeviceProtocol,
+        d.bMaxPacketSize0,
+        vid_lo,
+        vid_hi,
+        pid_lo,
+        pid_hi,
+        dev_lo,
+        dev_hi,
+        d.iManufacturer,
+        d.iProduct,
+        d.iSerialNumber,
+        d.bNumConfigurations,
+    ]
+}
+
+/// Parses a device descriptor as sent by a device.
+pub(crate) fn from_raw(raw: &[u8]) -> crate::Result<DeviceDescriptor> {
+    if raw.len() < RAW_SIZE || raw[0] as usize != RAW_SIZE || raw[1] != LIBUSB_DT_DEVICE {
+        return Err(Error::BadDescriptor);
+    }
+
+    Ok(from_libusb(libusb_device_descriptor {
+        bLength: raw[0],
+        bDescriptorType: raw[1],
+        bcdUSB: u16::from_le_bytes([raw[2], raw[3]]),
+        bDeviceClass: raw[4],
+        bDeviceSubClass: raw[5],
+        bDeviceProtocol: raw[6],
+        bMaxPacketSize0: raw[7],
+        idVendor: u16::from_le_bytes([raw[8], raw[9]]),
+        idProduct: u16::from_le_bytes([raw[10], raw[11]]),
+        bcdDevice: u16::from_le_bytes([raw[12], raw[13]]),
+        iManufacturer: raw[14],
+        iProduct: raw[15],
+        iSerialNumber: raw[16],
+        bNumConfigurations: raw[17],
+    }))
+}
+
 #[cfg(test)]
 mod test {
     use crate::fields::Version;
@@ -231,4 +287,25 @@ mod test {
             super::from_libusb(device_descriptor!(bNumConfigurations: 3)).num_configurations()
         );
     }
+
+    #[test]
+    fn it_round_trips_raw_descriptors() {
+        let device = super::from_libusb(device_descriptor!(
+            bcdUSB: 0x0210,
+            idVendor: 0x1d50,
+            idProduct: 0x6018,
+            bcdDevice: 0x0101,
+            iSerialNumber: 3,
+            bNumConfigurations: 2
+        ));
+
+        let raw = super::to_raw(&device);
+        assert_eq!([0x50, 0x1d, 0x18, 0x60, 0x01, 0x01], raw[8..14]);
+
+        let parsed = super::from_raw(&raw).unwrap();
+        assert_eq!(raw, super::to_raw(&parsed));
+        assert_eq!(Some(3), parsed.serial_number_string_index());
+
+        assert!(super::from_raw(&raw[..17]).is_err());
+    }
 }
@@ -1,94 +1,142 @@
-use std::{mem, fmt::{self, Debug}, ptr::NonNull, time::Duration, u8};
+use std::{
+    fmt::{self, Debug},
+    io::{IoSlice, IoSliceMut},
+    mem,
+    ptr::NonNull,
+    str,
+    sync::{
+        atomic::{AtomicBool, AtomicU64, Ordering},
+        Arc, Mutex, OnceLock, RwLock,
+    },
+    time::{Duration, Instant},
+    u8,
+};
 
 use libc::{c_int, c_uchar, c_uint};
 use libusb1_sys::{constants::*, *};
 
 use crate::{
+    bos_descriptor::{self, BosDescriptor},
+    cancellation::CancellationToken,
     config_descriptor::ConfigDescriptor,
+    context::{self, millis_from_duration},
+    control_batch::ControlBatch,
     device::{self, Device},
+    device_buffer::DeviceBuffer,
     device_descriptor::DeviceDescriptor,
+    endpoint::{BulkIn, BulkOut, InterruptIn, InterruptOut},
     error::{self, Error},
-    fields::{request_type, Direction, Recipient, RequestType},
+    fields::{request_type, Direction, Recipient, RequestType, TransferType},
     interface_descriptor::InterfaceDescriptor,
     language::Language,
-    UsbContext,
+    streams::BulkStreams,
+    string_cache::{self, DeviceStrings, Languages, StringCache},
+    transfer_stats::{Instruments, TransferHook, TransferStats},
+    vectored, UsbContext,
 };
 
 /// Bit set representing claimed USB interfaces.
-#[derive(Copy, Clone, Debug, Default, Eq, PartialEq)]
+///
+/// The bits are atomic, so interfaces can be claimed and released through a shared handle.
+#[derive(Default)]
 struct ClaimedInterfaces {
-    inner: [u128; 2],
+    inner: [AtomicU64; 4],
 }
 
 impl ClaimedInterfaces {
     /// Create a new bit set.
     fn new() -> Self {
-        Self { inner: [0, 0] }
+        Self::default()
     }
 
-    fn get_index_and_mask(interface: u8) -> (usize, u128) {
-        ((interface / 128) as usize, 1 << (interface % 128))
+    fn get_index_and_mask(interface: u8) -> (usize, u64) {
+        ((interface / 64) as usize, 1 << (interface % 64))
     }
 
     /// Mark `interface` as claimed.
-    fn insert(&mut self, interface: u8) {
+    fn insert(&self, interface: u8) {
         let (index, mask) = ClaimedInterfaces::get_index_and_mask(interface);
-        self.inner[index] |= mask;
+        self.inner[index].fetch_or(mask, Ordering::Relaxed);
     }
 
     /// Mark `interface` as not claimed.
-    fn remove(&mut self, interface: u8) {
+    fn remove(&self, interface: u8) {
         let (index, mask) = ClaimedInterfaces::get_index_and_mask(interface);
-        self.inner[index] &= !mask;
+        self.inner[index].fetch_and(!mask, Ordering::Relaxed);
     }
 
     /// Returns true if this set contains `interface`.
+    #[cfg(test)]
     fn contains(&self, interface: u8) -> bool {
         let (index, mask) = ClaimedInterfaces::get_index_and_mask(interface);
-        self.inner[index] & mask != 0
+        self.inner[index].load(Ordering::Relaxed) & mask != 0
+    }
+
+    /// Returns a copy of the bits of this set.
+    fn bits(&self) -> [u64; 4] {
+        let mut bits = [0; 4];
+        for (bits, inner) in bits.iter_mut().zip(self.inner.iter()) {
+            *bits = inner.load(Ordering::Relaxed);
+        }
+        bits
     }
 
     /// Returns a count of the interfaces contained in this set.
+    #[cfg(test)]
     fn size(&self) -> usize {
-        self.inner.iter().map(|v| v.count_ones()).sum::<u32>() as usize
+        self.bits().iter().map(|v| v.count_ones()).sum::<u32>() as usize
     }
 
-    /// Returns an iterator over the interfaces in this set.
+    /// Returns an iterator over the interfaces in this set, as of the time of the call.
     fn iter(&self) -> ClaimedInterfacesIter {
-        ClaimedInterfacesIter::new(&self)
+        ClaimedInterfacesIter::new(self.bits())
+    }
+}
+
+impl PartialEq for ClaimedInterfaces {
+    fn eq(&self, other: &Self) -> bool {
+        self.bits() == other.bits()
+    }
+}
+
+impl Eq for ClaimedInterfaces {}
+
+impl Debug for ClaimedInterfaces {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.debug_set().entries(self.iter()).finish()
     }
 }
 
 /// Iterator over interfaces.
-struct ClaimedInterfacesIter<'a> {
+struct ClaimedInterfacesIter {
     // Next interface to check as a possible value to return from the interator.
     index: u16,
 
     // Number of elements remaining in this iterator.
     remaining: usize,
 
-    // The ClaimedInterfaces object that we're iterating over.
-    source: &'a ClaimedInterfaces,
+    // The bits of the ClaimedInterfaces object that we're iterating over.
+    bits: [u64; 4],
 }
 
-impl<'a> ClaimedInterfacesIter<'a> {
-    /// Create a new iterator over the interfaces in `source`.
-    fn new<'source>(source: &'source ClaimedInterfaces) -> ClaimedInterfacesIter<'source> {
+impl ClaimedInterfacesIter {
+    /// Create a new iterator over the interfaces in `bits`.
+    fn new(bits: [u64; 4]) -> ClaimedInterfacesIter {
         ClaimedInterfacesIter {
             index: 0,
-            remaining: source.size(),
-            source,
+            remaining: bits.iter().map(|v| v.count_ones()).sum::<u32>() as usize,
+            bits,
         }
     }
 }
 
-impl<'a> Iterator for ClaimedInterfacesIter<'a> {
+impl Iterator for ClaimedInterfacesIter {
     type Item = u8;
 
     fn next(&mut self) -> Option<u8> {
         while self.index <= u8::MAX as u16 {
             let index = self.index as u8;
-            let contains = self.source.contains(index);
+            let contains = self.bits[index as usize / 64] & 1 << (index % 64) != 0;
             self.index += 1;
             if contains {
                 self.remaining -= 1;
@@ -104,13 +152,28 @@ impl<'a> Iterator for ClaimedInterfacesIter<'a> {
 }
 
 /// A handle to an open USB device.
-#[derive(Eq, PartialEq)]
 pub struct DeviceHandle<T: UsbContext> {
     context: T,
     handle: NonNull<libusb_device_handle>,
     interfaces: ClaimedInterfaces,
+    strings: Mutex<StringCache>,
+    stats: OnceLock<Arc<TransferStats>>,
+    hook: RwLock<Option<Arc<dyn TransferHook>>>,
+    // Set while a hook is installed, so that transfers without one do not take the lock.
+    hooked: AtomicBool,
+    cancellation: CancellationToken,
 }
 
+impl<T: UsbContext + PartialEq> PartialEq for DeviceHandle<T> {
+    fn eq(&self, other: &Self) -> bool {
+        self.context == other.context
+            && self.handle == other.handle
+            && self.interfaces == other.interfaces
+    }
+}
+
+impl<T: UsbContext + Eq> Eq for DeviceHandle<T> {}
+
 impl<T: UsbContext> Drop for DeviceHandle<T> {
     /// Closes the device.
     fn drop(&mut self) {
@@ -173,9 +236,188 @@ impl<T: UsbContext> DeviceHandle<T> {
             context,
             handle,
             interfaces: ClaimedInterfaces::new(),
+            strings: Mutex::new(StringCache::default()),
+            stats: OnceLock::new(),
+            hook: RwLock::new(None),
+            hooked: AtomicBool::new(false),
+            cancellation: CancellationToken::new(),
         }
     }
 
+    /// Starts collecting per endpoint transfer statistics and returns them.
+    ///
+    /// Once enabled, every synchronous transfer on this handle, and every
+    /// [`Transfer`](struct.Transfer.html) created for it afterwards, records its outcome and
+    /// latency. The returned [`TransferStats`](struct.TransferStats.html) can be kept to read
+    /// them from another thread. Calling this again returns the same statistics.
+    pub fn enable_stats(&self) -> Arc<TransferStats> {
+        self.stats
+            .get_or_init(|| Arc::new(TransferStats::new()))
+            .clone()
+    }
+
+    /// Returns the transfer statistics of this handle, if enabled.
+    pub fn stats(&self) -> Option<&Arc<TransferStats>> {
+        self.stats.get()
+    }
+
+    /// Installs `hook` to be called around every transfer on this handle, or removes the hook if
+    /// it is `None`.
+    ///
+    /// Like statistics, the hook covers the synchronous transfer methods and every
+    /// [`Transfer`](struct.Transfer.html) created after it was installed. Without a hook or
+    /// statistics, transfers are not timed at all.
+    pub fn set_transfer_hook(&self, hook: Option<Arc<dyn TransferHook>>) {
+        let mut current = self.hook.write().unwrap_or_else(|err| err.into_inner());
+        self.hooked.store(hook.is_some(), Ordering::Release);
+        *current = hook;
+    }
+
+    /// Returns the statistics and hook currently installed.
+    pub(crate) fn instruments(&self) -> Instruments {
+        let hook = if self.hooked.load(Ordering::Acquire) {
+            self.hook
+                .read()
+                .unwrap_or_else(|err| err.into_inner())
+                .clone()
+        } else {
+            None
+        };
+
+        Instruments {
+            stats: self.stats.get().cloned(),
+            hook,
+        }
+    }
+
+    /// Returns the cancellation token covering all [`Transfer`](struct.Transfer.html)s created
+    /// for this handle.
+    pub fn cancellation_token(&self) -> &CancellationToken {
+        &self.cancellation
+    }
+
+    /// Cancels every [`Transfer`](struct.Transfer.html) in flight on this handle and makes
+    /// further submissions fail with `Interrupted`.
+    ///
+    /// This bounds the time it takes to shut down: streams and pools built on transfers, such as
+    /// a [`BulkWriter`](struct.BulkWriter.html) flushing when it is dropped, then return as soon
+    /// as `libusb` has processed the cancellations instead of waiting for the transfers to time
+    /// out. Submissions are allowed again after
+    /// [`cancellation_token().reset()`](struct.CancellationToken.html#method.reset).
+    ///
+    /// Synchronous transfers can not be cancelled; use a deadline to bound them, for instance
+    /// with [`read_bulk_until`](#method.read_bulk_until).
+    pub fn cancel_transfers(&self) {
+        self.cancellation.cancel();
+    }
+
+    /// Runs the synchronous transfer `f` of `len` bytes on `endpoint`, reporting it to the
+    /// statistics and hook, if any.
+    pub(crate) fn instrumented<F>(&self, endpoint: u8, len: usize, f: F) -> crate::Result<usize>
+    where
+        F: FnOnce() -> crate::Result<usize>,
+    {
+        let instruments = self.instruments();
+        if !instruments.is_enabled() {
+            return f();
+        }
+
+        instruments.submitted(endpoint, len);
+        let started = Instant::now();
+        let result = f();
+        instruments.completed(endpoint, &result, started.elapsed());
+        result
+    }
+
+    /// Runs a synchronous bulk or interrupt transfer of `len` bytes at `buf` on `endpoint`.
+    ///
+    /// The caller has checked that `buf` points to `len` bytes that are valid for the direction
+    /// of `endpoint`. Partial transfers that were interrupted, or bulk transfers that timed out,
+    /// return the number of bytes moved.
+    pub(crate) unsafe fn transfer_sync(
+        &self,
+        transfer_type: TransferType,
+        endpoint: u8,
+        buf: *mut u8,
+        len: usize,
+        timeout: c_uint,
+    ) -> crate::Result<usize> {
+        let transfer = match transfer_type {
+            TransferType::Bulk => libusb_bulk_transfer,
+            _ => libusb_interrupt_transfer,
+        };
+
+        self.instrumented(endpoint, len, || {
+            let mut transferred = mem::MaybeUninit::<c_int>::uninit();
+            match transfer(
+                self.handle.as_ptr(),
+                endpoint,
+                buf as *mut c_uchar,
+                len as c_int,
+                transferred.as_mut_ptr(),
+                timeout,
+            ) {
+                0 => Ok(transferred.assume_init() as usize),
+                err if err == LIBUSB_ERROR_INTERRUPTED
+                    || (err == LIBUSB_ERROR_TIMEOUT && transfer_type == TransferType::Bulk) =>
+                {
+                    let transferred = transferred.assume_init();
+                    if transferred > 0 {
+                        Ok(transferred as usize)
+                    } else {
+                        Err(error::from_libusb(err))
+                    }
+                }
+                err => Err(error::from_libusb(err)),
+            }
+        })
+    }
+
+    /// Allocates a buffer of `len` bytes for transfers on this device.
+    ///
+    /// Device memory is used where the platform supports it, so that transfers on the buffer
+    /// avoid an extra copy in the kernel; otherwise the buffer falls back to heap memory. See
+    /// [`DeviceBuffer`](struct.DeviceBuffer.html).
+    pub fn alloc_buffer(&self, len: usize) -> crate::Result<DeviceBuffer<'_>> {
+        DeviceBuffer::new(self.handle, len)
+    }
+
+    /// Allocates up to `num_streams` bulk streams on each of `endpoints`.
+    ///
+    /// All endpoints must belong to claimed interfaces and be SuperSpeed bulk endpoints that
+    /// support streams. The streams are freed when the returned
+    /// [`BulkStreams`](struct.BulkStreams.html) is dropped.
+    ///
+    /// ## Errors
+    ///
+    /// * `InvalidParam` if an endpoint does not support streams.
+    /// * `NotSupported` if the platform or the host controller does not support streams.
+    /// * `NoDevice` if the device has been disconnected.
+    pub fn alloc_streams(
+        &self,
+        num_streams: u32,
+        endpoints: &[u8],
+    ) -> crate::Result<BulkStreams<'_, T>> {
+        BulkStreams::alloc(self, num_streams, endpoints)
+    }
+
+    /// Reads the device's Binary Object Store descriptor.
+    ///
+    /// ## Errors
+    ///
+    /// * `Pipe` if the device has no BOS descriptor, as is the case for USB 2.0 devices.
+    /// * `NoDevice` if the device has been disconnected.
+    pub fn read_bos_descriptor(&self) -> crate::Result<BosDescriptor> {
+        let mut bos = mem::MaybeUninit::<*const libusb_bos_descriptor>::uninit();
+
+        try_unsafe!(libusb_get_bos_descriptor(
+            self.handle.as_ptr(),
+            bos.as_mut_ptr()
+        ));
+
+        Ok(unsafe { bos_descriptor::from_libusb(bos.assume_init()) })
+    }
+
     /// Returns the active configuration number.
     pub fn active_configuration(&self) -> crate::Result<u8> {
         let mut config = mem::MaybeUninit::<c_int>::uninit();
@@ -188,7 +430,7 @@ impl<T: UsbContext> DeviceHandle<T> {
     }
 
     /// Sets the device's active configuration.
-    pub fn set_active_configuration(&mut self, config: u8) -> crate::Result<()> {
+    pub fn set_active_configuration(&self, config: u8) -> crate::Result<()> {
         try_unsafe!(libusb_set_configuration(
             self.handle.as_ptr(),
             c_int::from(config)
@@ -197,19 +439,19 @@ impl<T: UsbContext> DeviceHandle<T> {
     }
 
     /// Puts the device in an unconfigured state.
-    pub fn unconfigure(&mut self) -> crate::Result<()> {
+    pub fn unconfigure(&self) -> crate::Result<()> {
         try_unsafe!(libusb_set_configuration(self.handle.as_ptr(), -1));
         Ok(())
     }
 
     /// Resets the device.
-    pub fn reset(&mut self) -> crate::Result<()> {
+    pub fn reset(&self) -> crate::Result<()> {
         try_unsafe!(libusb_reset_device(self.handle.as_ptr()));
         Ok(())
     }
 
     /// Clear the halt/stall condition for an endpoint.
-    pub fn clear_halt(&mut self, endpoint: u8) -> crate::Result<()> {
+    pub fn clear_halt(&self, endpoint: u8) -> crate::Result<()> {
         try_unsafe!(libusb_clear_halt(self.handle.as_ptr(), endpoint));
         Ok(())
     }
@@ -228,7 +470,7 @@ impl<T: UsbContext> DeviceHandle<T> {
     /// Detaches an attached kernel driver from the device.
     ///
     /// This method is not supported on all platforms.
-    pub fn detach_kernel_driver(&mut self, iface: u8) -> crate::Result<()> {
+    pub fn detach_kernel_driver(&self, iface: u8) -> crate::Result<()> {
         try_unsafe!(libusb_detach_kernel_driver(
             self.handle.as_ptr(),
             c_int::from(iface)
@@ -239,7 +481,7 @@ impl<T: UsbContext> DeviceHandle<T> {
     /// Attaches a kernel driver to the device.
     ///
     /// This method is not supported on all platforms.
-    pub fn attach_kernel_driver(&mut self, iface: u8) -> crate::Result<()> {
+    pub fn attach_kernel_driver(&self, iface: u8) -> crate::Result<()> {
         try_unsafe!(libusb_attach_kernel_driver(
             self.handle.as_ptr(),
             c_int::from(iface)
@@ -256,7 +498,7 @@ impl<T: UsbContext> DeviceHandle<T> {
     /// On platforms which do not have support, this function will
     /// return `Error::NotSupported`, and rusb will continue as if
     /// this function was never called.
-    pub fn set_auto_detach_kernel_driver(&mut self, auto_detach: bool) -> crate::Result<()> {
+    pub fn set_auto_detach_kernel_driver(&self, auto_detach: bool) -> crate::Result<()> {
         try_unsafe!(libusb_set_auto_detach_kernel_driver(
             self.handle.as_ptr(),
             auto_detach.into()
@@ -268,7 +510,11 @@ impl<T: UsbContext> DeviceHandle<T> {
     ///
     /// An interface must be claimed before operating on it. All claimed interfaces are released
     /// when the device handle goes out of scope.
-    pub fn claim_interface(&mut self, iface: u8) -> crate::Result<()> {
+    ///
+    /// This only needs a shared reference, so one handle, for instance in an `Arc`, can claim and
+    /// drive several interfaces from several threads. Claiming and releasing the same interface
+    /// concurrently is not meaningful, though.
+    pub fn claim_interface(&self, iface: u8) -> crate::Result<()> {
         try_unsafe!(libusb_claim_interface(
             self.handle.as_ptr(),
             c_int::from(iface)
@@ -278,7 +524,7 @@ impl<T: UsbContext> DeviceHandle<T> {
     }
 
     /// Releases a claimed interface.
-    pub fn release_interface(&mut self, iface: u8) -> crate::Result<()> {
+    pub fn release_interface(&self, iface: u8) -> crate::Result<()> {
         try_unsafe!(libusb_release_interface(
             self.handle.as_ptr(),
             c_int::from(iface)
@@ -288,7 +534,7 @@ impl<T: UsbContext> DeviceHandle<T> {
     }
 
     /// Sets an interface's active setting.
-    pub fn set_alternate_setting(&mut self, iface: u8, setting: u8) -> crate::Result<()> {
+    pub fn set_alternate_setting(&self, iface: u8, setting: u8) -> crate::Result<()> {
         try_unsafe!(libusb_set_interface_alt_setting(
             self.handle.as_ptr(),
             c_int::from(iface),
@@ -297,6 +543,41 @@ impl<T: UsbContext> DeviceHandle<T> {
         Ok(())
     }
 
+    /// Opens the bulk IN endpoint `endpoint` for repeated reads.
+    ///
+    /// The endpoint's direction and transfer type are checked against the active configuration
+    /// once, and its maximum packet size is kept, so reads through the returned
+    /// [`BulkIn`](struct.BulkIn.html) skip those checks.
+    ///
+    /// ## Errors
+    ///
+    /// * `InvalidParam` if `endpoint` is not a bulk IN endpoint.
+    /// * `NotFound` if the active configuration has no such endpoint.
+    pub fn bulk_in(&self, endpoint: u8) -> crate::Result<BulkIn<'_, T>> {
+        BulkIn::open(self, endpoint)
+    }
+
+    /// Opens the bulk OUT endpoint `endpoint` for repeated writes.
+    ///
+    /// See [`bulk_in`](#method.bulk_in).
+    pub fn bulk_out(&self, endpoint: u8) -> crate::Result<BulkOut<'_, T>> {
+        BulkOut::open(self, endpoint)
+    }
+
+    /// Opens the interrupt IN endpoint `endpoint` for repeated reads.
+    ///
+    /// See [`bulk_in`](#method.bulk_in).
+    pub fn interrupt_in(&self, endpoint: u8) -> crate::Result<InterruptIn<'_, T>> {
+        InterruptIn::open(self, endpoint)
+    }
+
+    /// Opens the interrupt OUT endpoint `endpoint` for repeated writes.
+    ///
+    /// See [`bulk_in`](#method.bulk_in).
+    pub fn interrupt_out(&self, endpoint: u8) -> crate::Result<InterruptOut<'_, T>> {
+        InterruptOut::open(self, endpoint)
+    }
+
     /// Reads from an interrupt endpoint.
     ///
     /// This function attempts to read from the interrupt endpoint with the address given by the
@@ -328,27 +609,14 @@ impl<T: UsbContext> DeviceHandle<T> {
         if endpoint & LIBUSB_ENDPOINT_DIR_MASK != LIBUSB_ENDPOINT_IN {
             return Err(Error::InvalidParam);
         }
-        let mut transferred = mem::MaybeUninit::<c_int>::uninit();
         unsafe {
-            match libusb_interrupt_transfer(
-                self.handle.as_ptr(),
+            self.transfer_sync(
+                TransferType::Interrupt,
                 endpoint,
-                buf.as_mut_ptr() as *mut c_uchar,
-                buf.len() as c_int,
-                transferred.as_mut_ptr(),
-                timeout.as_millis() as c_uint,
-            ) {
-                0 => Ok(transferred.assume_init() as usize),
-                err if err == LIBUSB_ERROR_INTERRUPTED => {
-                    let transferred = transferred.assume_init();
-                    if transferred > 0 {
-                        Ok(transferred as usize)
-                    } else {
-                        Err(error::from_libusb(err))
-                    }
-                }
-                err => Err(error::from_libusb(err)),
-            }
+                buf.as_mut_ptr(),
+                buf.len(),
+                millis_from_duration(timeout),
+            )
         }
     }
 
@@ -381,27 +649,14 @@ impl<T: UsbContext> DeviceHandle<T> {
         if endpoint & LIBUSB_ENDPOINT_DIR_MASK != LIBUSB_ENDPOINT_OUT {
             return Err(Error::InvalidParam);
         }
-        let mut transferred = mem::MaybeUninit::<c_int>::uninit();
         unsafe {
-            match libusb_interrupt_transfer(
-                self.handle.as_ptr(),
+            self.transfer_sync(
+                TransferType::Interrupt,
                 endpoint,
-                buf.as_ptr() as *mut c_uchar,
-                buf.len() as c_int,
-                transferred.as_mut_ptr(),
-                timeout.as_millis() as c_uint,
-            ) {
-                0 => Ok(transferred.assume_init() as usize),
-                err if err == LIBUSB_ERROR_INTERRUPTED => {
-                    let transferred = transferred.assume_init();
-                    if transferred > 0 {
-                        Ok(transferred as usize)
-                    } else {
-                        Err(error::from_libusb(err))
-                    }
-                }
-                err => Err(error::from_libusb(err)),
-            }
+                buf.as_ptr() as *mut u8,
+                buf.len(),
+                millis_from_duration(timeout),
+            )
         }
     }
 
@@ -436,27 +691,14 @@ impl<T: UsbContext> DeviceHandle<T> {
         if endpoint & LIBUSB_ENDPOINT_DIR_MASK != LIBUSB_ENDPOINT_IN {
             return Err(Error::InvalidParam);
         }
-        let mut transferred = mem::MaybeUninit::<c_int>::uninit();
         unsafe {
-            match libusb_bulk_transfer(
-                self.handle.as_ptr(),
+            self.transfer_sync(
+                TransferType::Bulk,
                 endpoint,
-                buf.as_mut_ptr() as *mut c_uchar,
-                buf.len() as c_int,
-                transferred.as_mut_ptr(),
-                timeout.as_millis() as c_uint,
-            ) {
-                0 => Ok(transferred.assume_init() as usize),
-                err if err == LIBUSB_ERROR_INTERRUPTED || err == LIBUSB_ERROR_TIMEOUT => {
-                    let transferred = transferred.assume_init();
-                    if transferred > 0 {
-                        Ok(transferred as usize)
-                    } else {
-                        Err(error::from_libusb(err))
-                    }
-                }
-                err => Err(error::from_libusb(err)),
-            }
+                buf.as_mut_ptr(),
+                buf.len(),
+                millis_from_duration(timeout),
+            )
         }
     }
 
@@ -484,27 +726,101 @@ impl<T: UsbContext> DeviceHandle<T> {
         if endpoint & LIBUSB_ENDPOINT_DIR_MASK != LIBUSB_ENDPOINT_OUT {
             return Err(Error::InvalidParam);
         }
-        let mut transferred = mem::MaybeUninit::<c_int>::uninit();
         unsafe {
-            match libusb_bulk_transfer(
+            self.transfer_sync(
+                TransferType::Bulk,
+                endpoint,
+                buf.as_ptr() as *mut u8,
+                buf.len(),
+                millis_from_duration(timeout),
+            )
+        }
+    }
+
+    /// Reads from a bulk endpoint into several buffers.
+    ///
+    /// This behaves like [`read_bulk`](#method.read_bulk) on the concatenation of `bufs`: the
+    /// buffers are filled in order until the device ends the transfer with a short packet or all
+    /// of them are full. Data goes straight into the buffers, except for the packets that
+    /// straddle two buffers whose boundary is not a multiple of the endpoint's maximum packet
+    /// size, which are read into scratch memory and copied.
+    ///
+    /// Pieces are read one after the other, since data following a short packet belongs to the
+    /// device's next transfer.
+    ///
+    /// ## Errors
+    ///
+    /// The errors are those of [`read_bulk`](#method.read_bulk). If an error occurs after some
+    /// data was read, the number of bytes read so far is returned instead.
+    pub fn read_bulk_vectored(
+        &self,
+        endpoint: u8,
+        bufs: &mut [IoSliceMut<'_>],
+        timeout: Duration,
+    ) -> crate::Result<usize> {
+        if endpoint & LIBUSB_ENDPOINT_DIR_MASK != LIBUSB_ENDPOINT_IN {
+            return Err(Error::InvalidParam);
+        }
+        let max_packet_size = self.bulk_packet_size(endpoint);
+        let len = bufs.iter().map(|buf| buf.len()).sum();
+        self.instrumented(endpoint, len, || {
+            vectored::read_bulk(
                 self.handle.as_ptr(),
                 endpoint,
-                buf.as_ptr() as *mut c_uchar,
-                buf.len() as c_int,
-                transferred.as_mut_ptr(),
-                timeout.as_millis() as c_uint,
-            ) {
-                0 => Ok(transferred.assume_init() as usize),
-                err if err == LIBUSB_ERROR_INTERRUPTED || err == LIBUSB_ERROR_TIMEOUT => {
-                    let transferred = transferred.assume_init();
-                    if transferred > 0 {
-                        Ok(transferred as usize)
-                    } else {
-                        Err(error::from_libusb(err))
-                    }
-                }
-                err => Err(error::from_libusb(err)),
-            }
+                max_packet_size,
+                bufs,
+                timeout,
+            )
+        })
+    }
+
+    /// Writes several buffers to a bulk endpoint as one transfer.
+    ///
+    /// The device receives exactly what [`write_bulk`](#method.write_bulk) would send for the
+    /// concatenation of `bufs`, without concatenating them first: buffers are submitted as
+    /// back to back asynchronous transfers straight from their memory. Only the packets that
+    /// straddle two buffers whose boundary is not a multiple of the endpoint's maximum packet
+    /// size are gathered into scratch memory, so every transfer but the last ends on a packet
+    /// boundary and no short packet appears in the middle.
+    ///
+    /// If `zero_packet` is true and the total length is a multiple of the maximum packet size,
+    /// a zero length packet is sent after the data to mark the end of the transfer.
+    ///
+    /// ## Errors
+    ///
+    /// The errors are those of [`write_bulk`](#method.write_bulk). If an error occurs after some
+    /// data was written, the number of bytes written is returned instead.
+    pub fn write_bulk_vectored(
+        &self,
+        endpoint: u8,
+        bufs: &[IoSlice<'_>],
+        zero_packet: bool,
+        timeout: Duration,
+    ) -> crate::Result<usize> {
+        if endpoint & LIBUSB_ENDPOINT_DIR_MASK != LIBUSB_ENDPOINT_OUT {
+            return Err(Error::InvalidParam);
+        }
+        let max_packet_size = self.bulk_packet_size(endpoint);
+        let len = bufs.iter().map(|buf| buf.len()).sum();
+        self.instrumented(endpoint, len, || {
+            vectored::write_bulk(
+                self.context.as_raw(),
+                self.handle.as_ptr(),
+                endpoint,
+                max_packet_size,
+                bufs,
+                zero_packet,
+                timeout,
+            )
+        })
+    }
+
+    /// Returns the maximum packet size of a bulk endpoint, or `usize::MAX` if it is unknown so
+    /// that vectored transfers gather all data.
+    fn bulk_packet_size(&self, endpoint: u8) -> usize {
+        match self.device().max_packet_size(endpoint) {
+            Ok(size) if size > 0 => size as usize,
+            _ => usize::MAX,
         }
     }
 
@@ -547,24 +863,26 @@ impl<T: UsbContext> DeviceHandle<T> {
         if request_type & LIBUSB_ENDPOINT_DIR_MASK != LIBUSB_ENDPOINT_IN {
             return Err(Error::InvalidParam);
         }
-        let res = unsafe {
-            libusb_control_transfer(
-                self.handle.as_ptr(),
-                request_type,
-                request,
-                value,
-                index,
-                buf.as_mut_ptr() as *mut c_uchar,
-                buf.len() as u16,
-                timeout.as_millis() as c_uint,
-            )
-        };
-
-        if res < 0 {
-            Err(error::from_libusb(res))
-        } else {
-            Ok(res as usize)
-        }
+        self.instrumented(request_type & LIBUSB_ENDPOINT_DIR_MASK, buf.len(), || {
+            let res = unsafe {
+                libusb_control_transfer(
+                    self.handle.as_ptr(),
+                    request_type,
+                    request,
+                    value,
+                    index,
+                    buf.as_mut_ptr() as *mut c_uchar,
+                    buf.len() as u16,
+                    millis_from_duration(timeout),
+                )
+            };
+
+            if res < 0 {
+                Err(error::from_libusb(res))
+            } else {
+                Ok(res as usize)
+            }
+        })
     }
 
     /// Writes data using a control transfer.
@@ -605,24 +923,112 @@ impl<T: UsbContext> DeviceHandle<T> {
         if request_type & LIBUSB_ENDPOINT_DIR_MASK != LIBUSB_ENDPOINT_OUT {
             return Err(Error::InvalidParam);
         }
-        let res = unsafe {
-            libusb_control_transfer(
-                self.handle.as_ptr(),
-                request_type,
-                request,
-                value,
-                index,
-                buf.as_ptr() as *mut c_uchar,
-                buf.len() as u16,
-                timeout.as_millis() as c_uint,
-            )
-        };
+        self.instrumented(request_type & LIBUSB_ENDPOINT_DIR_MASK, buf.len(), || {
+            let res = unsafe {
+                libusb_control_transfer(
+                    self.handle.as_ptr(),
+                    request_type,
+                    request,
+                    value,
+                    index,
+                    buf.as_ptr() as *mut c_uchar,
+                    buf.len() as u16,
+                    millis_from_duration(timeout),
+                )
+            };
+
+            if res < 0 {
+                Err(error::from_libusb(res))
+            } else {
+                Ok(res as usize)
+            }
+        })
+    }
 
-        if res < 0 {
-            Err(error::from_libusb(res))
-        } else {
-            Ok(res as usize)
-        }
+    /// Reads from an interrupt endpoint, giving up at `deadline`.
+    ///
+    /// This behaves like [`read_interrupt`](#method.read_interrupt) with the time left until
+    /// `deadline` as timeout, so the deadline stays fixed over repeated calls, for instance in a
+    /// retry loop.
+    ///
+    /// ## Errors
+    ///
+    /// Returns `Timeout` without starting a transfer if `deadline` has already passed.
+    pub fn read_interrupt_until(
+        &self,
+        endpoint: u8,
+        buf: &mut [u8],
+        deadline: Instant,
+    ) -> crate::Result<usize> {
+        self.read_interrupt(endpoint, buf, context::remaining(deadline)?)
+    }
+
+    /// Writes to an interrupt endpoint, giving up at `deadline`.
+    ///
+    /// See [`read_interrupt_until`](#method.read_interrupt_until).
+    pub fn write_interrupt_until(
+        &self,
+        endpoint: u8,
+        buf: &[u8],
+        deadline: Instant,
+    ) -> crate::Result<usize> {
+        self.write_interrupt(endpoint, buf, context::remaining(deadline)?)
+    }
+
+    /// Reads from a bulk endpoint, giving up at `deadline`.
+    ///
+    /// See [`read_interrupt_until`](#method.read_interrupt_until).
+    pub fn read_bulk_until(
+        &self,
+        endpoint: u8,
+        buf: &mut [u8],
+        deadline: Instant,
+    ) -> crate::Result<usize> {
+        self.read_bulk(endpoint, buf, context::remaining(deadline)?)
+    }
+
+    /// Writes to a bulk endpoint, giving up at `deadline`.
+    ///
+    /// See [`read_interrupt_until`](#method.read_interrupt_until).
+    pub fn write_bulk_until(
+        &self,
+        endpoint: u8,
+        buf: &[u8],
+        deadline: Instant,
+    ) -> crate::Result<usize> {
+        self.write_bulk(endpoint, buf, context::remaining(deadline)?)
+    }
+
+    /// Reads data using a control transfer, giving up at `deadline`.
+    ///
+    /// See [`read_interrupt_until`](#method.read_interrupt_until).
+    pub fn read_control_until(
+        &self,
+        request_type: u8,
+        request: u8,
+        value: u16,
+        index: u16,
+        buf: &mut [u8],
+        deadline: Instant,
+    ) -> crate::Result<usize> {
+        let timeout = context::remaining(deadline)?;
+        self.read_control(request_type, request, value, index, buf, timeout)
+    }
+
+    /// Writes data using a control transfer, giving up at `deadline`.
+    ///
+    /// See [`read_interrupt_until`](#method.read_interrupt_until).
+    pub fn write_control_until(
+        &self,
+        request_type: u8,
+        request: u8,
+        value: u16,
+        index: u16,
+        buf: &[u8],
+        deadline: Instant,
+    ) -> crate::Result<usize> {
+        let timeout = context::remaining(deadline)?;
+        self.write_control(request_type, request, value, index, buf, timeout)
     }
 
     /// Reads the languages supported by the device's string descriptors.
@@ -641,22 +1047,41 @@ impl<T: UsbContext> DeviceHandle<T> {
             timeout,
         )?;
 
-        if len < 2 || buf[0] != len as u8 || len & 0x01 != 0 {
-            return Err(Error::BadDescriptor);
-        }
+        string_cache::parse_languages(&buf[..len])
+    }
+
+    /// Reads the languages supported by the device's string descriptors without allocating.
+    ///
+    /// The descriptor is returned inline in the iterator, so this is suitable for code that
+    /// must not touch the heap. Otherwise it behaves like
+    /// [`read_languages`](#method.read_languages).
+    pub fn read_languages_iter(&self, timeout: Duration) -> crate::Result<Languages> {
+        let mut buf = [0u8; string_cache::MAX_DESCRIPTOR_SIZE];
+
+        let len = self.read_control(
+            request_type(Direction::In, RequestType::Standard, Recipient::Device),
+            LIBUSB_REQUEST_GET_DESCRIPTOR,
+            u16::from(LIBUSB_DT_STRING) << 8,
+            0,
+            &mut buf,
+            timeout,
+        )?;
+
+        Languages::new(buf, len)
+    }
 
-        if len == 2 {
-            return Ok(Vec::new());
+    /// Returns the languages supported by the device's string descriptors, reading them only
+    /// the first time.
+    ///
+    /// See [`clear_string_cache`](#method.clear_string_cache).
+    pub fn read_languages_cached(&self, timeout: Duration) -> crate::Result<Vec<Language>> {
+        if let Some(ref languages) = self.strings.lock().unwrap().languages {
+            return Ok(languages.clone());
         }
 
-        Ok(buf[0..len]
-            .chunks(2)
-            .skip(1)
-            .map(|chunk| {
-                let lang_id = u16::from(chunk[0]) | u16::from(chunk[1]) << 8;
-                crate::language::from_lang_id(lang_id)
-            })
-            .collect())
+        let languages = self.read_languages(timeout)?;
+        self.strings.lock().unwrap().languages = Some(languages.clone());
+        Ok(languages)
     }
 
     /// Reads a ascii string descriptor from the device.
@@ -682,6 +1107,33 @@ impl<T: UsbContext> DeviceHandle<T> {
         String::from_utf8(buf).map_err(|_| Error::Other)
     }
 
+    /// Reads a ascii string descriptor from the device into `buf` without allocating.
+    ///
+    /// Returns the part of `buf` holding the string, which is truncated if `buf` is too small.
+    /// A buffer of 255 bytes always fits the whole string.
+    pub fn read_string_descriptor_ascii_into<'b>(
+        &self,
+        index: u8,
+        buf: &'b mut [u8],
+    ) -> crate::Result<&'b str> {
+        let capacity = buf.len().min(c_int::MAX as usize) as c_int;
+
+        let res = unsafe {
+            libusb_get_string_descriptor_ascii(
+                self.handle.as_ptr(),
+                index,
+                buf.as_mut_ptr() as *mut c_uchar,
+                capacity,
+            )
+        };
+
+        if res < 0 {
+            return Err(error::from_libusb(res));
+        }
+
+        str::from_utf8(&buf[..res as usize]).map_err(|_| Error::Other)
+    }
+
     /// Reads a string descriptor from the device.
     ///
     /// `language` should be one of the languages returned from [`read_languages`](#method.read_languages).
@@ -702,21 +1154,161 @@ impl<T: UsbContext> DeviceHandle<T> {
             timeout,
         )?;
 
-        if len < 2 || buf[0] != len as u8 || len & 0x01 != 0 {
-            return Err(Error::BadDescriptor);
+        string_cache::parse_string(&buf[..len])
+    }
+
+    /// Reads a string descriptor from the device into `buf` as UTF-8 without allocating.
+    ///
+    /// Returns the part of `buf` holding the string. A buffer of 384 bytes always fits the
+    /// longest string a descriptor can hold.
+    ///
+    /// ## Errors
+    ///
+    /// Returns `Error::Overflow` if the string does not fit into `buf`.
+    pub fn read_string_descriptor_into<'b>(
+        &self,
+        language: Language,
+        index: u8,
+        buf: &'b mut [u8],
+        timeout: Duration,
+    ) -> crate::Result<&'b str> {
+        let mut descriptor = [0u8; string_cache::MAX_DESCRIPTOR_SIZE];
+
+        let len = self.read_control(
+            request_type(Direction::In, RequestType::Standard, Recipient::Device),
+            LIBUSB_REQUEST_GET_DESCRIPTOR,
+            u16::from(LIBUSB_DT_STRING) << 8 | u16::from(index),
+            language.lang_id(),
+            &mut descriptor,
+            timeout,
+        )?;
+
+        string_cache::decode_string_into(&descriptor[..len], buf)
+    }
+
+    /// Returns a string descriptor, reading it from the device only the first time.
+    ///
+    /// See [`clear_string_cache`](#method.clear_string_cache).
+    pub fn read_string_descriptor_cached(
+        &self,
+        language: Language,
+        index: u8,
+        timeout: Duration,
+    ) -> crate::Result<String> {
+        if let Some(string) = self.strings.lock().unwrap().string(language, index) {
+            return Ok(string.clone());
+        }
+
+        let string = self.read_string_descriptor(language, index, timeout)?;
+        self.strings
+            .lock()
+            .unwrap()
+            .insert_string(language, index, string.clone());
+        Ok(string)
+    }
+
+    /// Reads the manufacturer, product and serial number strings of `device` at once.
+    ///
+    /// The strings that are not cached yet are requested together, so this costs about one
+    /// round trip instead of three. The strings are added to the cache used by
+    /// [`read_string_descriptor_cached`](#method.read_string_descriptor_cached).
+    ///
+    /// A string that the device rejects or returns malformed is `None` in the result, so one
+    /// bad descriptor does not hide the others.
+    ///
+    /// ## Errors
+    ///
+    /// * `Timeout` if a request timed out.
+    /// * `NoDevice` if the device has been disconnected.
+    /// * `Io` if a request encountered an I/O error.
+    pub fn read_strings(
+        &self,
+        language: Language,
+        device: &DeviceDescriptor,
+        timeout: Duration,
+    ) -> crate::Result<DeviceStrings> {
+        let indices = [
+            device.manufacturer_string_index(),
+            device.product_string_index(),
+            device.serial_number_string_index(),
+        ];
+        let mut strings: [Option<String>; 3] = Default::default();
+
+        let mut batch = ControlBatch::new(self, timeout);
+        let mut requested = Vec::with_capacity(indices.len());
+        {
+            let cache = self.strings.lock().unwrap();
+            for (i, index) in indices.iter().enumerate() {
+                let index = match *index {
+                    Some(index) => index,
+                    None => continue,
+                };
+                if let Some(string) = cache.string(language, index) {
+                    strings[i] = Some(string.clone());
+                } else if !requested.iter().any(|&(_, n)| n == index) {
+                    batch.read(
+                        request_type(Direction::In, RequestType::Standard, Recipient::Device),
+                        LIBUSB_REQUEST_GET_DESCRIPTOR,
+                        u16::from(LIBUSB_DT_STRING) << 8 | u16::from(index),
+                        language.lang_id(),
+                        255,
+                    )?;
+                    requested.push((i, index));
+                }
+            }
         }
 
-        if len == 2 {
-            return Ok(String::new());
+        for (n, result) in batch.execute().into_iter().enumerate() {
+            let (i, index) = requested[n];
+            match result {
+                Ok(_) => {
+                    if let Ok(string) = string_cache::parse_string(batch.data(n)) {
+                        self.strings
+                            .lock()
+                            .unwrap()
+                            .insert_string(language, index, string.clone());
+                        strings[i] = Some(string);
+                    }
+                }
+                Err(Error::Pipe) => {}
+                Err(err) => return Err(err),
+            }
         }
 
-        let utf16: Vec<u16> = buf[..len]
-            .chunks(2)
-            .skip(1)
-            .map(|chunk| u16::from(chunk[0]) | u16::from(chunk[1]) << 8)
-            .collect();
+        // Descriptors may share a string index.
+        for i in 0..indices.len() {
+            if strings[i].is_none() && indices[i].is_some() {
+                strings[i] = (0..indices.len())
+                    .find(|&j| indices[j] == indices[i] && strings[j].is_some())
+                    .and_then(|j| strings[j].clone());
+            }
+        }
+
+        let [manufacturer, product, serial_number] = strings;
+        Ok(DeviceStrings {
+            manufacturer,
+            product,
+            serial_number,
+        })
+    }
+
+    /// Forgets the languages and strings cached by the `_cached` read methods and
+    /// [`read_strings`](#method.read_strings).
+    pub fn clear_string_cache(&self) {
+        self.strings.lock().unwrap().clear();
+    }
 
-        String::from_utf16(&utf16).map_err(|_| Error::Other)
+    /// Fills the string cache with languages and strings known from elsewhere, such as a
+    /// snapshot, so the `_cached` read methods do not go to the device for them.
+    pub(crate) fn prime_string_cache<'a, I>(&self, languages: &[Language], strings: I)
+    where
+        I: IntoIterator<Item = (Language, u8, &'a str)>,
+    {
+        let mut cache = self.strings.lock().unwrap();
+        cache.languages = Some(languages.to_vec());
+        for (language, index, string) in strings {
+            cache.insert_string(language, index, string.to_owned());
+        }
     }
 
     /// Reads the device's manufacturer string descriptor (ascii).
@@ -835,7 +1427,7 @@ mod tests {
 
     #[test]
     fn claimed_interfaces_one_element() {
-        let mut interfaces = ClaimedInterfaces::new();
+        let interfaces = ClaimedInterfaces::new();
         interfaces.insert(94);
         assert_eq!(interfaces.size(), 1);
         assert!(interfaces.contains(94));
@@ -859,7 +1451,7 @@ mod tests {
 
     #[test]
     fn claimed_interfaces_many_elements() {
-        let mut interfaces = ClaimedInterfaces::new();
+        let interfaces = ClaimedInterfaces::new();
         let elements = vec![94, 0, 255, 17, 183, 6];
 
         for (index, &interface) in elements.iter().enumerate() {
@@ -898,4 +1490,29 @@ mod tests {
             }
         }
     }
+
+    #[test]
+    fn claimed_interfaces_shared_between_threads() {
+        let interfaces = std::sync::Arc::new(ClaimedInterfaces::new());
+
+        let threads = (0..4u8)
+            .map(|t| {
+                let interfaces = interfaces.clone();
+                std::thread::spawn(move || {
+                    for i in (t..=u8::MAX).step_by(4) {
+                        interfaces.insert(i);
+                    }
+                    for i in (t..=u8::MAX).step_by(8) {
+                        interfaces.remove(i);
+                    }
+                })
+            })
+            .collect::<Vec<_>>();
+        for thread in threads {
+            thread.join().unwrap();
+        }
+
+        assert_eq!(interfaces.size(), 128);
+        assert!(interfaces.iter().all(|i| i % 8 >= 4));
+    }
 }
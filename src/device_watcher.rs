@@ -0,0 +1,310 @@
+use std::{
+    collections::HashMap,
+    fmt::{self, Debug, Display},
+    mem,
+};
+
+use libusb1_sys::{constants::*, *};
+
+use crate::{
+    context::{Registration, UsbContext},
+    device::Device,
+    hotplug::{HotplugBuilder, HotplugEvent, HotplugReceiver},
+};
+
+/// Number of hotplug events held between two polls before the watcher falls back to listing
+/// the devices.
+const HOTPLUG_QUEUE_CAPACITY: usize = 256;
+
+/// The position of a device in the USB topology: its bus and the ports leading to it from the
+/// root hub.
+///
+/// Unlike the bus address, the path stays the same when a device is replugged into the same
+/// port.
+#[derive(Copy, Clone, Eq, PartialEq, Hash, Ord, PartialOrd)]
+pub struct PortPath {
+    bus: u8,
+    depth: u8,
+    // As per the USB 3.0 specs, the current maximum limit for the depth is 7.
+    ports: [u8; 7],
+}
+
+impl PortPath {
+    /// Returns the path of `device`.
+    pub fn of<T: UsbContext>(device: &Device<T>) -> Self {
+        let mut ports = [0; 7];
+        let n = unsafe {
+            libusb_get_port_numbers(device.as_raw(), ports.as_mut_ptr(), ports.len() as i32)
+        };
+
+        PortPath {
+            bus: device.bus_number(),
+            depth: n.max(0) as u8,
+            ports,
+        }
+    }
+
+    /// Returns the bus number.
+    pub fn bus_number(&self) -> u8 {
+        self.bus
+    }
+
+    /// Returns the port numbers from the root hub to the device. Root hubs have no ports.
+    pub fn port_numbers(&self) -> &[u8] {
+        &self.ports[..self.depth as usize]
+    }
+}
+
+impl Display for PortPath {
+    /// Formats the path the way Linux names devices in sysfs, for instance `1-4.2`.
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        write!(f, "{}", self.bus)?;
+        for (i, port) in self.port_numbers().iter().enumerate() {
+            write!(f, "{}{}", if i == 0 { '-' } else { '.' }, port)?;
+        }
+        Ok(())
+    }
+}
+
+impl Debug for PortPath {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        write!(f, "PortPath({})", self)
+    }
+}
+
+/// Devices that were added and removed since the previous call to
+/// [`DeviceWatcher::poll`](struct.DeviceWatcher.html#method.poll).
+#[derive(Debug)]
+pub struct DeviceChanges<T: UsbContext> {
+    added: Vec<Device<T>>,
+    removed: Vec<Device<T>>,
+    unchanged: usize,
+}
+
+impl<T: UsbContext> DeviceChanges<T> {
+    fn new() -> Self {
+        DeviceChanges {
+            added: Vec::new(),
+            removed: Vec::new(),
+            unchanged: 0,
+        }
+    }
+
+    /// Returns the devices that appeared.
+    pub fn added(&self) -> &[Device<T>] {
+        &self.added
+    }
+
+    /// Returns the devices that disappeared.
+    pub fn removed(&self) -> &[Device<T>] {
+        &self.removed
+    }
+
+    /// Returns the number of devices that were present before and still are.
+    pub fn unchanged(&self) -> usize {
+        self.unchanged
+    }
+
+    /// Returns true if no device was added or removed.
+    pub fn is_empty(&self) -> bool {
+        self.added.is_empty() && self.removed.is_empty()
+    }
+
+    /// Splits the changes into the added and the removed devices.
+    pub fn into_parts(self) -> (Vec<Device<T>>, Vec<Device<T>>) {
+        (self.added, self.removed)
+    }
+}
+
+/// Tracks the devices connected to a context.
+///
+/// The watcher keeps the devices it has seen, keyed by [`PortPath`], and reports only what
+/// changed. Where libusb supports hotplug, changes are collected from hotplug notifications, so
+/// [`poll`](#method.poll) does not touch the device list at all; the notifications are only
+/// delivered while events on the context are handled, for instance by an
+/// [`EventThread`](struct.EventThread.html). Elsewhere `poll` lists the devices and diffs them
+/// against the previous snapshot, which only compares device references and port paths and
+/// reads no descriptors.
+///
+/// A device that is replugged between two polls is reported as removed and added again.
+pub struct DeviceWatcher<T: UsbContext> {
+    context: T,
+    devices: HashMap<PortPath, Device<T>>,
+    hotplug: Option<(HotplugReceiver<T>, Registration<T>)>,
+}
+
+impl<T: UsbContext + 'static> DeviceWatcher<T> {
+    /// Creates a watcher for `context` holding the devices currently connected.
+    ///
+    /// Hotplug notifications are used if libusb supports them.
+    pub fn new(context: T) -> crate::Result<Self> {
+        let has_hotplug = unsafe { libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG) != 0 };
+
+        // Register first, so that no device can slip in between the snapshot and the
+        // registration. Devices reported twice are filtered out by `poll`.
+        let hotplug = if has_hotplug {
+            let (registration, receiver) =
+                HotplugBuilder::new().register_queue(&context, HOTPLUG_QUEUE_CAPACITY)?;
+            Some((receiver, registration))
+        } else {
+            None
+        };
+
+        let mut watcher = DeviceWatcher {
+            context,
+            devices: HashMap::new(),
+            hotplug,
+        };
+        watcher.rescan()?;
+        Ok(watcher)
+    }
+}
+
+impl<T: UsbContext> DeviceWatcher<T> {
+    /// Returns true if changes are detected through hotplug notifications.
+    pub fn uses_hotplug(&self) -> bool {
+        self.hotplug.is_some()
+    }
+
+    /// Returns the devices that were connected as of the last poll.
+    pub fn devices(&self) -> impl Iterator<Item = &Device<T>> {
+        self.devices.values()
+    }
+
+    /// Returns the device at `path`, if one was connected as of the last poll.
+    pub fn get(&self, path: &PortPath) -> Option<&Device<T>> {
+        self.devices.get(path)
+    }
+
+    /// Returns the number of devices that were connected as of the last poll.
+    pub fn len(&self) -> usize {
+        self.devices.len()
+    }
+
+    /// Returns true if no devices were connected as of the last poll.
+    pub fn is_empty(&self) -> bool {
+        self.devices.is_empty()
+    }
+
+    /// Returns the changes since the previous poll.
+    pub fn poll(&mut self) -> crate::Result<DeviceChanges<T>> {
+        let events = match self.hotplug {
+            Some((ref receiver, _)) => {
+                let events = receiver.drain().collect::<Vec<_>>();
+                if receiver.take_dropped() == 0 {
+                    Some(events)
+                } else {
+                    // Some changes were lost, so only a full listing is reliable.
+                    None
+                }
+            }
+            None => None,
+        };
+
+        match events {
+            Some(events) => Ok(self.apply(events)),
+            None => self.rescan(),
+        }
+    }
+
+    /// Lists the devices and diffs them against the snapshot.
+    fn rescan(&mut self) -> crate::Result<DeviceChanges<T>> {
+        let list = self.context.devices()?;
+        let mut previous = mem::replace(&mut self.devices, HashMap::with_capacity(list.len()));
+        let mut changes = DeviceChanges::new();
+
+        for device in list.iter() {
+            let path = device.port_path();
+            match previous.remove(&path) {
+                Some(old) if old.as_raw() == device.as_raw() => {
+                    changes.unchanged += 1;
+                    self.devices.insert(path, old);
+                }
+                old => {
+                    changes.removed.extend(old);
+                    changes.added.push(device.clone());
+                    self.devices.insert(path, device);
+                }
+            }
+        }
+
+        changes.removed.extend(previous.into_values());
+        Ok(changes)
+    }
+
+    /// Applies queued hotplug notifications to the snapshot.
+    fn apply(&mut self, events: Vec<HotplugEvent<T>>) -> DeviceChanges<T> {
+        let mut changes = DeviceChanges::new();
+
+        for event in events {
+            match event {
+                HotplugEvent::Arrived(device) => {
+                    let path = device.port_path();
+                    match self.devices.get(&path) {
+                        Some(old) if old.as_raw() == device.as_raw() => {}
+                        _ => {
+                            changes.removed.extend(self.devices.remove(&path));
+                            changes.added.push(device.clone());
+                            self.devices.insert(path, device);
+                        }
+                    }
+                }
+                HotplugEvent::Left(device) => {
+                    let path = device.port_path();
+                    if let Some(old) = self.devices.get(&path) {
+                        if old.as_raw() == device.as_raw() {
+                            changes.removed.extend(self.devices.remove(&path));
+                        }
+                    }
+                }
+            }
+        }
+
+        // A device that came and went between two polls is not reported at all.
+        let removed = &mut changes.removed;
+        changes.added.retain(|device| {
+            match removed.iter().position(|r| r.as_raw() == device.as_raw()) {
+                Some(i) => {
+                    removed.swap_remove(i);
+                    false
+                }
+                None => true,
+            }
+        });
+
+        changes.unchanged = self.devices.len() - changes.added.len();
+        changes
+    }
+}
+
+impl<T: UsbContext> Debug for DeviceWatcher<T> {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.debug_struct("DeviceWatcher")
+            .field("devices", &self.devices.len())
+            .field("hotplug", &self.hotplug.is_some())
+            .finish()
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::PortPath;
+
+    #[test]
+    fn it_formats_port_paths() {
+        let root = PortPath {
+            bus: 1,
+            depth: 0,
+            ports: [0; 7],
+        };
+        let device = PortPath {
+            bus: 3,
+            depth: 2,
+            ports: [4, 2, 0, 0, 0, 0, 0],
+        };
+
+        assert_eq!("1", root.to_string());
+        assert_eq!("3-4.2", device.to_string());
+        assert_eq!(&[4, 2], device.port_numbers());
+    }
+}
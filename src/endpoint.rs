@@ -0,0 +1,384 @@
+use std::{
+    fmt,
+    time::{Duration, Instant},
+};
+
+use libc::c_uint;
+use libusb1_sys::constants::*;
+
+use crate::{
+    config_descriptor::ConfigDescriptor,
+    context::{self, millis_from_duration},
+    device_handle::DeviceHandle,
+    error::Error,
+    fields::{Direction, TransferType},
+    transfer_stats::EndpointStats,
+    UsbContext,
+};
+
+/// What the active configuration declares about an endpoint.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+struct EndpointInfo {
+    transfer_type: TransferType,
+    // Without the additional transactions of high-bandwidth endpoints, which
+    // `max_interval_size` includes.
+    max_packet_size: u16,
+    max_interval_size: usize,
+    interval: u8,
+}
+
+/// Looks `address` up in `config`, taking the first alternate setting that declares it.
+fn find_endpoint(config: &ConfigDescriptor, address: u8) -> Option<EndpointInfo> {
+    for interface in config.interfaces() {
+        for setting in interface.descriptors() {
+            for endpoint in setting.endpoint_descriptors() {
+                if endpoint.address() == address {
+                    return Some(EndpointInfo {
+                        transfer_type: endpoint.transfer_type(),
+                        max_packet_size: endpoint.max_packet_size() & 0x07ff,
+                        max_interval_size: endpoint.max_iso_packet_size(),
+                        interval: endpoint.interval(),
+                    });
+                }
+            }
+        }
+    }
+
+    None
+}
+
+/// Rounds `len` up to a multiple of `max_packet_size`.
+fn align_len(len: usize, max_packet_size: u16) -> usize {
+    match max_packet_size as usize {
+        0 => len,
+        mps => len.div_ceil(mps) * mps,
+    }
+}
+
+/// State shared by all typed endpoints.
+struct Endpoint<'h, T: UsbContext> {
+    handle: &'h DeviceHandle<T>,
+    address: u8,
+    info: EndpointInfo,
+    timeout: Duration,
+    timeout_ms: c_uint,
+}
+
+impl<'h, T: UsbContext> Endpoint<'h, T> {
+    fn open(
+        handle: &'h DeviceHandle<T>,
+        address: u8,
+        direction: Direction,
+        transfer_type: TransferType,
+    ) -> crate::Result<Self> {
+        let in_address = address & LIBUSB_ENDPOINT_DIR_MASK == LIBUSB_ENDPOINT_IN;
+        if in_address != (direction == Direction::In) {
+            return Err(Error::InvalidParam);
+        }
+
+        let config = handle.device().active_config_descriptor()?;
+        let info = find_endpoint(&config, address).ok_or(Error::NotFound)?;
+        if info.transfer_type != transfer_type {
+            return Err(Error::InvalidParam);
+        }
+
+        Ok(Endpoint {
+            handle,
+            address,
+            info,
+            timeout: Duration::from_secs(0),
+            timeout_ms: 0,
+        })
+    }
+
+    fn set_timeout(&mut self, timeout: Duration) {
+        self.timeout = timeout;
+        self.timeout_ms = millis_from_duration(timeout);
+    }
+
+    fn read(&self, buf: &mut [u8], timeout_ms: c_uint) -> crate::Result<usize> {
+        unsafe {
+            self.handle.transfer_sync(
+                self.info.transfer_type,
+                self.address,
+                buf.as_mut_ptr(),
+                buf.len(),
+                timeout_ms,
+            )
+        }
+    }
+
+    fn write(&self, buf: &[u8], timeout_ms: c_uint) -> crate::Result<usize> {
+        unsafe {
+            self.handle.transfer_sync(
+                self.info.transfer_type,
+                self.address,
+                buf.as_ptr() as *mut u8,
+                buf.len(),
+                timeout_ms,
+            )
+        }
+    }
+}
+
+macro_rules! typed_endpoint {
+    ($(#[$attr:meta])* $name:ident) => {
+        $(#[$attr])*
+        pub struct $name<'h, T: UsbContext> {
+            inner: Endpoint<'h, T>,
+        }
+
+        impl<'h, T: UsbContext> $name<'h, T> {
+            /// Returns the handle this endpoint belongs to.
+            pub fn handle(&self) -> &'h DeviceHandle<T> {
+                self.inner.handle
+            }
+
+            /// Returns the endpoint's address.
+            pub fn address(&self) -> u8 {
+                self.inner.address
+            }
+
+            /// Returns the endpoint's maximum packet size.
+            ///
+            /// The additional transactions of high-bandwidth endpoints, which share the
+            /// `wMaxPacketSize` field of the descriptor, are not included.
+            pub fn max_packet_size(&self) -> u16 {
+                self.inner.info.max_packet_size
+            }
+
+            /// Returns the maximum number of bytes the endpoint can move in one service
+            /// interval.
+            ///
+            /// See
+            /// [`EndpointDescriptor::max_iso_packet_size`](struct.EndpointDescriptor.html#method.max_iso_packet_size).
+            pub fn max_interval_size(&self) -> usize {
+                self.inner.info.max_interval_size
+            }
+
+            /// Returns the endpoint's polling interval.
+            pub fn interval(&self) -> u8 {
+                self.inner.info.interval
+            }
+
+            /// Returns the timeout used by transfers that do not give one. Zero means no timeout.
+            pub fn timeout(&self) -> Duration {
+                self.inner.timeout
+            }
+
+            /// Sets the timeout used by transfers that do not give one. Zero means no timeout.
+            pub fn set_timeout(&mut self, timeout: Duration) {
+                self.inner.set_timeout(timeout);
+            }
+
+            /// Returns this endpoint with its default timeout set to `timeout`.
+            pub fn with_timeout(mut self, timeout: Duration) -> Self {
+                self.inner.set_timeout(timeout);
+                self
+            }
+
+            /// Rounds `len` up to a multiple of the maximum packet size.
+            ///
+            /// Transfers of such a length never split a packet, so reads into buffers of this
+            /// size cannot overflow.
+            pub fn aligned_len(&self, len: usize) -> usize {
+                align_len(len, self.inner.info.max_packet_size)
+            }
+
+            /// Returns the transfer statistics of this endpoint, if statistics are enabled on the
+            /// handle and the endpoint has been used.
+            pub fn stats(&self) -> Option<&'h EndpointStats> {
+                self.inner
+                    .handle
+                    .stats()
+                    .and_then(|stats| stats.endpoint(self.inner.address))
+            }
+
+            /// Clears a halt condition on this endpoint.
+            pub fn clear_halt(&self) -> crate::Result<()> {
+                self.inner.handle.clear_halt(self.inner.address)
+            }
+        }
+
+        impl<'h, T: UsbContext> fmt::Debug for $name<'h, T> {
+            fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+                f.debug_struct(stringify!($name))
+                    .field("address", &self.inner.address)
+                    .field("max_packet_size", &self.inner.info.max_packet_size)
+                    .field("timeout", &self.inner.timeout)
+                    .finish()
+            }
+        }
+    };
+}
+
+macro_rules! typed_in_endpoint {
+    ($(#[$attr:meta])* $name:ident) => {
+        typed_endpoint!($(#[$attr])* $name);
+
+        impl<'h, T: UsbContext> $name<'h, T> {
+            /// Reads from the endpoint into `buf` with the default timeout.
+            ///
+            /// The direction and transfer type were checked when the endpoint was opened, so
+            /// this goes straight to `libusb`. The errors are those of the corresponding
+            /// `DeviceHandle` method.
+            pub fn read(&self, buf: &mut [u8]) -> crate::Result<usize> {
+                self.inner.read(buf, self.inner.timeout_ms)
+            }
+
+            /// Reads from the endpoint into `buf`, waiting up to `timeout`.
+            pub fn read_timeout(&self, buf: &mut [u8], timeout: Duration) -> crate::Result<usize> {
+                self.inner.read(buf, millis_from_duration(timeout))
+            }
+
+            /// Reads from the endpoint into `buf`, giving up at `deadline`.
+            ///
+            /// Returns `Timeout` without starting a transfer if `deadline` has already passed.
+            pub fn read_until(&self, buf: &mut [u8], deadline: Instant) -> crate::Result<usize> {
+                let timeout = context::remaining(deadline)?;
+                self.inner.read(buf, millis_from_duration(timeout))
+            }
+        }
+    };
+}
+
+macro_rules! typed_out_endpoint {
+    ($(#[$attr:meta])* $name:ident) => {
+        typed_endpoint!($(#[$attr])* $name);
+
+        impl<'h, T: UsbContext> $name<'h, T> {
+            /// Writes `buf` to the endpoint with the default timeout.
+            ///
+            /// The direction and transfer type were checked when the endpoint was opened, so
+            /// this goes straight to `libusb`. The errors are those of the corresponding
+            /// `DeviceHandle` method.
+            pub fn write(&self, buf: &[u8]) -> crate::Result<usize> {
+                self.inner.write(buf, self.inner.timeout_ms)
+            }
+
+            /// Writes `buf` to the endpoint, waiting up to `timeout`.
+            pub fn write_timeout(&self, buf: &[u8], timeout: Duration) -> crate::Result<usize> {
+                self.inner.write(buf, millis_from_duration(timeout))
+            }
+
+            /// Writes `buf` to the endpoint, giving up at `deadline`.
+            ///
+            /// Returns `Timeout` without starting a transfer if `deadline` has already passed.
+            pub fn write_until(&self, buf: &[u8], deadline: Instant) -> crate::Result<usize> {
+                let timeout = context::remaining(deadline)?;
+                self.inner.write(buf, millis_from_duration(timeout))
+            }
+        }
+    };
+}
+
+typed_in_endpoint!(
+    /// A bulk IN endpoint, returned by
+    /// [`DeviceHandle::bulk_in`](struct.DeviceHandle.html#method.bulk_in).
+    BulkIn
+);
+typed_out_endpoint!(
+    /// A bulk OUT endpoint, returned by
+    /// [`DeviceHandle::bulk_out`](struct.DeviceHandle.html#method.bulk_out).
+    BulkOut
+);
+typed_in_endpoint!(
+    /// An interrupt IN endpoint, returned by
+    /// [`DeviceHandle::interrupt_in`](struct.DeviceHandle.html#method.interrupt_in).
+    InterruptIn
+);
+typed_out_endpoint!(
+    /// An interrupt OUT endpoint, returned by
+    /// [`DeviceHandle::interrupt_out`](struct.DeviceHandle.html#method.interrupt_out).
+    InterruptOut
+);
+
+macro_rules! open_endpoint {
+    ($name:ident, $direction:expr, $transfer_type:expr) => {
+        impl<'h, T: UsbContext> $name<'h, T> {
+            pub(crate) fn open(handle: &'h DeviceHandle<T>, address: u8) -> crate::Result<Self> {
+                Ok($name {
+                    inner: Endpoint::open(handle, address, $direction, $transfer_type)?,
+                })
+            }
+        }
+    };
+}
+
+open_endpoint!(BulkIn, Direction::In, TransferType::Bulk);
+open_endpoint!(BulkOut, Direction::Out, TransferType::Bulk);
+open_endpoint!(InterruptIn, Direction::In, TransferType::Interrupt);
+open_endpoint!(InterruptOut, Direction::Out, TransferType::Interrupt);
+
+#[cfg(test)]
+mod test {
+    use std::mem;
+
+    use super::{align_len, find_endpoint, EndpointInfo};
+    use crate::{config_descriptor, fields::TransferType};
+
+    #[test]
+    fn it_finds_endpoints_in_the_active_configuration() {
+        let config = config_descriptor!(interface!(
+            interface_descriptor!(
+                endpoint_descriptor!(bEndpointAddress: 0x81, bmAttributes: 0x02, wMaxPacketSize: 512, bInterval: 0)
+            ),
+            merge!(interface_descriptor!(
+                endpoint_descriptor!(bEndpointAddress: 0x81, bmAttributes: 0x03, wMaxPacketSize: 64, bInterval: 4),
+                endpoint_descriptor!(bEndpointAddress: 0x02, bmAttributes: 0x03, wMaxPacketSize: 64, bInterval: 4)
+            ) => bAlternateSetting: 1)
+        ));
+        let config = unsafe { config_descriptor::from_libusb(&config) };
+
+        assert_eq!(
+            Some(EndpointInfo {
+                transfer_type: TransferType::Bulk,
+                max_packet_size: 512,
+                max_interval_size: 512,
+                interval: 0
+            }),
+            find_endpoint(&config, 0x81)
+        );
+        assert_eq!(
+            Some(EndpointInfo {
+                transfer_type: TransferType::Interrupt,
+                max_packet_size: 64,
+                max_interval_size: 64,
+                interval: 4
+            }),
+            find_endpoint(&config, 0x02)
+        );
+        assert_eq!(None, find_endpoint(&config, 0x01));
+
+        mem::forget(config);
+    }
+
+    #[test]
+    fn it_separates_additional_transactions_from_the_max_packet_size() {
+        let config = config_descriptor!(interface!(interface_descriptor!(
+            endpoint_descriptor!(bEndpointAddress: 0x81, bmAttributes: 0x03, wMaxPacketSize: 0x1400, bInterval: 1)
+        )));
+        let config = unsafe { config_descriptor::from_libusb(&config) };
+
+        assert_eq!(
+            Some(EndpointInfo {
+                transfer_type: TransferType::Interrupt,
+                max_packet_size: 1024,
+                max_interval_size: 3072,
+                interval: 1
+            }),
+            find_endpoint(&config, 0x81)
+        );
+
+        mem::forget(config);
+    }
+
+    #[test]
+    fn it_aligns_lengths_to_the_max_packet_size() {
+        assert_eq!(0, align_len(0, 512));
+        assert_eq!(512, align_len(1, 512));
+        assert_eq!(512, align_len(512, 512));
+        assert_eq!(1024, align_len(513, 512));
+        assert_eq!(13, align_len(13, 0));
+    }
+}
@@ -1,4 +1,4 @@
-use std::{fmt, slice};
+use std::{cmp, fmt, slice};
 
 use libusb1_sys::{constants::*, libusb_endpoint_descriptor};
 
@@ -72,6 +72,82 @@ impl<'a> EndpointDescriptor<'a> {
         self.descriptor.bInterval
     }
 
+    /// Returns the maximum number of bytes the endpoint can move in one service interval.
+    ///
+    /// For high-bandwidth high speed endpoints this includes the additional transactions encoded
+    /// in `wMaxPacketSize`. For SuperSpeed isochronous endpoints it includes the burst size and
+    /// multiplier of the endpoint companion descriptor found in the 'extra' bytes. This is the
+    /// largest packet size usable for isochronous transfers on the endpoint.
+    pub fn max_iso_packet_size(&self) -> usize {
+        let packet_size = usize::from(self.descriptor.wMaxPacketSize & 0x07ff);
+
+        match ss_companion(self.extra_bytes()) {
+            Some(companion) => {
+                let burst = usize::from(companion[2]) + 1;
+                let mult = match self.transfer_type() {
+                    TransferType::Isochronous => usize::from(companion[3] & 0x03) + 1,
+                    _ => 1,
+                };
+                packet_size * burst * mult
+            }
+            None => {
+                let transactions = usize::from((self.descriptor.wMaxPacketSize >> 11) & 0x03) + 1;
+                packet_size * transactions
+            }
+        }
+    }
+
+    /// Returns the SuperSpeed endpoint companion descriptor, found in the 'extra' bytes of
+    /// endpoints of SuperSpeed devices.
+    pub fn ss_companion(&self) -> Option<SsEndpointCompanionDescriptor> {
+        ss_companion(self.extra_bytes()).map(|companion| SsEndpointCompanionDescriptor {
+            max_burst: companion[2],
+            attributes: companion[3],
+            bytes_per_interval: u16::from(companion[4]) | u16::from(companion[5]) << 8,
+        })
+    }
+
+    /// Suggests a transfer size and queue depth for keeping the endpoint busy.
+    ///
+    /// Transfers are made a multiple of the bytes the endpoint moves per service interval, and
+    /// enough of them are suggested to queue that the host controller does not run dry while
+    /// completions are handled. Faster endpoints get larger and more transfers. The result is a
+    /// starting point for tuning rather than an optimum for any particular device.
+    pub fn recommended_sizing(&self) -> TransferSizing {
+        let unit = self.max_iso_packet_size().max(1);
+
+        match self.transfer_type() {
+            TransferType::Isochronous => {
+                // 8 packets cover one millisecond on high speed and SuperSpeed endpoints.
+                let iso_packets = 8;
+                TransferSizing {
+                    transfer_size: unit * iso_packets,
+                    queue_depth: if unit > 1024 { 8 } else { 4 },
+                    iso_packets,
+                }
+            }
+            TransferType::Interrupt => TransferSizing {
+                transfer_size: unit,
+                queue_depth: 2,
+                iso_packets: 0,
+            },
+            TransferType::Bulk | TransferType::Control => {
+                let transfer_size = cmp::max(unit, MAX_BULK_TRANSFER_SIZE / unit * unit)
+                    .min(unit * BULK_UNITS_PER_TRANSFER);
+                let queue_depth = match unit {
+                    n if n > 512 => 8,
+                    512 => 4,
+                    _ => 2,
+                };
+                TransferSizing {
+                    transfer_size,
+                    queue_depth,
+                    iso_packets: 0,
+                }
+            }
+        }
+    }
+
     /// Returns the unknown 'extra' bytes that libusb does not understand.
     pub fn extra(&'a self) -> Option<&'a [u8]> {
         unsafe {
@@ -85,6 +161,13 @@ impl<'a> EndpointDescriptor<'a> {
         }
     }
 
+    fn extra_bytes(&self) -> &[u8] {
+        match self.descriptor.extra_length {
+            len if len > 0 => unsafe { slice::from_raw_parts(self.descriptor.extra, len as usize) },
+            _ => &[],
+        }
+    }
+
     /// For audio devices only: return the rate at which synchronization feedback is provided.
     pub fn refresh(&self) -> u8 {
         self.descriptor.bRefresh
@@ -111,6 +194,93 @@ impl<'a> fmt::Debug for EndpointDescriptor<'a> {
     }
 }
 
+/// Largest bulk transfer suggested by `recommended_sizing`.
+const MAX_BULK_TRANSFER_SIZE: usize = 256 * 1024;
+
+/// Number of service intervals worth of data in a suggested bulk transfer.
+const BULK_UNITS_PER_TRANSFER: usize = 32;
+
+/// Describes the SuperSpeed capabilities of an endpoint.
+#[derive(Debug, Copy, Clone, Eq, PartialEq)]
+pub struct SsEndpointCompanionDescriptor {
+    max_burst: u8,
+    attributes: u8,
+    bytes_per_interval: u16,
+}
+
+impl SsEndpointCompanionDescriptor {
+    /// Returns the number of packets the endpoint can send or receive in one burst.
+    pub fn max_burst(&self) -> u8 {
+        self.max_burst + 1
+    }
+
+    /// Returns the number of bulk streams the endpoint supports, or zero if it does not support
+    /// streams.
+    ///
+    /// The return value of this method is only valid for bulk endpoints.
+    pub fn max_streams(&self) -> u32 {
+        match self.attributes & 0x1f {
+            0 => 0,
+            n => 1 << n,
+        }
+    }
+
+    /// Returns the number of bursts per service interval.
+    ///
+    /// The return value of this method is only valid for isochronous endpoints.
+    pub fn mult(&self) -> u8 {
+        (self.attributes & 0x03) + 1
+    }
+
+    /// Returns the number of bytes the endpoint moves per service interval.
+    ///
+    /// The return value of this method is only valid for periodic endpoints.
+    pub fn bytes_per_interval(&self) -> u16 {
+        self.bytes_per_interval
+    }
+}
+
+/// Transfer parameters suggested by
+/// [`EndpointDescriptor::recommended_sizing`](struct.EndpointDescriptor.html#method.recommended_sizing).
+#[derive(Debug, Copy, Clone, Eq, PartialEq)]
+pub struct TransferSizing {
+    transfer_size: usize,
+    queue_depth: usize,
+    iso_packets: usize,
+}
+
+impl TransferSizing {
+    /// Returns the size of each transfer in bytes.
+    pub fn transfer_size(&self) -> usize {
+        self.transfer_size
+    }
+
+    /// Returns the number of transfers to keep submitted.
+    pub fn queue_depth(&self) -> usize {
+        self.queue_depth
+    }
+
+    /// Returns the number of packets per transfer for isochronous endpoints, or zero.
+    pub fn iso_packets(&self) -> usize {
+        self.iso_packets
+    }
+}
+
+/// Finds the SuperSpeed endpoint companion descriptor in an endpoint's extra bytes.
+fn ss_companion(mut extra: &[u8]) -> Option<&[u8]> {
+    while extra.len() >= 2 {
+        let len = usize::from(extra[0]);
+        if len < 2 || len > extra.len() {
+            return None;
+        }
+        if extra[1] == LIBUSB_DT_SS_ENDPOINT_COMPANION && len >= 6 {
+            return Some(&extra[..len]);
+        }
+        extra = &extra[len..];
+    }
+    None
+}
+
 #[doc(hidden)]
 pub(crate) fn from_libusb(endpoint: &libusb_endpoint_descriptor) -> EndpointDescriptor {
     EndpointDescriptor {
@@ -258,6 +428,124 @@ mod test {
         );
     }
 
+    #[test]
+    fn it_has_max_iso_packet_size() {
+        assert_eq!(
+            1024,
+            super::from_libusb(
+                &endpoint_descriptor!(bmAttributes: 0b0000_0001, wMaxPacketSize: 1024)
+            )
+            .max_iso_packet_size()
+        );
+    }
+
+    #[test]
+    fn it_includes_additional_transactions_in_max_iso_packet_size() {
+        assert_eq!(
+            3072,
+            super::from_libusb(
+                &endpoint_descriptor!(bmAttributes: 0b0000_0001, wMaxPacketSize: 0x1400)
+            )
+            .max_iso_packet_size()
+        );
+    }
+
+    #[test]
+    fn it_includes_ss_companion_in_max_iso_packet_size() {
+        // a class-specific descriptor followed by a companion with bMaxBurst 3 and Mult 1
+        let extra = [3u8, 0x24, 0, 6, 0x30, 3, 1, 0x00, 0x20];
+
+        assert_eq!(
+            8192,
+            super::from_libusb(&endpoint_descriptor!(
+                bmAttributes: 0b0000_0001,
+                wMaxPacketSize: 1024,
+                extra: extra.as_ptr(),
+                extra_length: extra.len() as i32
+            ))
+            .max_iso_packet_size()
+        );
+
+        // Mult is only defined for isochronous endpoints
+        assert_eq!(
+            4096,
+            super::from_libusb(&endpoint_descriptor!(
+                bmAttributes: 0b0000_0011,
+                wMaxPacketSize: 1024,
+                extra: extra.as_ptr(),
+                extra_length: extra.len() as i32
+            ))
+            .max_iso_packet_size()
+        );
+    }
+
+    #[test]
+    fn it_parses_ss_companion() {
+        // bMaxBurst 15, 16 streams
+        let extra = [6u8, 0x30, 15, 4, 0, 0];
+        let companion = super::from_libusb(&endpoint_descriptor!(
+            bmAttributes: 0b0000_0010,
+            wMaxPacketSize: 1024,
+            extra: extra.as_ptr(),
+            extra_length: extra.len() as i32
+        ))
+        .ss_companion()
+        .unwrap();
+
+        assert_eq!(16, companion.max_burst());
+        assert_eq!(16, companion.max_streams());
+        assert_eq!(0, companion.bytes_per_interval());
+
+        assert!(
+            super::from_libusb(&endpoint_descriptor!(wMaxPacketSize: 512))
+                .ss_companion()
+                .is_none()
+        );
+    }
+
+    #[test]
+    fn it_recommends_larger_transfers_for_faster_bulk_endpoints() {
+        let full_speed = super::from_libusb(&endpoint_descriptor!(
+            bmAttributes: 0b0000_0010,
+            wMaxPacketSize: 64
+        ))
+        .recommended_sizing();
+        assert_eq!(2048, full_speed.transfer_size());
+        assert_eq!(2, full_speed.queue_depth());
+
+        let high_speed = super::from_libusb(&endpoint_descriptor!(
+            bmAttributes: 0b0000_0010,
+            wMaxPacketSize: 512
+        ))
+        .recommended_sizing();
+        assert_eq!(16384, high_speed.transfer_size());
+        assert_eq!(4, high_speed.queue_depth());
+
+        let extra = [6u8, 0x30, 15, 0, 0, 0];
+        let super_speed = super::from_libusb(&endpoint_descriptor!(
+            bmAttributes: 0b0000_0010,
+            wMaxPacketSize: 1024,
+            extra: extra.as_ptr(),
+            extra_length: extra.len() as i32
+        ))
+        .recommended_sizing();
+        assert_eq!(262144, super_speed.transfer_size());
+        assert_eq!(8, super_speed.queue_depth());
+        assert_eq!(0, super_speed.iso_packets());
+    }
+
+    #[test]
+    fn it_recommends_iso_packets_for_isochronous_endpoints() {
+        let sizing = super::from_libusb(&endpoint_descriptor!(
+            bmAttributes: 0b0000_0001,
+            wMaxPacketSize: 0x1400
+        ))
+        .recommended_sizing();
+
+        assert_eq!(8, sizing.iso_packets());
+        assert_eq!(8 * 3072, sizing.transfer_size());
+    }
+
     #[test]
     fn it_has_interval() {
         assert_eq!(
@@ -1,4 +1,4 @@
-use std::{fmt, result};
+use std::{fmt, io, result};
 
 use libusb1_sys::constants::*;
 
@@ -74,6 +74,25 @@ impl fmt::Display for Error {
 
 impl std::error::Error for Error {}
 
+impl From<Error> for io::Error {
+    fn from(err: Error) -> io::Error {
+        let kind = match err {
+            Error::InvalidParam => io::ErrorKind::InvalidInput,
+            Error::Access => io::ErrorKind::PermissionDenied,
+            Error::NoDevice => io::ErrorKind::NotConnected,
+            Error::NotFound => io::ErrorKind::NotFound,
+            Error::Timeout => io::ErrorKind::TimedOut,
+            Error::Overflow | Error::BadDescriptor => io::ErrorKind::InvalidData,
+            Error::Pipe => io::ErrorKind::BrokenPipe,
+            Error::Interrupted => io::ErrorKind::Interrupted,
+            Error::Io | Error::Busy | Error::NoMem | Error::NotSupported | Error::Other => {
+                io::ErrorKind::Other
+            }
+        };
+        io::Error::new(kind, err)
+    }
+}
+
 #[doc(hidden)]
 pub(crate) fn from_libusb(err: i32) -> Error {
     match err {
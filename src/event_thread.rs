@@ -0,0 +1,102 @@
+use std::{
+    fmt::{self, Debug},
+    sync::{
+        atomic::{AtomicI32, Ordering},
+        Arc,
+    },
+    thread::{self, JoinHandle},
+};
+
+use libc::c_int;
+use libusb1_sys::*;
+
+use crate::{error::Error, UsbContext};
+
+/// A background thread that handles all events of a context.
+///
+/// The thread handles events in a loop, taking libusb's event lock for each pass and releasing
+/// it in between. Threads waiting on their own transfers, through
+/// [`Transfer::wait`](struct.Transfer.html#method.wait) or the streams built on it, sleep until
+/// they are woken by a completion while the thread is handling events, which keeps the cost of
+/// many devices on one context flat. A waiter that finds the lock free between two passes
+/// handles events itself, so transfer and hotplug callbacks usually, but not always, run on
+/// this thread.
+///
+/// The thread is stopped, and joined, when the `EventThread` is dropped.
+pub struct EventThread<T: UsbContext> {
+    context: T,
+    stop: Arc<AtomicI32>,
+    thread: Option<JoinHandle<()>>,
+}
+
+impl<T: UsbContext + 'static> EventThread<T> {
+    /// Spawns a thread handling events for `context`.
+    ///
+    /// Only one event thread should be run per context.
+    pub fn spawn(context: T) -> crate::Result<Self> {
+        let stop = Arc::new(AtomicI32::new(0));
+
+        let thread = {
+            let context = context.clone();
+            let stop = stop.clone();
+            thread::Builder::new()
+                .name("rusb-events".into())
+                .spawn(move || run(&context, &stop))
+                .map_err(|_| Error::Other)?
+        };
+
+        Ok(EventThread {
+            context,
+            stop,
+            thread: Some(thread),
+        })
+    }
+}
+
+impl<T: UsbContext> EventThread<T> {
+    /// Returns the context whose events are handled.
+    pub fn context(&self) -> &T {
+        &self.context
+    }
+
+    /// Stops the thread and waits for it to exit.
+    ///
+    /// Callbacks that are currently running finish first. This is also done on drop.
+    pub fn stop(mut self) {
+        self.join();
+    }
+
+    fn join(&mut self) {
+        if let Some(thread) = self.thread.take() {
+            self.stop.store(1, Ordering::Release);
+            unsafe { libusb_interrupt_event_handler(self.context.as_raw()) };
+            let _ = thread.join();
+        }
+    }
+}
+
+impl<T: UsbContext> Drop for EventThread<T> {
+    fn drop(&mut self) {
+        self.join();
+    }
+}
+
+impl<T: UsbContext> Debug for EventThread<T> {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.debug_struct("EventThread")
+            .field("context", &self.context.as_raw())
+            .field("running", &self.thread.is_some())
+            .finish()
+    }
+}
+
+fn run<T: UsbContext>(context: &T, stop: &AtomicI32) {
+    let stop_ptr = stop as *const AtomicI32 as *mut c_int;
+
+    // `libusb_interrupt_event_handler` makes this return once `stop` has been set.
+    while stop.load(Ordering::Acquire) == 0 {
+        unsafe {
+            libusb_handle_events_completed(context.as_raw(), stop_ptr);
+        }
+    }
+}
@@ -0,0 +1,479 @@
+use std::{
+    cell::UnsafeCell,
+    fmt::{self, Debug},
+    future::Future,
+    mem::MaybeUninit,
+    pin::Pin,
+    sync::{
+        atomic::{self, AtomicBool, AtomicUsize, Ordering},
+        Arc, Mutex,
+    },
+    task::{Context, Poll, Waker},
+};
+
+use libc::c_int;
+use libusb1_sys::constants::*;
+
+use crate::{
+    context::{self, Hotplug, Registration, UsbContext},
+    device::Device,
+    error::Error,
+};
+
+/// A hotplug notification.
+#[derive(Debug)]
+pub enum HotplugEvent<T: UsbContext> {
+    /// The device was connected, or was already connected when enumerating at registration.
+    Arrived(Device<T>),
+
+    /// The device was disconnected.
+    Left(Device<T>),
+}
+
+impl<T: UsbContext> HotplugEvent<T> {
+    /// Returns the device the event is about.
+    pub fn device(&self) -> &Device<T> {
+        match *self {
+            HotplugEvent::Arrived(ref device) | HotplugEvent::Left(ref device) => device,
+        }
+    }
+}
+
+/// Options for registering a hotplug callback.
+///
+/// By default, arrivals and departures of all devices are reported, starting from the
+/// registration.
+#[derive(Debug, Copy, Clone)]
+pub struct HotplugBuilder {
+    vendor_id: Option<u16>,
+    product_id: Option<u16>,
+    class: Option<u8>,
+    enumerate: bool,
+    arrived: bool,
+    left: bool,
+}
+
+impl HotplugBuilder {
+    /// Returns the default options.
+    pub fn new() -> Self {
+        HotplugBuilder {
+            vendor_id: None,
+            product_id: None,
+            class: None,
+            enumerate: false,
+            arrived: true,
+            left: true,
+        }
+    }
+
+    /// Only reports devices with vendor ID `vendor_id`.
+    pub fn vendor_id(&mut self, vendor_id: u16) -> &mut Self {
+        self.vendor_id = Some(vendor_id);
+        self
+    }
+
+    /// Only reports devices with product ID `product_id`.
+    pub fn product_id(&mut self, product_id: u16) -> &mut Self {
+        self.product_id = Some(product_id);
+        self
+    }
+
+    /// Only reports devices of device class `class`.
+    pub fn class(&mut self, class: u8) -> &mut Self {
+        self.class = Some(class);
+        self
+    }
+
+    /// Also reports the matching devices that are already connected as arrived, from within the
+    /// registration (`LIBUSB_HOTPLUG_ENUMERATE`).
+    pub fn enumerate(&mut self, enumerate: bool) -> &mut Self {
+        self.enumerate = enumerate;
+        self
+    }
+
+    /// Sets whether devices being connected are reported.
+    pub fn device_arrived(&mut self, arrived: bool) -> &mut Self {
+        self.arrived = arrived;
+        self
+    }
+
+    /// Sets whether devices being disconnected are reported.
+    pub fn device_left(&mut self, left: bool) -> &mut Self {
+        self.left = left;
+        self
+    }
+
+    /// Registers `callback` on `context`.
+    ///
+    /// The callback is run by the thread handling events on the context, so transfer
+    /// completions on the context are delayed while it runs. To keep that thread free of
+    /// potentially slow work such as opening devices, see
+    /// [`register_queue`](#method.register_queue).
+    ///
+    /// ## Errors
+    ///
+    /// * `InvalidParam` if neither arrivals nor departures are to be reported.
+    /// * `NotSupported` if the platform does not support hotplug.
+    pub fn register<T: UsbContext>(
+        &self,
+        context: &T,
+        callback: Box<dyn Hotplug<T>>,
+    ) -> crate::Result<Registration<T>> {
+        let mut events: c_int = 0;
+        if self.arrived {
+            events |= LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED;
+        }
+        if self.left {
+            events |= LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT;
+        }
+        if events == 0 {
+            return Err(Error::InvalidParam);
+        }
+
+        let flags = if self.enumerate {
+            LIBUSB_HOTPLUG_ENUMERATE
+        } else {
+            LIBUSB_HOTPLUG_NO_FLAGS
+        };
+
+        context::register_hotplug(
+            context,
+            events,
+            flags,
+            self.vendor_id,
+            self.product_id,
+            self.class,
+            callback,
+        )
+    }
+
+    /// Registers a callback on `context` that only queues the events, for a
+    /// [`HotplugReceiver`] to take them from.
+    ///
+    /// Queueing does not block or allocate, and only takes a lock to wake a task waiting in
+    /// [`HotplugReceiver::recv`](struct.HotplugReceiver.html#method.recv), so the thread
+    /// handling events returns to transfer completions immediately. Up to `capacity` events are held; events arriving while the
+    /// queue is full are dropped and counted, see
+    /// [`HotplugReceiver::take_dropped`](struct.HotplugReceiver.html#method.take_dropped). When
+    /// enumerating, `capacity` should leave room for all devices already connected.
+    ///
+    /// ## Errors
+    ///
+    /// The same as for [`register`](#method.register).
+    pub fn register_queue<T: UsbContext + 'static>(
+        &self,
+        context: &T,
+        capacity: usize,
+    ) -> crate::Result<(Registration<T>, HotplugReceiver<T>)> {
+        let queue = Arc::new(Shared {
+            queue: EventQueue::new(capacity),
+            dropped: AtomicUsize::new(0),
+            waiting: AtomicBool::new(false),
+            waker: Mutex::new(None),
+        });
+        let registration = self.register(context, Box::new(Sender(queue.clone())))?;
+        Ok((registration, HotplugReceiver { shared: queue }))
+    }
+}
+
+impl Default for HotplugBuilder {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+struct Shared<T: UsbContext> {
+    queue: EventQueue<HotplugEvent<T>>,
+    dropped: AtomicUsize,
+    // Set with `waker`, so that senders only take the lock when there is a task to wake.
+    waiting: AtomicBool,
+    waker: Mutex<Option<Waker>>,
+}
+
+struct Sender<T: UsbContext>(Arc<Shared<T>>);
+
+impl<T: UsbContext> Sender<T> {
+    fn send(&self, event: HotplugEvent<T>) {
+        if self.0.queue.push(event).is_err() {
+            self.0.dropped.fetch_add(1, Ordering::Relaxed);
+        }
+
+        // Pairs with the fence in `HotplugRecv::poll`: either the task sees the event, or this
+        // sees the task waiting.
+        atomic::fence(Ordering::SeqCst);
+        if self.0.waiting.load(Ordering::Relaxed) {
+            let waker = {
+                let mut waker = self.0.waker.lock().unwrap();
+                self.0.waiting.store(false, Ordering::Relaxed);
+                waker.take()
+            };
+            if let Some(waker) = waker {
+                waker.wake();
+            }
+        }
+    }
+}
+
+impl<T: UsbContext> Hotplug<T> for Sender<T> {
+    fn device_arrived(&mut self, device: Device<T>) {
+        self.send(HotplugEvent::Arrived(device));
+    }
+
+    fn device_left(&mut self, device: Device<T>) {
+        self.send(HotplugEvent::Left(device));
+    }
+}
+
+/// The receiving end of a hotplug callback registered with
+/// [`HotplugBuilder::register_queue`](struct.HotplugBuilder.html#method.register_queue).
+///
+/// Events are only queued while events on the context are handled, for instance by an
+/// [`EventThread`](struct.EventThread.html).
+pub struct HotplugReceiver<T: UsbContext> {
+    shared: Arc<Shared<T>>,
+}
+
+impl<T: UsbContext> HotplugReceiver<T> {
+    /// Takes the oldest queued event, if any.
+    pub fn try_recv(&self) -> Option<HotplugEvent<T>> {
+        self.shared.queue.pop()
+    }
+
+    /// Returns an iterator that takes all queued events.
+    pub fn drain(&self) -> impl Iterator<Item = HotplugEvent<T>> + '_ {
+        std::iter::from_fn(move || self.try_recv())
+    }
+
+    /// Returns a future that resolves to the next event.
+    ///
+    /// Only one task can wait for events at a time, which the mutable borrow enforces.
+    pub fn recv(&mut self) -> HotplugRecv<'_, T> {
+        HotplugRecv { receiver: self }
+    }
+
+    /// Returns how many events were dropped because the queue was full, and resets the count.
+    ///
+    /// After events have been dropped, the set of connected devices should be listed again.
+    pub fn take_dropped(&self) -> usize {
+        self.shared.dropped.swap(0, Ordering::Relaxed)
+    }
+
+    /// Returns the number of events the queue can hold.
+    pub fn capacity(&self) -> usize {
+        self.shared.queue.capacity()
+    }
+}
+
+impl<T: UsbContext> Debug for HotplugReceiver<T> {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.debug_struct("HotplugReceiver")
+            .field("capacity", &self.capacity())
+            .finish()
+    }
+}
+
+/// Future returned by [`HotplugReceiver::recv`](struct.HotplugReceiver.html#method.recv).
+#[derive(Debug)]
+pub struct HotplugRecv<'r, T: UsbContext> {
+    receiver: &'r HotplugReceiver<T>,
+}
+
+impl<'r, T: UsbContext> Future for HotplugRecv<'r, T> {
+    type Output = HotplugEvent<T>;
+
+    fn poll(self: Pin<&mut Self>, cx: &mut Context<'_>) -> Poll<HotplugEvent<T>> {
+        if let Some(event) = self.receiver.try_recv() {
+            return Poll::Ready(event);
+        }
+
+        {
+            let mut waker = self.receiver.shared.waker.lock().unwrap();
+            *waker = Some(cx.waker().clone());
+            self.receiver.shared.waiting.store(true, Ordering::Relaxed);
+        }
+
+        // An event queued before the waker was stored would not wake this task.
+        atomic::fence(Ordering::SeqCst);
+        match self.receiver.try_recv() {
+            Some(event) => Poll::Ready(event),
+            None => Poll::Pending,
+        }
+    }
+}
+
+struct Slot<T> {
+    sequence: AtomicUsize,
+    value: UnsafeCell<MaybeUninit<T>>,
+}
+
+/// A bounded lock-free multi-producer multi-consumer queue.
+///
+/// Each slot carries a sequence number telling whether it is ready to be written or read for a
+/// given position, so producers and consumers only contend on their own position counter.
+struct EventQueue<T> {
+    slots: Box<[Slot<T>]>,
+    mask: usize,
+    head: AtomicUsize,
+    tail: AtomicUsize,
+}
+
+unsafe impl<T: Send> Send for EventQueue<T> {}
+unsafe impl<T: Send> Sync for EventQueue<T> {}
+
+impl<T> EventQueue<T> {
+    fn new(capacity: usize) -> Self {
+        // The sequence scheme needs at least two slots.
+        let capacity = capacity.max(2).next_power_of_two();
+
+        EventQueue {
+            slots: (0..capacity)
+                .map(|i| Slot {
+                    sequence: AtomicUsize::new(i),
+                    value: UnsafeCell::new(MaybeUninit::uninit()),
+                })
+                .collect(),
+            mask: capacity - 1,
+            head: AtomicUsize::new(0),
+            tail: AtomicUsize::new(0),
+        }
+    }
+
+    fn capacity(&self) -> usize {
+        self.slots.len()
+    }
+
+    fn push(&self, value: T) -> Result<(), T> {
+        let mut pos = self.tail.load(Ordering::Relaxed);
+        loop {
+            let slot = &self.slots[pos & self.mask];
+            let diff = slot.sequence.load(Ordering::Acquire).wrapping_sub(pos) as isize;
+
+            if diff == 0 {
+                match self.tail.compare_exchange_weak(
+                    pos,
+                    pos.wrapping_add(1),
+                    Ordering::Relaxed,
+                    Ordering::Relaxed,
+                ) {
+                    Ok(_) => {
+                        unsafe { (*slot.value.get()).as_mut_ptr().write(value) };
+                        slot.sequence.store(pos.wrapping_add(1), Ordering::Release);
+                        return Ok(());
+                    }
+                    Err(current) => pos = current,
+                }
+            } else if diff < 0 {
+                return Err(value);
+            } else {
+                pos = self.tail.load(Ordering::Relaxed);
+            }
+        }
+    }
+
+    fn pop(&self) -> Option<T> {
+        let mut pos = self.head.load(Ordering::Relaxed);
+        loop {
+            let slot = &self.slots[pos & self.mask];
+            let diff = slot
+                .sequence
+                .load(Ordering::Acquire)
+                .wrapping_sub(pos.wrapping_add(1)) as isize;
+
+            if diff == 0 {
+                match self.head.compare_exchange_weak(
+                    pos,
+                    pos.wrapping_add(1),
+                    Ordering::Relaxed,
+                    Ordering::Relaxed,
+                ) {
+                    Ok(_) => {
+                        let value = unsafe { (*slot.value.get()).as_ptr().read() };
+                        slot.sequence
+                            .store(pos.wrapping_add(self.mask + 1), Ordering::Release);
+                        return Some(value);
+                    }
+                    Err(current) => pos = current,
+                }
+            } else if diff < 0 {
+                return None;
+            } else {
+                pos = self.head.load(Ordering::Relaxed);
+            }
+        }
+    }
+}
+
+impl<T> Drop for EventQueue<T> {
+    fn drop(&mut self) {
+        while self.pop().is_some() {}
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use std::{sync::Arc, thread};
+
+    use super::EventQueue;
+
+    #[test]
+    fn it_queues_in_order_up_to_capacity() {
+        let queue = EventQueue::new(3);
+        assert_eq!(4, queue.capacity());
+
+        for i in 0..4 {
+            assert_eq!(Ok(()), queue.push(i));
+        }
+        assert_eq!(Err(4), queue.push(4));
+
+        assert_eq!(Some(0), queue.pop());
+        assert_eq!(Ok(()), queue.push(4));
+        assert_eq!(
+            vec![1, 2, 3, 4],
+            std::iter::from_fn(|| queue.pop()).collect::<Vec<_>>()
+        );
+        assert_eq!(None, queue.pop());
+    }
+
+    #[test]
+    fn it_drops_queued_values() {
+        let value = Arc::new(());
+        let queue = EventQueue::new(2);
+        queue.push(value.clone()).unwrap();
+        drop(queue);
+
+        assert_eq!(1, Arc::strong_count(&value));
+    }
+
+    #[test]
+    fn it_passes_values_between_threads() {
+        let queue = Arc::new(EventQueue::new(16));
+        let producers = (0..4)
+            .map(|p| {
+                let queue = queue.clone();
+                thread::spawn(move || {
+                    for i in 0..1000 {
+                        let mut value = p * 1000 + i;
+                        while let Err(v) = queue.push(value) {
+                            value = v;
+                            thread::yield_now();
+                        }
+                    }
+                })
+            })
+            .collect::<Vec<_>>();
+
+        let mut received = Vec::new();
+        while received.len() < 4000 {
+            match queue.pop() {
+                Some(value) => received.push(value),
+                None => thread::yield_now(),
+            }
+        }
+        for producer in producers {
+            producer.join().unwrap();
+        }
+
+        received.sort();
+        assert_eq!((0..4000).collect::<Vec<_>>(), received);
+    }
+}
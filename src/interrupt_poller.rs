@@ -0,0 +1,499 @@
+use std::{
+    cell::UnsafeCell,
+    cmp,
+    fmt::{self, Debug},
+    ptr::NonNull,
+    slice,
+    sync::atomic::{AtomicBool, AtomicI32, AtomicU64, AtomicUsize, Ordering},
+    time::{Duration, Instant},
+};
+
+use libc::{c_int, c_uchar, c_void};
+use libusb1_sys::{constants::*, *};
+
+use crate::{
+    context::wait_for_completion,
+    device_handle::DeviceHandle,
+    error::{self, Error},
+    transfer::status_from_libusb,
+    UsbContext,
+};
+
+/// A report waiting in the ring.
+struct Slot {
+    data: Box<[u8]>,
+    len: usize,
+    timestamp: Instant,
+}
+
+/// Bounded ring of reports, written by the completion callback and read by the poller.
+///
+/// `libusb` runs completion callbacks on one thread at a time, so there is a single producer;
+/// the poller is the single consumer, since reading takes `&mut self`.
+struct Ring {
+    slots: Box<[UnsafeCell<Slot>]>,
+    // Number of reports ever written and read. Only the producer stores `head` and only the
+    // consumer stores `tail`.
+    head: AtomicUsize,
+    tail: AtomicUsize,
+}
+
+impl Ring {
+    fn new(capacity: usize, report_size: usize) -> Self {
+        let now = Instant::now();
+        Ring {
+            slots: (0..capacity)
+                .map(|_| {
+                    UnsafeCell::new(Slot {
+                        data: vec![0; report_size].into_boxed_slice(),
+                        len: 0,
+                        timestamp: now,
+                    })
+                })
+                .collect(),
+            head: AtomicUsize::new(0),
+            tail: AtomicUsize::new(0),
+        }
+    }
+
+    fn capacity(&self) -> usize {
+        self.slots.len()
+    }
+
+    fn len(&self) -> usize {
+        self.head
+            .load(Ordering::Acquire)
+            .wrapping_sub(self.tail.load(Ordering::Acquire))
+    }
+
+    /// Copies `data` into the next free slot, or returns `false` if the ring is full.
+    ///
+    /// # Safety
+    ///
+    /// Only one thread may push at a time.
+    unsafe fn push(&self, data: &[u8], timestamp: Instant) -> bool {
+        let head = self.head.load(Ordering::Relaxed);
+        if head.wrapping_sub(self.tail.load(Ordering::Acquire)) == self.capacity() {
+            return false;
+        }
+
+        let slot = &mut *self.slots[head % self.capacity()].get();
+        let len = cmp::min(data.len(), slot.data.len());
+        slot.data[..len].copy_from_slice(&data[..len]);
+        slot.len = len;
+        slot.timestamp = timestamp;
+        self.head.store(head.wrapping_add(1), Ordering::Release);
+        true
+    }
+
+    /// Returns the oldest report, which stays in the ring until [`pop`](#method.pop).
+    ///
+    /// # Safety
+    ///
+    /// Only one thread may read at a time.
+    unsafe fn peek(&self) -> Option<&Slot> {
+        let tail = self.tail.load(Ordering::Relaxed);
+        if tail == self.head.load(Ordering::Acquire) {
+            return None;
+        }
+        Some(&*self.slots[tail % self.capacity()].get())
+    }
+
+    /// Frees the slot of the oldest report.
+    unsafe fn pop(&self) {
+        let tail = self.tail.load(Ordering::Relaxed);
+        self.tail.store(tail.wrapping_add(1), Ordering::Release);
+    }
+}
+
+/// State shared with the completion callback through `user_data`.
+struct Shared {
+    ring: Ring,
+    stopping: AtomicBool,
+    // Transfers in flight, plus one for the poller itself. `idle` is set once this drops to zero.
+    active: AtomicUsize,
+    idle: AtomicI32,
+    // Set after every completion, so that a waiting reader wakes up.
+    ready: AtomicI32,
+    received: AtomicU64,
+    dropped: AtomicU64,
+    errors: AtomicU64,
+    // Status of the first transfer that stopped polling, or -1.
+    stopped_status: AtomicI32,
+}
+
+impl Shared {
+    fn release(&self) {
+        if self.active.fetch_sub(1, Ordering::AcqRel) == 1 {
+            self.idle.store(1, Ordering::Release);
+        }
+    }
+}
+
+/// Keeps an interrupt IN endpoint polled by resubmitting transfers as soon as they complete.
+///
+/// A fixed number of transfers stay in flight, so the host controller polls the endpoint at its
+/// `bInterval` even while the reading thread is descheduled. Each report is copied into a
+/// bounded ring together with the time it completed, and the transfer is resubmitted from the
+/// completion callback. When the ring is full, new reports are dropped and counted in
+/// [`dropped`](#method.dropped).
+///
+/// Completions are delivered while events are handled on the handle's context, either by
+/// [`recv`](#method.recv) or by another thread such as an
+/// [`EventThread`](struct.EventThread.html).
+///
+/// Polling stops for good if the endpoint stalls or the device is disconnected; this is reported
+/// by `recv` once the buffered reports have been read. Dropping the poller cancels its transfers
+/// and blocks until `libusb` has released them.
+pub struct InterruptPoller<'d, T: UsbContext> {
+    handle: &'d DeviceHandle<T>,
+    endpoint: u8,
+    report_size: usize,
+    shared: NonNull<Shared>,
+    transfers: Vec<NonNull<libusb_transfer>>,
+    // Transfer buffers, only accessed by `libusb` through the pointers handed to it.
+    buffers: Vec<u8>,
+}
+
+unsafe impl<'d, T: UsbContext> Send for InterruptPoller<'d, T> {}
+unsafe impl<'d, T: UsbContext> Sync for InterruptPoller<'d, T> {}
+
+impl<'d, T: UsbContext> Drop for InterruptPoller<'d, T> {
+    /// Cancels the transfers and waits until `libusb` has released them.
+    fn drop(&mut self) {
+        // Pairs with the loads in `poll_callback`, so that a transfer resubmitted concurrently is
+        // either cancelled below or by the callback itself.
+        self.shared().stopping.store(true, Ordering::SeqCst);
+        for transfer in self.transfers.iter() {
+            unsafe { libusb_cancel_transfer(transfer.as_ptr()) };
+        }
+
+        self.shared().release();
+        let context = self.handle.context().as_raw();
+        while wait_for_completion(context, &self.shared().idle, None).is_err() {}
+
+        unsafe {
+            for transfer in self.transfers.iter() {
+                libusb_free_transfer(transfer.as_ptr());
+            }
+            drop(Box::from_raw(self.shared.as_ptr()));
+        }
+    }
+}
+
+impl<'d, T: UsbContext> Debug for InterruptPoller<'d, T> {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.debug_struct("InterruptPoller")
+            .field("endpoint", &self.endpoint)
+            .field("transfers", &self.transfers.len())
+            .field("queued", &self.len())
+            .field("received", &self.received())
+            .field("dropped", &self.dropped())
+            .finish()
+    }
+}
+
+impl<'d, T: UsbContext> InterruptPoller<'d, T> {
+    /// Starts polling the interrupt IN endpoint `endpoint` with `transfers` transfers in flight,
+    /// buffering up to `capacity` reports.
+    ///
+    /// Each report holds up to one service interval's worth of data, as given by
+    /// [`InterruptIn::max_interval_size`](struct.InterruptIn.html#method.max_interval_size).
+    ///
+    /// ## Errors
+    ///
+    /// * `InvalidParam` if `endpoint` is not an interrupt IN endpoint, or `transfers` or
+    ///   `capacity` is zero.
+    /// * `NotFound` if the active configuration has no such endpoint.
+    /// * Any error from submitting the transfers.
+    pub fn new(
+        handle: &'d DeviceHandle<T>,
+        endpoint: u8,
+        transfers: usize,
+        capacity: usize,
+    ) -> crate::Result<Self> {
+        if transfers == 0 || capacity == 0 {
+            return Err(Error::InvalidParam);
+        }
+
+        let report_size = handle.interrupt_in(endpoint)?.max_interval_size();
+
+        let shared = Box::new(Shared {
+            ring: Ring::new(capacity, report_size),
+            stopping: AtomicBool::new(false),
+            active: AtomicUsize::new(1),
+            idle: AtomicI32::new(0),
+            ready: AtomicI32::new(0),
+            received: AtomicU64::new(0),
+            dropped: AtomicU64::new(0),
+            errors: AtomicU64::new(0),
+            stopped_status: AtomicI32::new(-1),
+        });
+
+        let mut poller = InterruptPoller {
+            handle,
+            endpoint,
+            report_size,
+            shared: unsafe { NonNull::new_unchecked(Box::into_raw(shared)) },
+            transfers: Vec::with_capacity(transfers),
+            buffers: vec![0; transfers * report_size],
+        };
+
+        for i in 0..transfers {
+            let transfer = NonNull::new(unsafe { libusb_alloc_transfer(0) }).ok_or(Error::NoMem)?;
+            poller.transfers.push(transfer);
+
+            unsafe {
+                libusb_fill_interrupt_transfer(
+                    transfer.as_ptr(),
+                    handle.as_raw(),
+                    endpoint,
+                    poller.buffers.as_mut_ptr().add(i * report_size) as *mut c_uchar,
+                    report_size as c_int,
+                    poll_callback,
+                    poller.shared.as_ptr() as *mut c_void,
+                    0,
+                );
+
+                poller.shared().active.fetch_add(1, Ordering::AcqRel);
+                match libusb_submit_transfer(transfer.as_ptr()) {
+                    0 => {}
+                    err => {
+                        poller.shared().release();
+                        return Err(error::from_libusb(err));
+                    }
+                }
+            }
+        }
+
+        Ok(poller)
+    }
+
+    /// Returns the polled endpoint's address.
+    pub fn endpoint(&self) -> u8 {
+        self.endpoint
+    }
+
+    /// Returns the maximum size of a report.
+    pub fn report_size(&self) -> usize {
+        self.report_size
+    }
+
+    /// Returns the number of reports the ring can hold.
+    pub fn capacity(&self) -> usize {
+        self.shared().ring.capacity()
+    }
+
+    /// Returns the number of reports waiting to be read.
+    pub fn len(&self) -> usize {
+        self.shared().ring.len()
+    }
+
+    /// Returns `true` if no reports are waiting to be read.
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+
+    /// Returns the number of reports put into the ring.
+    pub fn received(&self) -> u64 {
+        self.shared().received.load(Ordering::Relaxed)
+    }
+
+    /// Returns the number of reports dropped because the ring was full.
+    pub fn dropped(&self) -> u64 {
+        self.shared().dropped.load(Ordering::Relaxed)
+    }
+
+    /// Returns the number of transfers that failed without stopping the polling.
+    pub fn errors(&self) -> u64 {
+        self.shared().errors.load(Ordering::Relaxed)
+    }
+
+    /// Returns `true` while at least one transfer is still polling the endpoint.
+    pub fn is_polling(&self) -> bool {
+        self.shared().active.load(Ordering::Acquire) > 1
+    }
+
+    /// Returns the oldest buffered report without waiting.
+    pub fn try_recv(&mut self) -> Option<InterruptReport<'_>> {
+        let ring = &self.shared().ring;
+        unsafe { ring.peek() }.map(|slot| InterruptReport { ring, slot })
+    }
+
+    /// Returns the oldest buffered report, handling events on the context until one arrives.
+    ///
+    /// ## Errors
+    ///
+    /// * `Timeout` if `timeout` is given and expires first.
+    /// * `Pipe`, `NoDevice` or the error of the failed submission if polling has stopped and
+    ///   all buffered reports have been read.
+    pub fn recv(&mut self, timeout: Option<Duration>) -> crate::Result<InterruptReport<'_>> {
+        let deadline = timeout.map(|timeout| Instant::now() + timeout);
+        let context = self.handle.context().as_raw();
+
+        loop {
+            let shared = self.shared();
+            shared.ready.store(0, Ordering::Release);
+            if unsafe { shared.ring.peek() }.is_some() {
+                break;
+            }
+            if !self.is_polling() {
+                return Err(self.stopped_error());
+            }
+            wait_for_completion(context, &shared.ready, deadline)?;
+        }
+
+        Ok(self.try_recv().unwrap())
+    }
+
+    fn stopped_error(&self) -> Error {
+        match self.shared().stopped_status.load(Ordering::Acquire) {
+            -1 => Error::Other,
+            status => status_from_libusb(status)
+                .into_result(0)
+                .err()
+                .unwrap_or(Error::Other),
+        }
+    }
+
+    fn shared(&self) -> &Shared {
+        unsafe { self.shared.as_ref() }
+    }
+}
+
+/// A report read by an [`InterruptPoller`](struct.InterruptPoller.html).
+///
+/// The report borrows its slot in the ring, which is freed when it is dropped.
+pub struct InterruptReport<'p> {
+    ring: &'p Ring,
+    slot: &'p Slot,
+}
+
+impl<'p> InterruptReport<'p> {
+    /// Returns the report's data.
+    pub fn data(&self) -> &[u8] {
+        &self.slot.data[..self.slot.len]
+    }
+
+    /// Returns the time the transfer carrying the report completed.
+    pub fn timestamp(&self) -> Instant {
+        self.slot.timestamp
+    }
+}
+
+impl<'p> Drop for InterruptReport<'p> {
+    fn drop(&mut self) {
+        unsafe { self.ring.pop() };
+    }
+}
+
+impl<'p> Debug for InterruptReport<'p> {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.debug_struct("InterruptReport")
+            .field("data", &self.data())
+            .field("timestamp", &self.timestamp())
+            .finish()
+    }
+}
+
+extern "system" fn poll_callback(transfer: *mut libusb_transfer) {
+    unsafe {
+        let shared = &*((*transfer).user_data as *const Shared);
+        let timestamp = Instant::now();
+
+        let status = (*transfer).status;
+        let mut stopped = match status {
+            LIBUSB_TRANSFER_COMPLETED => {
+                let data = slice::from_raw_parts(
+                    (*transfer).buffer as *const u8,
+                    (*transfer).actual_length as usize,
+                );
+                if shared.ring.push(data, timestamp) {
+                    shared.received.fetch_add(1, Ordering::Relaxed);
+                } else {
+                    shared.dropped.fetch_add(1, Ordering::Relaxed);
+                }
+                None
+            }
+            LIBUSB_TRANSFER_TIMED_OUT => None,
+            LIBUSB_TRANSFER_CANCELLED | LIBUSB_TRANSFER_STALL | LIBUSB_TRANSFER_NO_DEVICE => {
+                Some(status)
+            }
+            _ => {
+                shared.errors.fetch_add(1, Ordering::Relaxed);
+                None
+            }
+        };
+
+        if stopped.is_none() && !shared.stopping.load(Ordering::SeqCst) {
+            match libusb_submit_transfer(transfer) {
+                0 => {
+                    // The poller may have been dropped while this transfer was not in flight, in
+                    // which case its cancellation missed it.
+                    if shared.stopping.load(Ordering::SeqCst) {
+                        libusb_cancel_transfer(transfer);
+                    }
+                }
+                LIBUSB_ERROR_NO_DEVICE => stopped = Some(LIBUSB_TRANSFER_NO_DEVICE),
+                _ => stopped = Some(LIBUSB_TRANSFER_ERROR),
+            }
+        } else if stopped.is_none() {
+            stopped = Some(LIBUSB_TRANSFER_CANCELLED);
+        }
+
+        if let Some(status) = stopped {
+            if status != LIBUSB_TRANSFER_CANCELLED {
+                let _ = shared.stopped_status.compare_exchange(
+                    -1,
+                    status,
+                    Ordering::AcqRel,
+                    Ordering::Acquire,
+                );
+            }
+        }
+
+        shared.ready.store(1, Ordering::Release);
+
+        // The poller may free the shared state as soon as the last transfer is released, so
+        // nothing may be touched afterwards.
+        if stopped.is_some() {
+            shared.release();
+        }
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use std::time::Instant;
+
+    use super::Ring;
+
+    #[test]
+    fn it_drops_reports_when_the_ring_is_full() {
+        let ring = Ring::new(2, 4);
+        let now = Instant::now();
+
+        unsafe {
+            assert!(ring.push(&[1, 2], now));
+            assert!(ring.push(&[3, 4, 5, 6, 7], now));
+            assert!(!ring.push(&[8], now));
+            assert_eq!(2, ring.len());
+
+            assert_eq!(
+                &[1, 2],
+                &ring.peek().unwrap().data[..ring.peek().unwrap().len]
+            );
+            ring.pop();
+            assert!(ring.push(&[9], now));
+
+            let slot = ring.peek().unwrap();
+            assert_eq!(&[3, 4, 5, 6], &slot.data[..slot.len]);
+            ring.pop();
+            let slot = ring.peek().unwrap();
+            assert_eq!(&[9], &slot.data[..slot.len]);
+            ring.pop();
+            assert!(ring.peek().is_none());
+            assert_eq!(0, ring.len());
+        }
+    }
+}
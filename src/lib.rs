@@ -3,24 +3,48 @@
 pub use libusb1_sys as ffi;
 pub use libusb1_sys::constants;
 
+#[cfg(unix)]
+pub use crate::async_context::{AsyncContext, PollFd, PollFdEvent};
 pub use crate::{
+    bos_descriptor::{
+        BosCapability, BosDescriptor, SsUsbDeviceCapability, Usb2ExtensionCapability,
+    },
+    bulk_stream::{BulkReader, BulkWriter, StreamStats},
+    cancellation::CancellationToken,
     config_descriptor::{ConfigDescriptor, Interfaces},
     context::{Context, GlobalContext, Hotplug, LogLevel, Registration, UsbContext},
-    device::Device,
+    control_batch::ControlBatch,
+    descriptor_cache::{DescriptorCache, Descriptors},
+    device::{Device, DeviceId},
+    device_buffer::DeviceBuffer,
     device_descriptor::DeviceDescriptor,
     device_handle::DeviceHandle,
     device_list::{DeviceList, Devices},
-    endpoint_descriptor::EndpointDescriptor,
+    device_watcher::{DeviceChanges, DeviceWatcher, PortPath},
+    endpoint::{BulkIn, BulkOut, InterruptIn, InterruptOut},
+    endpoint_descriptor::{EndpointDescriptor, SsEndpointCompanionDescriptor, TransferSizing},
     error::{Error, Result},
+    event_thread::EventThread,
     fields::{
         request_type, Direction, Recipient, RequestType, Speed, SyncType, TransferType, UsageType,
         Version,
     },
+    hotplug::{HotplugBuilder, HotplugEvent, HotplugReceiver, HotplugRecv},
     interface_descriptor::{
         EndpointDescriptors, Interface, InterfaceDescriptor, InterfaceDescriptors,
     },
+    interrupt_poller::{InterruptPoller, InterruptReport},
     language::{Language, PrimaryLanguage, SubLanguage},
+    log_callback::LogCallback,
     options::UsbOption,
+    probe::{probe_devices, ProbedDevice},
+    scheduler::{Completion, Scheduler, SchedulerStreamStats, StreamId},
+    snapshot::{DeviceSnapshot, Snapshot, SnapshotKey},
+    streams::BulkStreams,
+    string_cache::{DeviceStrings, Languages},
+    transfer::{IsoPacket, IsoPackets, Transfer, TransferFuture, TransferStatus},
+    transfer_pool::{PoolStats, PooledTransfer, TransferPool},
+    transfer_stats::{EndpointStats, LatencyHistogram, TransferHook, TransferStats},
     version::{version, LibraryVersion},
 };
 
@@ -32,18 +56,41 @@ mod test_helpers;
 mod error;
 mod version;
 
+#[cfg(unix)]
+mod async_context;
 mod context;
+mod control_batch;
+mod descriptor_cache;
 mod device;
+mod device_buffer;
 mod device_handle;
 mod device_list;
+mod device_watcher;
+mod endpoint;
+mod event_thread;
 
+mod bos_descriptor;
+mod bulk_stream;
+mod cancellation;
 mod config_descriptor;
 mod device_descriptor;
 mod endpoint_descriptor;
 mod fields;
+mod hotplug;
 mod interface_descriptor;
+mod interrupt_poller;
 mod language;
+mod log_callback;
 mod options;
+mod probe;
+mod scheduler;
+mod snapshot;
+mod streams;
+mod string_cache;
+mod transfer;
+mod transfer_pool;
+mod transfer_stats;
+mod vectored;
 
 /// Tests whether the running `libusb` library supports capability API.
 pub fn has_capability() -> bool {
@@ -83,6 +130,16 @@ pub fn set_log_level(level: LogLevel) {
     }
 }
 
+/// Routes the messages `libusb` logs for any context to `callback`, or stops doing so if
+/// `callback` is `None`.
+///
+/// This is called in addition to any callback set with
+/// [`UsbContext::set_log_callback`](trait.UsbContext.html#method.set_log_callback). Messages are
+/// only produced up to the log level of their context.
+pub fn set_log_callback(callback: Option<LogCallback>) {
+    log_callback::set_global_callback(callback);
+}
+
 /// Convenience function to open a device by its vendor ID and product ID.
 /// Using global context
 ///
@@ -0,0 +1,124 @@
+use std::{
+    borrow::Cow,
+    ffi::CStr,
+    panic::{self, AssertUnwindSafe},
+    ptr,
+    sync::{Arc, Mutex},
+};
+
+use libc::{c_char, c_int};
+use libusb1_sys::{constants::*, *};
+
+use crate::context::LogLevel;
+
+/// A function receiving the messages logged by `libusb`.
+pub type LogCallback = Box<dyn Fn(LogLevel, &str) + Send + Sync>;
+
+/// Callbacks keyed by the address of their context, or null for the global callback.
+static CALLBACKS: Mutex<Vec<(usize, Arc<LogCallback>)>> = Mutex::new(Vec::new());
+
+fn callback(context: *mut libusb_context) -> Option<Arc<LogCallback>> {
+    let callbacks = CALLBACKS.lock().unwrap_or_else(|err| err.into_inner());
+    callbacks
+        .iter()
+        .find(|&&(key, _)| key == context as usize)
+        .map(|(_, callback)| callback.clone())
+}
+
+fn replace(context: *mut libusb_context, callback: Option<LogCallback>) {
+    let mut callbacks = CALLBACKS.lock().unwrap_or_else(|err| err.into_inner());
+    callbacks.retain(|&(key, _)| key != context as usize);
+    if let Some(callback) = callback {
+        callbacks.push((context as usize, Arc::new(callback)));
+    }
+}
+
+/// Routes the messages of `context` to `callback`, or back to `stderr` if it is `None`.
+pub(crate) fn set_context_callback(context: *mut libusb_context, callback: Option<LogCallback>) {
+    let enabled = callback.is_some();
+    replace(context, callback);
+    unsafe {
+        libusb_set_log_cb(
+            context,
+            if enabled {
+                Some(context_trampoline)
+            } else {
+                None
+            },
+            LIBUSB_LOG_CB_CONTEXT,
+        );
+    }
+}
+
+/// Routes the messages of all contexts to `callback`, or stops doing so if it is `None`.
+pub(crate) fn set_global_callback(callback: Option<LogCallback>) {
+    let enabled = callback.is_some();
+    replace(ptr::null_mut(), callback);
+    unsafe {
+        libusb_set_log_cb(
+            ptr::null_mut(),
+            if enabled {
+                Some(global_trampoline)
+            } else {
+                None
+            },
+            LIBUSB_LOG_CB_GLOBAL,
+        );
+    }
+}
+
+/// Forgets the callback of a context that is being closed.
+pub(crate) fn remove_context_callback(context: *mut libusb_context) {
+    replace(context, None);
+}
+
+/// Converts a message from `libusb`, which ends with a newline, into a string.
+unsafe fn message<'a>(message: *const c_char) -> Cow<'a, str> {
+    if message.is_null() {
+        return "".into();
+    }
+
+    match CStr::from_ptr(message).to_string_lossy() {
+        Cow::Borrowed(s) => s.trim_end().into(),
+        Cow::Owned(s) => s.trim_end().to_owned().into(),
+    }
+}
+
+fn dispatch(key: *mut libusb_context, level: c_int, msg: *const c_char) {
+    if let Some(callback) = callback(key) {
+        let level = LogLevel::from_c_int(level);
+        let msg = unsafe { message(msg) };
+        let _ = panic::catch_unwind(AssertUnwindSafe(|| callback(level, &msg)));
+    }
+}
+
+extern "system" fn context_trampoline(
+    context: *mut libusb_context,
+    level: c_int,
+    msg: *const c_char,
+) {
+    dispatch(context, level, msg);
+}
+
+extern "system" fn global_trampoline(
+    _context: *mut libusb_context,
+    level: c_int,
+    msg: *const c_char,
+) {
+    dispatch(ptr::null_mut(), level, msg);
+}
+
+#[cfg(test)]
+mod test {
+    use super::message;
+
+    #[test]
+    fn it_trims_the_trailing_newline() {
+        let msg = b"libusb: debug [libusb_init] created default context\n\0";
+        assert_eq!(
+            "libusb: debug [libusb_init] created default context",
+            unsafe { message(msg.as_ptr() as *const _) }
+        );
+        assert_eq!("", unsafe { message(std::ptr::null()) });
+    }
+}
@@ -1,5 +1,9 @@
+use std::ptr;
+
 use crate::{error, UsbContext};
-use libusb1_sys::{constants::*, libusb_set_option};
+use libusb1_sys::{constants::*, libusb_context, libusb_set_option};
+#[cfg(libusb_init_context)]
+use libusb1_sys::{libusb_init_option, libusb_init_option_value};
 
 /// A `libusb` runtime option that can be enabled for a context.
 pub struct UsbOption {
@@ -19,16 +23,71 @@ impl UsbOption {
         }
     }
 
+    /// Do not scan for devices when a context is created.
+    ///
+    /// Listing devices on such a context returns nothing. Devices are instead opened from file
+    /// descriptors obtained elsewhere, for example from the Android USB manager, with
+    /// [`UsbContext::wrap_sys_device`](trait.UsbContext.html#method.wrap_sys_device). This
+    /// avoids the cost of enumerating the bus at startup, and works where enumeration is not
+    /// permitted at all.
+    ///
+    /// libusb only honours this option while a context is initialized.
+    /// [`Context::with_options`](struct.Context.html#method.with_options) passes it to that
+    /// context alone, which needs libusb 1.0.27 or later; with older versions it fails with
+    /// `NotSupported`. [`set_process_default`](#method.set_process_default) applies it to every
+    /// context created afterwards instead.
+    ///
+    /// **Note**: This option needs libusb 1.0.24 or later, and only has an effect on Linux.
+    pub fn no_device_discovery() -> Self {
+        Self {
+            inner: OptionInner::NoDeviceDiscovery,
+        }
+    }
+
+    /// Returns true if the option must be set before the context is initialized.
+    pub(crate) fn before_init(&self) -> bool {
+        match self.inner {
+            OptionInner::UseUsbdk => false,
+            OptionInner::NoDeviceDiscovery => true,
+        }
+    }
+
+    /// Sets the option for every context the process initializes from now on, including
+    /// [`GlobalContext`](struct.GlobalContext.html).
+    ///
+    /// The setting can not be undone. Prefer
+    /// [`Context::with_options`](struct.Context.html#method.with_options), which only affects
+    /// the context it creates, where it is supported.
+    pub fn set_process_default(&self) -> crate::Result<()> {
+        self.set(ptr::null_mut())
+    }
+
+    /// Returns the option in the form `libusb_init_context` takes.
+    #[cfg(libusb_init_context)]
+    pub(crate) fn init_option(&self) -> libusb_init_option {
+        libusb_init_option {
+            option: self.option(),
+            value: libusb_init_option_value { ival: 0 },
+        }
+    }
+
     pub(crate) fn apply<T: UsbContext>(&self, ctx: &mut T) -> crate::Result<()> {
+        self.set(ctx.as_raw())
+    }
+
+    fn option(&self) -> u32 {
         match self.inner {
-            OptionInner::UseUsbdk => {
-                let err = unsafe { libusb_set_option(ctx.as_raw(), LIBUSB_OPTION_USE_USBDK) };
-                if err == LIBUSB_SUCCESS {
-                    Ok(())
-                } else {
-                    Err(error::from_libusb(err))
-                }
-            }
+            OptionInner::UseUsbdk => LIBUSB_OPTION_USE_USBDK,
+            OptionInner::NoDeviceDiscovery => LIBUSB_OPTION_NO_DEVICE_DISCOVERY,
+        }
+    }
+
+    fn set(&self, ctx: *mut libusb_context) -> crate::Result<()> {
+        let err = unsafe { libusb_set_option(ctx, self.option()) };
+        if err == LIBUSB_SUCCESS {
+            Ok(())
+        } else {
+            Err(error::from_libusb(err))
         }
     }
 }
@@ -36,4 +95,5 @@ impl UsbOption {
 enum OptionInner {
     #[cfg_attr(not(windows), allow(dead_code))] // only constructed on Windows
     UseUsbdk,
+    NoDeviceDiscovery,
 }
@@ -0,0 +1,168 @@
+use std::{
+    fmt::{self, Debug},
+    sync::{mpsc, Arc, Mutex},
+    thread,
+    time::Duration,
+};
+
+use crate::{
+    config_descriptor::ConfigDescriptor, device::Device, device_descriptor::DeviceDescriptor,
+    device_handle::DeviceHandle, device_list::DeviceList, error::Error,
+    string_cache::DeviceStrings, UsbContext,
+};
+
+/// An opened device and the descriptors read while probing it.
+pub struct ProbedDevice<T: UsbContext> {
+    descriptor: DeviceDescriptor,
+    handle: DeviceHandle<T>,
+    config: ConfigDescriptor,
+    strings: DeviceStrings,
+}
+
+impl<T: UsbContext> ProbedDevice<T> {
+    /// Returns the device descriptor.
+    pub fn device_descriptor(&self) -> &DeviceDescriptor {
+        &self.descriptor
+    }
+
+    /// Returns the handle the device was opened with.
+    pub fn handle(&self) -> &DeviceHandle<T> {
+        &self.handle
+    }
+
+    /// Returns the descriptor of the active configuration.
+    pub fn active_config_descriptor(&self) -> &ConfigDescriptor {
+        &self.config
+    }
+
+    /// Returns the manufacturer, product and serial number strings, in the first language the
+    /// device supports. They are all `None` if the device has no string descriptors.
+    pub fn strings(&self) -> &DeviceStrings {
+        &self.strings
+    }
+
+    /// Returns the handle, dropping the descriptors.
+    pub fn into_handle(self) -> DeviceHandle<T> {
+        self.handle
+    }
+}
+
+impl<T: UsbContext> Debug for ProbedDevice<T> {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.debug_struct("ProbedDevice")
+            .field("descriptor", &self.descriptor)
+            .field("handle", &self.handle)
+            .field("strings", &self.strings)
+            .finish()
+    }
+}
+
+/// Opens and probes the devices in `devices` whose descriptor matches `filter`, on up to
+/// `workers` threads at once.
+///
+/// Each matching device is opened, and its active configuration descriptor and strings are
+/// read, which takes several round trips per device. Devices are probed in parallel, so the
+/// total time is close to that of the slowest device instead of the sum over all of them.
+/// `timeout` applies to each string request.
+///
+/// The device descriptors are read on the calling thread before any worker starts, since
+/// libusb caches them and reading them needs no I/O. Each device is then only ever touched by
+/// one worker, and libusb serializes whatever the workers share internally, so no locking is
+/// needed by the caller.
+///
+/// Returns every matching device with the result of probing it, in list order.
+pub fn probe_devices<T, F>(
+    devices: &DeviceList<T>,
+    workers: usize,
+    timeout: Duration,
+    mut filter: F,
+) -> Vec<(Device<T>, crate::Result<ProbedDevice<T>>)>
+where
+    T: UsbContext + 'static,
+    F: FnMut(&DeviceDescriptor) -> bool,
+{
+    let mut results = Vec::new();
+    let mut queue = Vec::new();
+    for device in devices.iter() {
+        match device.device_descriptor() {
+            Ok(descriptor) if filter(&descriptor) => {
+                queue.push((results.len(), device.clone(), descriptor));
+                results.push((device, None));
+            }
+            Ok(_) => {}
+            Err(err) => results.push((device, Some(Err(err)))),
+        }
+    }
+
+    // Workers take devices from the back, so reverse to probe them in list order.
+    queue.reverse();
+    let workers = workers.max(1).min(queue.len());
+    let queue = Arc::new(Mutex::new(queue));
+    let (sender, receiver) = mpsc::channel();
+
+    let threads = (0..workers)
+        .filter_map(|_| {
+            let queue = queue.clone();
+            let sender = sender.clone();
+            thread::Builder::new()
+                .name("rusb-probe".into())
+                .spawn(move || loop {
+                    let next = queue.lock().unwrap().pop();
+                    let (index, device, descriptor) = match next {
+                        Some(next) => next,
+                        None => break,
+                    };
+                    let result = probe(&device, descriptor, timeout);
+                    if sender.send((index, result)).is_err() {
+                        break;
+                    }
+                })
+                .ok()
+        })
+        .collect::<Vec<_>>();
+    drop(sender);
+
+    // Probe on this thread if no worker could be spawned.
+    if threads.is_empty() {
+        while let Some((index, device, descriptor)) = queue.lock().unwrap().pop() {
+            results[index].1 = Some(probe(&device, descriptor, timeout));
+        }
+    }
+
+    for (index, result) in receiver {
+        results[index].1 = Some(result);
+    }
+    for thread in threads {
+        let _ = thread.join();
+    }
+
+    results
+        .into_iter()
+        .map(|(device, result)| (device, result.unwrap_or(Err(Error::Other))))
+        .collect()
+}
+
+fn probe<T: UsbContext>(
+    device: &Device<T>,
+    descriptor: DeviceDescriptor,
+    timeout: Duration,
+) -> crate::Result<ProbedDevice<T>> {
+    let handle = device.open()?;
+    let config = device.active_config_descriptor()?;
+
+    let strings = match handle.read_languages_cached(timeout) {
+        Ok(ref languages) if !languages.is_empty() => {
+            handle.read_strings(languages[0], &descriptor, timeout)?
+        }
+        // Devices without string descriptors stall the request for the languages.
+        Ok(_) | Err(Error::Pipe) => DeviceStrings::default(),
+        Err(err) => return Err(err),
+    };
+
+    Ok(ProbedDevice {
+        descriptor,
+        handle,
+        config,
+        strings,
+    })
+}
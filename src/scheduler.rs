@@ -0,0 +1,741 @@
+use std::{
+    any::Any,
+    collections::VecDeque,
+    fmt::{self, Debug},
+    mem::ManuallyDrop,
+    ptr::NonNull,
+    slice,
+    sync::{
+        atomic::{AtomicBool, AtomicI32, AtomicU64, AtomicUsize, Ordering},
+        Arc, Condvar, Mutex,
+    },
+    thread::{self, JoinHandle},
+    time::{Duration, Instant},
+};
+
+use libc::{c_int, c_uchar, c_void};
+use libusb1_sys::{constants::*, *};
+
+use crate::{
+    context::wait_for_completion,
+    device_handle::DeviceHandle,
+    error::{self, Error},
+    event_thread::EventThread,
+    fields::TransferType,
+    transfer::{status_from_libusb, TransferStatus},
+    UsbContext,
+};
+
+/// Identifies a stream added to a [`Scheduler`](struct.Scheduler.html).
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash, PartialOrd, Ord)]
+pub struct StreamId(u64);
+
+impl StreamId {
+    /// Returns the number of the stream, unique within its scheduler.
+    pub fn as_u64(self) -> u64 {
+        self.0
+    }
+}
+
+/// The single completion queue of a scheduler.
+struct Queue {
+    completions: Mutex<QueueState>,
+    available: Condvar,
+}
+
+struct QueueState {
+    completions: VecDeque<Completion>,
+    closed: bool,
+}
+
+impl Queue {
+    fn push(&self, completion: Completion) {
+        let mut state = self
+            .completions
+            .lock()
+            .unwrap_or_else(|err| err.into_inner());
+        state.completions.push_back(completion);
+        drop(state);
+        self.available.notify_one();
+    }
+
+    fn reserve(&self, additional: usize) {
+        let mut state = self
+            .completions
+            .lock()
+            .unwrap_or_else(|err| err.into_inner());
+        state.completions.reserve(additional);
+    }
+}
+
+/// The transfers of one endpoint, shared with their completion callback through `user_data`.
+struct Stream {
+    id: StreamId,
+    endpoint: u8,
+    queue: Arc<Queue>,
+    context: *mut libusb_context,
+    transfers: Vec<NonNull<libusb_transfer>>,
+    // Transfer buffers, only accessed through the pointers handed to `libusb`.
+    buffers: Vec<u8>,
+    stopping: AtomicBool,
+    // Transfers owned by `libusb`. `idle` is set whenever this drops to zero, to wake `stop`.
+    // The last reference to the stream may be dropped by a callback, freeing the transfers
+    // from the event thread, which `libusb` allows.
+    in_flight: AtomicUsize,
+    idle: AtomicI32,
+    completed: AtomicU64,
+    bytes: AtomicU64,
+    // Keeps the device handle open for as long as the transfers exist.
+    _handle: Arc<dyn Any + Send + Sync>,
+}
+
+unsafe impl Send for Stream {}
+unsafe impl Sync for Stream {}
+
+impl Drop for Stream {
+    fn drop(&mut self) {
+        for transfer in self.transfers.iter() {
+            unsafe { libusb_free_transfer(transfer.as_ptr()) };
+        }
+    }
+}
+
+impl Stream {
+    /// Hands `transfer` to `libusb` again, unless the stream is being removed.
+    fn submit(&self, transfer: NonNull<libusb_transfer>) -> crate::Result<()> {
+        // Counted before checking `stopping`, so that `stop` either waits for the transfer or
+        // the transfer is not submitted.
+        self.in_flight.fetch_add(1, Ordering::SeqCst);
+        if self.stopping.load(Ordering::SeqCst) {
+            self.release();
+            return Err(Error::Interrupted);
+        }
+
+        match unsafe { libusb_submit_transfer(transfer.as_ptr()) } {
+            0 => {
+                // `stop` may have cancelled the other transfers while this one was submitted.
+                if self.stopping.load(Ordering::SeqCst) {
+                    unsafe { libusb_cancel_transfer(transfer.as_ptr()) };
+                }
+                Ok(())
+            }
+            err => {
+                self.release();
+                Err(error::from_libusb(err))
+            }
+        }
+    }
+
+    fn release(&self) {
+        if self.in_flight.fetch_sub(1, Ordering::SeqCst) == 1 {
+            self.idle.store(1, Ordering::Release);
+        }
+    }
+
+    /// Cancels all transfers and waits until `libusb` has released them.
+    fn stop(&self) {
+        self.stopping.store(true, Ordering::SeqCst);
+        for transfer in self.transfers.iter() {
+            unsafe { libusb_cancel_transfer(transfer.as_ptr()) };
+        }
+        loop {
+            // Cleared before checking the count, so that releasing the last transfer afterwards
+            // sets it again.
+            self.idle.store(0, Ordering::SeqCst);
+            if self.in_flight.load(Ordering::SeqCst) == 0 {
+                break;
+            }
+            let _ = wait_for_completion(self.context, &self.idle, None);
+        }
+    }
+}
+
+/// A completed transfer, taken from a scheduler's completion queue.
+///
+/// The completion owns the transfer's buffer. Dropping it resubmits the transfer, so each stream
+/// has at most its queue depth of transfers either in flight or waiting to be consumed. A device
+/// that produces data faster than it is consumed therefore stalls on its own instead of filling
+/// the queue.
+pub struct Completion {
+    stream: Arc<Stream>,
+    transfer: NonNull<libusb_transfer>,
+    timestamp: Instant,
+}
+
+unsafe impl Send for Completion {}
+unsafe impl Sync for Completion {}
+
+impl Completion {
+    /// Returns the stream the transfer belongs to.
+    pub fn stream(&self) -> StreamId {
+        self.stream.id
+    }
+
+    /// Returns the endpoint the transfer was made on.
+    pub fn endpoint(&self) -> u8 {
+        self.stream.endpoint
+    }
+
+    /// Returns the status of the transfer.
+    pub fn status(&self) -> TransferStatus {
+        status_from_libusb(self.raw().status)
+    }
+
+    /// Returns the number of bytes received, or the error the transfer completed with.
+    pub fn result(&self) -> crate::Result<usize> {
+        self.status().into_result(self.data().len())
+    }
+
+    /// Returns the data received by the transfer.
+    pub fn data(&self) -> &[u8] {
+        let transfer = self.raw();
+        unsafe { slice::from_raw_parts(transfer.buffer, transfer.actual_length as usize) }
+    }
+
+    /// Returns the time the transfer completed.
+    pub fn timestamp(&self) -> Instant {
+        self.timestamp
+    }
+
+    fn raw(&self) -> &libusb_transfer {
+        unsafe { &*self.transfer.as_ptr() }
+    }
+}
+
+impl Drop for Completion {
+    /// Resubmits the transfer, unless the endpoint stalled or the device is gone.
+    fn drop(&mut self) {
+        match self.status() {
+            TransferStatus::Stall | TransferStatus::NoDevice | TransferStatus::Cancelled => {}
+            _ => {
+                let _ = self.stream.submit(self.transfer);
+            }
+        }
+    }
+}
+
+impl Debug for Completion {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.debug_struct("Completion")
+            .field("stream", &self.stream())
+            .field("endpoint", &self.endpoint())
+            .field("status", &self.status())
+            .field("length", &self.data().len())
+            .finish()
+    }
+}
+
+/// Counters of one stream of a [`Scheduler`](struct.Scheduler.html).
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct SchedulerStreamStats {
+    /// Number of transfers completed.
+    pub completed: u64,
+    /// Number of bytes received.
+    pub bytes: u64,
+    /// Number of transfers currently in flight.
+    pub in_flight: usize,
+}
+
+/// Multiplexes bulk and interrupt IN streams of many devices onto a few threads.
+///
+/// All devices share one context, whose events are handled by a single
+/// [`EventThread`](struct.EventThread.html) owned by the scheduler. Every stream keeps a fixed
+/// number of transfers in flight, and each completed transfer is appended to one completion
+/// queue shared by all streams, in the order the transfers completed. The queue is consumed with
+/// [`recv`](#method.recv) from any number of threads, or by worker threads started with
+/// [`spawn_workers`](#method.spawn_workers).
+///
+/// Since a stream's transfers are only resubmitted once their [`Completion`] is dropped, each
+/// device is limited to its own queue depth, which keeps memory use fixed and stops one busy
+/// device from crowding out the others. The number of threads does not depend on the number of
+/// devices.
+///
+/// The context's events must not be handled anywhere else while the scheduler exists.
+pub struct Scheduler<T: UsbContext + 'static> {
+    queue: Arc<Queue>,
+    streams: Mutex<Vec<Arc<Stream>>>,
+    next_id: AtomicU64,
+    workers: Vec<JoinHandle<()>>,
+    events: Option<EventThread<T>>,
+}
+
+impl<T: UsbContext + 'static> Scheduler<T> {
+    /// Creates a scheduler for devices opened on `context`, and starts handling its events.
+    pub fn new(context: T) -> crate::Result<Self> {
+        Ok(Scheduler {
+            queue: Arc::new(Queue {
+                completions: Mutex::new(QueueState {
+                    completions: VecDeque::new(),
+                    closed: false,
+                }),
+                available: Condvar::new(),
+            }),
+            streams: Mutex::new(Vec::new()),
+            next_id: AtomicU64::new(0),
+            workers: Vec::new(),
+            events: Some(EventThread::spawn(context)?),
+        })
+    }
+
+    /// Starts streaming from the bulk IN endpoint `endpoint` of `handle`, with `depth` transfers
+    /// of `buffer_size` bytes each.
+    ///
+    /// The buffer size is rounded up to a multiple of the endpoint's maximum packet size.
+    ///
+    /// ## Errors
+    ///
+    /// * `InvalidParam` if `endpoint` is not a bulk IN endpoint or `depth` is zero.
+    /// * `NotFound` if the active configuration has no such endpoint.
+    /// * Any error from submitting the transfers.
+    pub fn add_bulk_in(
+        &self,
+        handle: Arc<DeviceHandle<T>>,
+        endpoint: u8,
+        buffer_size: usize,
+        depth: usize,
+    ) -> crate::Result<StreamId> {
+        let buffer_size = handle.bulk_in(endpoint)?.aligned_len(buffer_size);
+        self.add_stream(handle, TransferType::Bulk, endpoint, buffer_size, depth)
+    }
+
+    /// Starts streaming from the interrupt IN endpoint `endpoint` of `handle`, with `depth`
+    /// transfers of `buffer_size` bytes each.
+    ///
+    /// See [`add_bulk_in`](#method.add_bulk_in).
+    pub fn add_interrupt_in(
+        &self,
+        handle: Arc<DeviceHandle<T>>,
+        endpoint: u8,
+        buffer_size: usize,
+        depth: usize,
+    ) -> crate::Result<StreamId> {
+        let buffer_size = handle.interrupt_in(endpoint)?.aligned_len(buffer_size);
+        self.add_stream(
+            handle,
+            TransferType::Interrupt,
+            endpoint,
+            buffer_size,
+            depth,
+        )
+    }
+
+    fn add_stream(
+        &self,
+        handle: Arc<DeviceHandle<T>>,
+        transfer_type: TransferType,
+        endpoint: u8,
+        buffer_size: usize,
+        depth: usize,
+    ) -> crate::Result<StreamId> {
+        if depth == 0 || buffer_size == 0 || buffer_size > c_int::MAX as usize {
+            return Err(Error::InvalidParam);
+        }
+
+        let mut transfers = Vec::with_capacity(depth);
+        for _ in 0..depth {
+            match NonNull::new(unsafe { libusb_alloc_transfer(0) }) {
+                Some(transfer) => transfers.push(transfer),
+                None => {
+                    for transfer in transfers {
+                        unsafe { libusb_free_transfer(transfer.as_ptr()) };
+                    }
+                    return Err(Error::NoMem);
+                }
+            }
+        }
+
+        let id = StreamId(self.next_id.fetch_add(1, Ordering::Relaxed));
+        let raw_handle = handle.as_raw();
+        let mut stream = Stream {
+            id,
+            endpoint,
+            queue: self.queue.clone(),
+            context: handle.context().as_raw(),
+            transfers,
+            buffers: vec![0; depth * buffer_size],
+            stopping: AtomicBool::new(false),
+            in_flight: AtomicUsize::new(0),
+            idle: AtomicI32::new(0),
+            completed: AtomicU64::new(0),
+            bytes: AtomicU64::new(0),
+            _handle: handle,
+        };
+
+        // The buffers do not move with the stream, only the `Vec` pointing to them does.
+        let buffers = stream.buffers.as_mut_ptr();
+        let stream = Arc::new(stream);
+        for (i, transfer) in stream.transfers.iter().enumerate() {
+            unsafe {
+                libusb_fill_bulk_transfer(
+                    transfer.as_ptr(),
+                    raw_handle,
+                    endpoint,
+                    buffers.add(i * buffer_size) as *mut c_uchar,
+                    buffer_size as c_int,
+                    stream_callback,
+                    Arc::as_ptr(&stream) as *mut c_void,
+                    0,
+                );
+                if transfer_type == TransferType::Interrupt {
+                    (*transfer.as_ptr()).transfer_type = LIBUSB_TRANSFER_TYPE_INTERRUPT;
+                }
+            }
+        }
+
+        self.queue.reserve(depth);
+        for transfer in stream.transfers.iter() {
+            if let Err(err) = stream.submit(*transfer) {
+                stream.stop();
+                return Err(err);
+            }
+        }
+
+        self.streams().push(stream);
+        Ok(id)
+    }
+
+    /// Stops a stream, cancelling its transfers and waiting until they are released.
+    ///
+    /// Completions of the stream that are still queued or held can be consumed as usual, but
+    /// are not resubmitted.
+    ///
+    /// ## Errors
+    ///
+    /// * `NotFound` if there is no such stream.
+    pub fn remove_stream(&self, id: StreamId) -> crate::Result<()> {
+        let stream = {
+            let mut streams = self.streams();
+            let index = streams
+                .iter()
+                .position(|stream| stream.id == id)
+                .ok_or(Error::NotFound)?;
+            streams.swap_remove(index)
+        };
+
+        stream.stop();
+        Ok(())
+    }
+
+    /// Returns the counters of a stream, or `None` if there is no such stream.
+    pub fn stream_stats(&self, id: StreamId) -> Option<SchedulerStreamStats> {
+        self.streams()
+            .iter()
+            .find(|stream| stream.id == id)
+            .map(|stream| SchedulerStreamStats {
+                completed: stream.completed.load(Ordering::Relaxed),
+                bytes: stream.bytes.load(Ordering::Relaxed),
+                in_flight: stream.in_flight.load(Ordering::Relaxed),
+            })
+    }
+
+    /// Returns the number of streams.
+    pub fn num_streams(&self) -> usize {
+        self.streams().len()
+    }
+
+    /// Returns the number of completions waiting in the queue.
+    pub fn pending(&self) -> usize {
+        self.queue
+            .completions
+            .lock()
+            .unwrap_or_else(|err| err.into_inner())
+            .completions
+            .len()
+    }
+
+    /// Takes the oldest completion from the queue, waiting up to `timeout` for one, or forever
+    /// if it is `None`.
+    ///
+    /// Returns `None` if the timeout expired or the scheduler is shutting down.
+    pub fn recv(&self, timeout: Option<Duration>) -> Option<Completion> {
+        recv(&self.queue, timeout.map(|timeout| Instant::now() + timeout))
+    }
+
+    /// Starts `count` threads that take completions from the queue and pass them to `handler`.
+    ///
+    /// The threads run until the scheduler is dropped.
+    pub fn spawn_workers<F>(&mut self, count: usize, handler: F) -> crate::Result<()>
+    where
+        F: Fn(Completion) + Send + Sync + 'static,
+    {
+        let handler = Arc::new(handler);
+        for _ in 0..count {
+            let queue = self.queue.clone();
+            let handler = handler.clone();
+            let worker = thread::Builder::new()
+                .name("rusb-worker".into())
+                .spawn(move || {
+                    while let Some(completion) = recv(&queue, None) {
+                        handler(completion);
+                    }
+                })
+                .map_err(|_| Error::Other)?;
+            self.workers.push(worker);
+        }
+        Ok(())
+    }
+
+    fn streams(&self) -> std::sync::MutexGuard<'_, Vec<Arc<Stream>>> {
+        self.streams.lock().unwrap_or_else(|err| err.into_inner())
+    }
+}
+
+impl<T: UsbContext + 'static> Drop for Scheduler<T> {
+    /// Stops the workers and all streams, then the event thread.
+    fn drop(&mut self) {
+        self.queue
+            .completions
+            .lock()
+            .unwrap_or_else(|err| err.into_inner())
+            .closed = true;
+        self.queue.available.notify_all();
+        for worker in self.workers.drain(..) {
+            let _ = worker.join();
+        }
+
+        for stream in self.streams().drain(..) {
+            stream.stop();
+        }
+
+        let completions = {
+            let mut state = self
+                .queue
+                .completions
+                .lock()
+                .unwrap_or_else(|err| err.into_inner());
+            state.completions.drain(..).collect::<Vec<_>>()
+        };
+        drop(completions);
+
+        self.events.take();
+    }
+}
+
+impl<T: UsbContext + 'static> Debug for Scheduler<T> {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.debug_struct("Scheduler")
+            .field("streams", &self.num_streams())
+            .field("pending", &self.pending())
+            .field("workers", &self.workers.len())
+            .finish()
+    }
+}
+
+fn recv(queue: &Queue, deadline: Option<Instant>) -> Option<Completion> {
+    let mut state = queue
+        .completions
+        .lock()
+        .unwrap_or_else(|err| err.into_inner());
+    loop {
+        if state.closed {
+            return None;
+        }
+        if let Some(completion) = state.completions.pop_front() {
+            return Some(completion);
+        }
+
+        state = match deadline {
+            Some(deadline) => {
+                let now = Instant::now();
+                if now >= deadline {
+                    return None;
+                }
+                queue
+                    .available
+                    .wait_timeout(state, deadline - now)
+                    .unwrap_or_else(|err| err.into_inner())
+                    .0
+            }
+            None => queue
+                .available
+                .wait(state)
+                .unwrap_or_else(|err| err.into_inner()),
+        };
+    }
+}
+
+extern "system" fn stream_callback(transfer: *mut libusb_transfer) {
+    unsafe {
+        let timestamp = Instant::now();
+
+        // `stop` returns as soon as it sees no transfers in flight, which can be before
+        // `release` is done with the stream. This reference keeps the stream alive until then.
+        let owner = ManuallyDrop::new(Arc::from_raw((*transfer).user_data as *const Stream));
+        let stream = Arc::clone(&owner);
+
+        if (*transfer).status == LIBUSB_TRANSFER_CANCELLED && stream.stopping.load(Ordering::SeqCst)
+        {
+            stream.release();
+            return;
+        }
+
+        stream.completed.fetch_add(1, Ordering::Relaxed);
+        stream
+            .bytes
+            .fetch_add((*transfer).actual_length as u64, Ordering::Relaxed);
+
+        stream.queue.push(Completion {
+            stream: stream.clone(),
+            transfer: NonNull::new_unchecked(transfer),
+            timestamp,
+        });
+
+        stream.release();
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use std::{
+        collections::VecDeque,
+        ptr,
+        sync::{
+            atomic::{AtomicBool, AtomicI32, AtomicU64, AtomicUsize, Ordering},
+            Arc, Condvar, Mutex,
+        },
+        thread,
+        time::{Duration, Instant},
+    };
+
+    use libc::c_void;
+    use libusb1_sys::{constants::*, libusb_transfer};
+
+    use super::{recv, stream_callback, Queue, QueueState, Stream, StreamId};
+    use crate::transfer::TransferStatus;
+
+    fn queue() -> Arc<Queue> {
+        Arc::new(Queue {
+            completions: Mutex::new(QueueState {
+                completions: VecDeque::new(),
+                closed: false,
+            }),
+            available: Condvar::new(),
+        })
+    }
+
+    // A stream without transfers of its own, so that stopping it never calls into `libusb`. The
+    // transfers handed to the callback are owned by the tests instead.
+    fn stream(queue: &Arc<Queue>, in_flight: usize) -> Arc<Stream> {
+        Arc::new(Stream {
+            id: StreamId(7),
+            endpoint: 0x81,
+            queue: queue.clone(),
+            context: ptr::null_mut(),
+            transfers: Vec::new(),
+            buffers: Vec::new(),
+            stopping: AtomicBool::new(false),
+            in_flight: AtomicUsize::new(in_flight),
+            idle: AtomicI32::new(0),
+            completed: AtomicU64::new(0),
+            bytes: AtomicU64::new(0),
+            _handle: Arc::new(()),
+        })
+    }
+
+    fn transfer(stream: &Arc<Stream>, status: i32, data: &mut [u8]) -> libusb_transfer {
+        libusb_transfer {
+            dev_handle: ptr::null_mut(),
+            flags: 0,
+            endpoint: stream.endpoint,
+            transfer_type: LIBUSB_TRANSFER_TYPE_BULK,
+            timeout: 0,
+            status,
+            length: data.len() as i32,
+            actual_length: data.len() as i32,
+            callback: stream_callback,
+            user_data: Arc::as_ptr(stream) as *mut c_void,
+            buffer: data.as_mut_ptr(),
+            num_iso_packets: 0,
+            iso_packet_desc: [],
+        }
+    }
+
+    #[test]
+    fn it_releases_cancelled_transfers_of_a_stopping_stream() {
+        let queue = queue();
+        let stream = stream(&queue, 1);
+        stream.stopping.store(true, Ordering::SeqCst);
+
+        let mut data = [0; 4];
+        let mut transfer = transfer(&stream, LIBUSB_TRANSFER_CANCELLED, &mut data);
+        stream_callback(&mut transfer);
+
+        assert_eq!(0, stream.in_flight.load(Ordering::SeqCst));
+        assert_eq!(1, stream.idle.load(Ordering::SeqCst));
+        assert!(queue.completions.lock().unwrap().completions.is_empty());
+
+        stream.stop();
+        assert_eq!(1, Arc::strong_count(&stream));
+    }
+
+    #[test]
+    fn it_does_not_resubmit_completions_of_a_stopped_stream() {
+        let queue = queue();
+        let stream = stream(&queue, 1);
+
+        let mut data = [1, 2, 3, 4];
+        let mut transfer = transfer(&stream, LIBUSB_TRANSFER_COMPLETED, &mut data);
+        stream_callback(&mut transfer);
+        assert_eq!(0, stream.in_flight.load(Ordering::SeqCst));
+        assert_eq!(1, stream.completed.load(Ordering::Relaxed));
+        assert_eq!(4, stream.bytes.load(Ordering::Relaxed));
+
+        stream.stop();
+
+        let completion = recv(&queue, Some(Instant::now())).unwrap();
+        assert_eq!(StreamId(7), completion.stream());
+        assert_eq!(TransferStatus::Completed, completion.status());
+        assert_eq!(&[1, 2, 3, 4], completion.data());
+        assert_eq!(2, Arc::strong_count(&stream));
+
+        drop(completion);
+        assert_eq!(0, stream.in_flight.load(Ordering::SeqCst));
+        assert_eq!(1, Arc::strong_count(&stream));
+    }
+
+    #[test]
+    fn it_keeps_a_stream_alive_until_its_callback_returns() {
+        let queue = queue();
+        let stream = stream(&queue, 1);
+        stream.stopping.store(true, Ordering::SeqCst);
+
+        let mut data = [0; 4];
+        let mut transfer = transfer(&stream, LIBUSB_TRANSFER_CANCELLED, &mut data);
+        let transfer = &mut transfer as *mut libusb_transfer as usize;
+        let weak = Arc::downgrade(&stream);
+
+        let callback = thread::spawn(move || stream_callback(transfer as *mut libusb_transfer));
+
+        // Like `remove_stream`, drop the last reference as soon as nothing is in flight.
+        while stream.in_flight.load(Ordering::SeqCst) != 0 {
+            thread::yield_now();
+        }
+        stream.stop();
+        drop(stream);
+
+        callback.join().unwrap();
+        assert!(weak.upgrade().is_none());
+    }
+
+    #[test]
+    fn it_times_out_on_an_empty_queue() {
+        let queue = queue();
+        let started = Instant::now();
+        assert!(recv(&queue, Some(started + Duration::from_millis(10))).is_none());
+        assert!(started.elapsed() >= Duration::from_millis(10));
+    }
+
+    #[test]
+    fn it_wakes_receivers_when_closed() {
+        let queue = queue();
+        let receiver = {
+            let queue = queue.clone();
+            thread::spawn(move || recv(&queue, None).is_none())
+        };
+
+        thread::sleep(Duration::from_millis(10));
+        queue.completions.lock().unwrap().closed = true;
+        queue.available.notify_all();
+        assert!(receiver.join().unwrap());
+    }
+}
@@ -0,0 +1,560 @@
+use std::{sync::Arc, time::Duration};
+
+use crate::{
+    config_descriptor::{self, ConfigDescriptor},
+    descriptor_cache::Descriptors,
+    device_descriptor::{self, DeviceDescriptor},
+    device_handle::DeviceHandle,
+    error::Error,
+    language::{self, Language},
+    UsbContext,
+};
+
+const MAGIC: &[u8; 8] = b"RUSBSNAP";
+const VERSION: u16 = 1;
+
+/// Identifies the device a [`DeviceSnapshot`](struct.DeviceSnapshot.html) was taken of.
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
+pub struct SnapshotKey {
+    vendor_id: u16,
+    product_id: u16,
+    device_version: u16,
+    serial_number: Option<String>,
+}
+
+impl SnapshotKey {
+    /// Creates a key from a device descriptor and the device's serial number string.
+    pub fn new(device: &DeviceDescriptor, serial_number: Option<String>) -> Self {
+        SnapshotKey {
+            vendor_id: device.vendor_id(),
+            product_id: device.product_id(),
+            device_version: bcd(device),
+            serial_number,
+        }
+    }
+
+    /// Returns the vendor ID.
+    pub fn vendor_id(&self) -> u16 {
+        self.vendor_id
+    }
+
+    /// Returns the product ID.
+    pub fn product_id(&self) -> u16 {
+        self.product_id
+    }
+
+    /// Returns the device release number in binary-coded decimal, `bcdDevice`.
+    pub fn device_version(&self) -> u16 {
+        self.device_version
+    }
+
+    /// Returns the serial number string, if the device has one.
+    pub fn serial_number(&self) -> Option<&str> {
+        self.serial_number.as_deref()
+    }
+}
+
+fn bcd(device: &DeviceDescriptor) -> u16 {
+    let raw = device_descriptor::to_raw(device);
+    u16::from_le_bytes([raw[12], raw[13]])
+}
+
+/// The descriptors and strings of one device, as captured by
+/// [`DeviceSnapshot::capture`](#method.capture).
+#[derive(Debug)]
+pub struct DeviceSnapshot {
+    key: SnapshotKey,
+    descriptors: Arc<Descriptors>,
+    languages: Vec<Language>,
+    // Keyed by language ID and string index, in capture order.
+    strings: Vec<(u16, u8, String)>,
+}
+
+impl DeviceSnapshot {
+    /// Reads all descriptors of the device and the strings they reference.
+    ///
+    /// Strings are read in the first language the device supports. Strings that the device
+    /// rejects or returns malformed are left out, so a snapshot can be taken of devices with
+    /// broken string descriptors.
+    ///
+    /// ## Errors
+    ///
+    /// * `Timeout` if a request timed out.
+    /// * `NoDevice` if the device has been disconnected.
+    /// * `Io` if a request encountered an I/O error.
+    pub fn capture<T: UsbContext>(
+        handle: &DeviceHandle<T>,
+        timeout: Duration,
+    ) -> crate::Result<Self> {
+        let descriptors = Descriptors::read(&handle.device())?;
+
+        let languages = match handle.read_languages(timeout) {
+            Ok(languages) => languages,
+            Err(Error::Pipe) | Err(Error::BadDescriptor) => Vec::new(),
+            Err(err) => return Err(err),
+        };
+
+        let device = descriptors.device_descriptor();
+        let mut indices = vec![
+            device.manufacturer_string_index(),
+            device.product_string_index(),
+            device.serial_number_string_index(),
+        ];
+        for config in descriptors.config_descriptors() {
+            indices.push(config.description_string_index());
+            for interface in config.interfaces() {
+                for setting in interface.descriptors() {
+                    indices.push(setting.description_string_index());
+                }
+            }
+        }
+
+        let mut strings: Vec<(u16, u8, String)> = Vec::new();
+        if let Some(&language) = languages.first() {
+            for index in indices.into_iter().flatten() {
+                if strings.iter().any(|&(_, i, _)| i == index) {
+                    continue;
+                }
+                match handle.read_string_descriptor(language, index, timeout) {
+                    Ok(string) => strings.push((language.lang_id(), index, string)),
+                    Err(Error::Pipe) | Err(Error::BadDescriptor) => {}
+                    Err(err) => return Err(err),
+                }
+            }
+        }
+
+        let serial_number = device.serial_number_string_index().and_then(|index| {
+            strings
+                .iter()
+                .find(|&&(_, i, _)| i == index)
+                .map(|(_, _, string)| string.clone())
+        });
+
+        Ok(DeviceSnapshot {
+            key: SnapshotKey::new(device, serial_number),
+            descriptors: Arc::new(descriptors),
+            languages,
+            strings,
+        })
+    }
+
+    /// Returns the key identifying the device.
+    pub fn key(&self) -> &SnapshotKey {
+        &self.key
+    }
+
+    /// Returns the captured descriptors.
+    ///
+    /// They can be added to a [`DescriptorCache`](struct.DescriptorCache.html) with
+    /// [`insert`](struct.DescriptorCache.html#method.insert).
+    pub fn descriptors(&self) -> &Arc<Descriptors> {
+        &self.descriptors
+    }
+
+    /// Returns the languages the device supports.
+    pub fn languages(&self) -> &[Language] {
+        &self.languages
+    }
+
+    /// Returns the string with `index` in `language`, if it was captured.
+    pub fn string(&self, language: Language, index: u8) -> Option<&str> {
+        self.strings
+            .iter()
+            .find(|&&(lang_id, i, _)| lang_id == language.lang_id() && i == index)
+            .map(|(_, _, string)| string.as_str())
+    }
+
+    /// Fills the string cache of `handle` with the captured languages and strings.
+    ///
+    /// The `_cached` read methods of the handle and
+    /// [`read_strings`](struct.DeviceHandle.html#method.read_strings) then return them without
+    /// going to the device.
+    pub fn restore<T: UsbContext>(&self, handle: &DeviceHandle<T>) {
+        handle.prime_string_cache(
+            &self.languages,
+            self.strings.iter().map(|(lang_id, index, string)| {
+                (language::from_lang_id(*lang_id), *index, string.as_str())
+            }),
+        );
+    }
+}
+
+/// A set of [`DeviceSnapshot`](struct.DeviceSnapshot.html)s with a compact binary form.
+///
+/// Reading the descriptors and strings of a device takes one control transfer each, which adds
+/// up to a noticeable delay for composite devices. A process that saves a snapshot with
+/// [`to_bytes`](#method.to_bytes) can load it with [`from_bytes`](#method.from_bytes) after a
+/// restart, find the entry of each device with [`find`](#method.find) and skip those reads.
+///
+/// `from_bytes` only reads from the slice it is given, so the snapshot can be parsed straight
+/// out of a memory-mapped file.
+///
+/// The format is little-endian and versioned. It holds the descriptors as sent by the device, so
+/// a snapshot does not depend on the layout of `libusb`'s structures.
+#[derive(Debug, Default)]
+pub struct Snapshot {
+    devices: Vec<DeviceSnapshot>,
+}
+
+impl Snapshot {
+    /// Creates an empty snapshot.
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Adds `device`, replacing the entry with the same key.
+    pub fn insert(&mut self, device: DeviceSnapshot) {
+        match self.devices.iter_mut().find(|d| d.key == device.key) {
+            Some(entry) => *entry = device,
+            None => self.devices.push(device),
+        }
+    }
+
+    /// Returns the entry with key `key`.
+    pub fn get(&self, key: &SnapshotKey) -> Option<&DeviceSnapshot> {
+        self.devices.iter().find(|device| device.key == *key)
+    }
+
+    /// Removes and returns the entry with key `key`.
+    pub fn remove(&mut self, key: &SnapshotKey) -> Option<DeviceSnapshot> {
+        let pos = self.devices.iter().position(|device| device.key == *key)?;
+        Some(self.devices.remove(pos))
+    }
+
+    /// Returns the entries.
+    pub fn devices(&self) -> &[DeviceSnapshot] {
+        &self.devices
+    }
+
+    /// Returns the number of entries.
+    pub fn len(&self) -> usize {
+        self.devices.len()
+    }
+
+    /// Returns true if the snapshot has no entries.
+    pub fn is_empty(&self) -> bool {
+        self.devices.is_empty()
+    }
+
+    /// Returns the entry for the device of `handle`, if there is one.
+    ///
+    /// Candidates are selected by comparing the whole device descriptor, which `libusb` keeps in
+    /// memory, so this does not go to the device. Only if a candidate has a serial number is it
+    /// read, in a language known from the snapshot. That is one control transfer instead of the
+    /// dozens a full [`capture`](struct.DeviceSnapshot.html#method.capture) may take.
+    ///
+    /// ## Errors
+    ///
+    /// The errors of
+    /// [`read_string_descriptor`](struct.DeviceHandle.html#method.read_string_descriptor), except
+    /// that a device without a readable serial number matches no entry that has one.
+    pub fn find<T: UsbContext>(
+        &self,
+        handle: &DeviceHandle<T>,
+        timeout: Duration,
+    ) -> crate::Result<Option<&DeviceSnapshot>> {
+        let descriptor = handle.device().device_descriptor()?;
+        let raw = device_descriptor::to_raw(&descriptor);
+
+        let candidates = self.devices.iter().filter(|device| {
+            device_descriptor::to_raw(device.descriptors.device_descriptor()) == raw
+        });
+
+        // Read at most once, on the first candidate with a serial number.
+        let mut serial_number: Option<Option<String>> = None;
+        for candidate in candidates {
+            let expected = match candidate.key.serial_number {
+                Some(ref expected) => expected,
+                None => return Ok(Some(candidate)),
+            };
+
+            if serial_number.is_none() {
+                let read = match (
+                    descriptor.serial_number_string_index(),
+                    candidate.languages.first(),
+                ) {
+                    (Some(index), Some(&language)) => {
+                        match handle.read_string_descriptor(language, index, timeout) {
+                            Ok(string) => Some(string),
+                            Err(Error::Pipe) | Err(Error::BadDescriptor) => None,
+                            Err(err) => return Err(err),
+                        }
+                    }
+                    _ => None,
+                };
+                serial_number = Some(read);
+            }
+
+            if serial_number.as_ref().and_then(|s| s.as_ref()) == Some(expected) {
+                return Ok(Some(candidate));
+            }
+        }
+
+        Ok(None)
+    }
+
+    /// Serializes the snapshot.
+    pub fn to_bytes(&self) -> Vec<u8> {
+        let mut out = Vec::new();
+        out.extend_from_slice(MAGIC);
+        out.extend_from_slice(&VERSION.to_le_bytes());
+        out.extend_from_slice(&(self.devices.len() as u32).to_le_bytes());
+
+        for device in &self.devices {
+            let key = &device.key;
+            out.extend_from_slice(&key.vendor_id.to_le_bytes());
+            out.extend_from_slice(&key.product_id.to_le_bytes());
+            out.extend_from_slice(&key.device_version.to_le_bytes());
+            match key.serial_number {
+                Some(ref serial_number) => {
+                    out.push(1);
+                    write_str(&mut out, serial_number);
+                }
+                None => out.push(0),
+            }
+
+            let descriptors = &device.descriptors;
+            out.extend_from_slice(&device_descriptor::to_raw(descriptors.device_descriptor()));
+            out.push(descriptors.config_descriptors().len() as u8);
+            for config in descriptors.config_descriptors() {
+                config_descriptor::write_raw(config, &mut out);
+            }
+
+            out.push(device.languages.len() as u8);
+            for language in &device.languages {
+                out.extend_from_slice(&language.lang_id().to_le_bytes());
+            }
+
+            out.extend_from_slice(&(device.strings.len() as u16).to_le_bytes());
+            for (lang_id, index, string) in &device.strings {
+                out.extend_from_slice(&lang_id.to_le_bytes());
+                out.push(*index);
+                write_str(&mut out, string);
+            }
+        }
+
+        out
+    }
+
+    /// Parses a snapshot serialized by [`to_bytes`](#method.to_bytes).
+    ///
+    /// ## Errors
+    ///
+    /// * `NotSupported` if `bytes` is not a snapshot or one of an unknown version.
+    /// * `BadDescriptor` if `bytes` is truncated or holds malformed descriptors.
+    pub fn from_bytes(bytes: &[u8]) -> crate::Result<Self> {
+        let mut r = Reader { bytes, pos: 0 };
+
+        if r.take(MAGIC.len()).ok() != Some(&MAGIC[..]) || r.u16()? != VERSION {
+            return Err(Error::NotSupported);
+        }
+
+        let count = r.u32()? as usize;
+        let mut devices = Vec::new();
+        for _ in 0..count {
+            let vendor_id = r.u16()?;
+            let product_id = r.u16()?;
+            let device_version = r.u16()?;
+            let serial_number = match r.u8()? {
+                0 => None,
+                _ => Some(r.str()?),
+            };
+
+            let device = device_descriptor::from_raw(r.take(device_descriptor::RAW_SIZE)?)?;
+            let num_configs = r.u8()?;
+            let mut configs = Vec::with_capacity(num_configs as usize);
+            for _ in 0..num_configs {
+                configs.push(r.config()?);
+            }
+
+            let num_languages = r.u8()?;
+            let mut languages = Vec::with_capacity(num_languages as usize);
+            for _ in 0..num_languages {
+                languages.push(language::from_lang_id(r.u16()?));
+            }
+
+            let num_strings = r.u16()?;
+            let mut strings = Vec::with_capacity(num_strings as usize);
+            for _ in 0..num_strings {
+                let lang_id = r.u16()?;
+                let index = r.u8()?;
+                strings.push((lang_id, index, r.str()?));
+            }
+
+            devices.push(DeviceSnapshot {
+                key: SnapshotKey {
+                    vendor_id,
+                    product_id,
+                    device_version,
+                    serial_number,
+                },
+                descriptors: Arc::new(Descriptors::new(device, configs)),
+                languages,
+                strings,
+            });
+        }
+
+        Ok(Snapshot { devices })
+    }
+}
+
+fn write_str(out: &mut Vec<u8>, string: &str) {
+    // String descriptors hold at most 126 UTF-16 code units, so the length always fits.
+    out.extend_from_slice(&(string.len() as u16).to_le_bytes());
+    out.extend_from_slice(string.as_bytes());
+}
+
+struct Reader<'a> {
+    bytes: &'a [u8],
+    pos: usize,
+}
+
+impl<'a> Reader<'a> {
+    fn take(&mut self, len: usize) -> crate::Result<&'a [u8]> {
+        if self.bytes.len() - self.pos < len {
+            return Err(Error::BadDescriptor);
+        }
+        let bytes = &self.bytes[self.pos..self.pos + len];
+        self.pos += len;
+        Ok(bytes)
+    }
+
+    fn u8(&mut self) -> crate::Result<u8> {
+        Ok(self.take(1)?[0])
+    }
+
+    fn u16(&mut self) -> crate::Result<u16> {
+        let bytes = self.take(2)?;
+        Ok(u16::from_le_bytes([bytes[0], bytes[1]]))
+    }
+
+    fn u32(&mut self) -> crate::Result<u32> {
+        let bytes = self.take(4)?;
+        Ok(u32::from_le_bytes([bytes[0], bytes[1], bytes[2], bytes[3]]))
+    }
+
+    fn str(&mut self) -> crate::Result<String> {
+        let len = self.u16()? as usize;
+        String::from_utf8(self.take(len)?.to_vec()).map_err(|_| Error::BadDescriptor)
+    }
+
+    fn config(&mut self) -> crate::Result<ConfigDescriptor> {
+        // The configuration descriptor delimits itself with wTotalLength.
+        let header = &self.bytes[self.pos..];
+        if header.len() < 4 {
+            return Err(Error::BadDescriptor);
+        }
+        let total = u16::from_le_bytes([header[2], header[3]]) as usize;
+        config_descriptor::from_raw(self.take(total)?)
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use std::sync::Arc;
+
+    use super::{DeviceSnapshot, Snapshot, SnapshotKey};
+    use crate::{
+        config_descriptor, descriptor_cache::Descriptors, device_descriptor, language, Error,
+    };
+
+    const CONFIG: [u8; 34] = [
+        0x09, 0x02, 0x22, 0x00, 0x01, 0x01, 0x00, 0xa0, 0x32, // configuration
+        0x09, 0x04, 0x00, 0x00, 0x01, 0x03, 0x01, 0x02, 0x00, // interface
+        0x09, 0x21, 0x11, 0x01, 0x00, 0x01, 0x22, 0x34, 0x00, // HID descriptor
+        0x07, 0x05, 0x81, 0x03, 0x08, 0x00, 0x0a, // endpoint
+    ];
+
+    fn snapshot(serial_number: Option<&str>) -> DeviceSnapshot {
+        let device = device_descriptor::from_libusb(device_descriptor!(
+            iManufacturer: 1,
+            iSerialNumber: 3
+        ));
+        let config = config_descriptor::from_raw(&CONFIG).unwrap();
+
+        DeviceSnapshot {
+            key: SnapshotKey::new(&device, serial_number.map(str::to_owned)),
+            descriptors: Arc::new(Descriptors::new(device, vec![config])),
+            languages: vec![language::from_lang_id(0x0409)],
+            strings: vec![
+                (0x0409, 1, "Manufacturer".to_owned()),
+                (0x0409, 3, serial_number.unwrap_or("").to_owned()),
+            ],
+        }
+    }
+
+    #[test]
+    fn it_keys_devices_by_ids_version_and_serial_number() {
+        let device = snapshot(Some("A1"));
+        assert_eq!(0x1234, device.key().vendor_id());
+        assert_eq!(0x5678, device.key().product_id());
+        assert_eq!(0x0123, device.key().device_version());
+        assert_eq!(Some("A1"), device.key().serial_number());
+
+        let mut snapshot = Snapshot::new();
+        snapshot.insert(device);
+        snapshot.insert(self::snapshot(Some("B2")));
+        snapshot.insert(self::snapshot(Some("A1")));
+        assert_eq!(2, snapshot.len());
+
+        let key = self::snapshot(Some("B2")).key;
+        assert!(snapshot.get(&key).is_some());
+        assert!(snapshot.remove(&key).is_some());
+        assert!(snapshot.get(&key).is_none());
+    }
+
+    #[test]
+    fn it_round_trips_through_bytes() {
+        let mut snapshot = Snapshot::new();
+        snapshot.insert(self::snapshot(Some("A1")));
+        snapshot.insert(self::snapshot(None));
+
+        let bytes = snapshot.to_bytes();
+        assert_eq!(b"RUSBSNAP", &bytes[..8]);
+
+        let parsed = Snapshot::from_bytes(&bytes).unwrap();
+        assert_eq!(2, parsed.len());
+        assert_eq!(bytes, parsed.to_bytes());
+
+        let device = &parsed.devices()[0];
+        assert_eq!(Some("A1"), device.key().serial_number());
+        assert_eq!(
+            Some("Manufacturer"),
+            device.string(language::from_lang_id(0x0409), 1)
+        );
+        assert_eq!(None, device.string(language::from_lang_id(0x0407), 1));
+
+        let config = &device.descriptors().config_descriptors()[0];
+        let mut raw = Vec::new();
+        config_descriptor::write_raw(config, &mut raw);
+        assert_eq!(&CONFIG[..], &raw[..]);
+    }
+
+    #[test]
+    fn it_rejects_foreign_or_truncated_bytes() {
+        let mut snapshot = Snapshot::new();
+        snapshot.insert(self::snapshot(Some("A1")));
+        let bytes = snapshot.to_bytes();
+
+        assert_eq!(
+            Some(Error::NotSupported),
+            Snapshot::from_bytes(b"RUSBSNAQ\x01\x00").err()
+        );
+
+        let mut newer = bytes.clone();
+        newer[8] = 2;
+        assert_eq!(
+            Some(Error::NotSupported),
+            Snapshot::from_bytes(&newer).err()
+        );
+
+        for len in 10..bytes.len() {
+            assert_eq!(
+                Some(Error::BadDescriptor),
+                Snapshot::from_bytes(&bytes[..len]).err(),
+                "truncated to {} bytes",
+                len
+            );
+        }
+    }
+}
@@ -0,0 +1,109 @@
+use std::{
+    fmt::{self, Debug},
+    time::Duration,
+};
+
+use libc::{c_int, c_uchar};
+use libusb1_sys::*;
+
+use crate::{
+    device_buffer::DeviceBuffer, device_handle::DeviceHandle, error, transfer::Transfer, UsbContext,
+};
+
+/// Bulk streams allocated on a set of SuperSpeed bulk endpoints.
+///
+/// USB 3 bulk streams let a device work on many outstanding requests on one endpoint at once
+/// and complete them in any order, each request being tagged with a stream ID. They are used
+/// by UAS storage devices among others. Transfers on a stream are created with
+/// [`transfer`](#method.transfer) and borrow the allocation, so the streams can not be freed
+/// while transfers on them exist.
+///
+/// The streams are freed when this is dropped.
+pub struct BulkStreams<'d, T: UsbContext> {
+    handle: &'d DeviceHandle<T>,
+    endpoints: Vec<u8>,
+    num_streams: u32,
+}
+
+impl<'d, T: UsbContext> BulkStreams<'d, T> {
+    pub(crate) fn alloc(
+        handle: &'d DeviceHandle<T>,
+        num_streams: u32,
+        endpoints: &[u8],
+    ) -> crate::Result<Self> {
+        let mut endpoints = endpoints.to_vec();
+        let n = unsafe {
+            libusb_alloc_streams(
+                handle.as_raw(),
+                num_streams,
+                endpoints.as_mut_ptr() as *mut c_uchar,
+                endpoints.len() as c_int,
+            )
+        };
+
+        if n < 0 {
+            Err(error::from_libusb(n))
+        } else {
+            Ok(BulkStreams {
+                handle,
+                endpoints,
+                num_streams: n as u32,
+            })
+        }
+    }
+
+    /// Returns the number of streams allocated on each endpoint.
+    ///
+    /// This can be less than requested. Valid stream IDs are `1..=num_streams()`.
+    pub fn num_streams(&self) -> u32 {
+        self.num_streams
+    }
+
+    /// Returns the endpoints the streams were allocated on.
+    pub fn endpoints(&self) -> &[u8] {
+        &self.endpoints
+    }
+
+    /// Creates a transfer on stream `stream_id` of `endpoint`.
+    ///
+    /// See [`Transfer::bulk_stream`](struct.Transfer.html#method.bulk_stream).
+    ///
+    /// ## Errors
+    ///
+    /// * `InvalidParam` if the streams were not allocated on `endpoint` or `stream_id` is not
+    ///   one of them.
+    pub fn transfer<'s>(
+        &'s self,
+        endpoint: u8,
+        stream_id: u32,
+        buffer: impl Into<DeviceBuffer<'s>>,
+        timeout: Duration,
+    ) -> crate::Result<Transfer<'s, T>> {
+        if !self.endpoints.contains(&endpoint) || stream_id == 0 || stream_id > self.num_streams {
+            return Err(error::Error::InvalidParam);
+        }
+        Transfer::bulk_stream(self.handle, endpoint, stream_id, buffer, timeout)
+    }
+}
+
+impl<'d, T: UsbContext> Drop for BulkStreams<'d, T> {
+    /// Frees the streams.
+    fn drop(&mut self) {
+        unsafe {
+            libusb_free_streams(
+                self.handle.as_raw(),
+                self.endpoints.as_mut_ptr() as *mut c_uchar,
+                self.endpoints.len() as c_int,
+            );
+        }
+    }
+}
+
+impl<'d, T: UsbContext> Debug for BulkStreams<'d, T> {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.debug_struct("BulkStreams")
+            .field("endpoints", &self.endpoints)
+            .field("num_streams", &self.num_streams)
+            .finish()
+    }
+}
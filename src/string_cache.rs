@@ -0,0 +1,222 @@
+use std::{char, collections::HashMap, iter::FusedIterator, str};
+
+use crate::{
+    error::Error,
+    language::{self, Language},
+};
+
+/// The strings referenced by a device descriptor.
+///
+/// Returned by [`DeviceHandle::read_strings`](struct.DeviceHandle.html#method.read_strings).
+/// A string is `None` if the device descriptor does not reference it or the device failed to
+/// return it.
+#[derive(Debug, Clone, Default, Eq, PartialEq, Hash)]
+pub struct DeviceStrings {
+    pub(crate) manufacturer: Option<String>,
+    pub(crate) product: Option<String>,
+    pub(crate) serial_number: Option<String>,
+}
+
+impl DeviceStrings {
+    /// Returns the manufacturer string.
+    pub fn manufacturer(&self) -> Option<&str> {
+        self.manufacturer.as_deref()
+    }
+
+    /// Returns the product string.
+    pub fn product(&self) -> Option<&str> {
+        self.product.as_deref()
+    }
+
+    /// Returns the serial number string.
+    pub fn serial_number(&self) -> Option<&str> {
+        self.serial_number.as_deref()
+    }
+}
+
+/// Languages and string descriptors read from a device handle.
+#[derive(Debug, Default)]
+pub(crate) struct StringCache {
+    pub(crate) languages: Option<Vec<Language>>,
+    // Keyed by language ID and string index.
+    pub(crate) strings: HashMap<(u16, u8), String>,
+}
+
+impl StringCache {
+    pub(crate) fn string(&self, language: Language, index: u8) -> Option<&String> {
+        self.strings.get(&(language.lang_id(), index))
+    }
+
+    pub(crate) fn insert_string(&mut self, language: Language, index: u8, string: String) {
+        self.strings.insert((language.lang_id(), index), string);
+    }
+
+    pub(crate) fn clear(&mut self) {
+        self.languages = None;
+        self.strings.clear();
+    }
+}
+
+/// Maximum size of a string descriptor.
+pub(crate) const MAX_DESCRIPTOR_SIZE: usize = 255;
+
+/// Checks the header of a string descriptor and returns its UTF-16 code units.
+fn code_units(buf: &[u8]) -> crate::Result<impl Iterator<Item = u16> + '_> {
+    let len = buf.len();
+    if len < 2 || buf[0] as usize != len || len & 0x01 != 0 {
+        return Err(Error::BadDescriptor);
+    }
+
+    Ok(buf
+        .chunks(2)
+        .skip(1)
+        .map(|chunk| u16::from(chunk[0]) | u16::from(chunk[1]) << 8))
+}
+
+/// Iterator over the languages listed in string descriptor zero.
+///
+/// Returned by
+/// [`DeviceHandle::read_languages_iter`](struct.DeviceHandle.html#method.read_languages_iter).
+/// The descriptor is held inline, so the iterator does not allocate.
+#[derive(Clone)]
+pub struct Languages {
+    buf: [u8; MAX_DESCRIPTOR_SIZE],
+    len: usize,
+    pos: usize,
+}
+
+impl Languages {
+    /// Checks the first `len` bytes of `buf` as string descriptor zero.
+    pub(crate) fn new(buf: [u8; MAX_DESCRIPTOR_SIZE], len: usize) -> crate::Result<Self> {
+        let _ = code_units(&buf[..len])?;
+        Ok(Languages { buf, len, pos: 2 })
+    }
+}
+
+impl Iterator for Languages {
+    type Item = Language;
+
+    fn next(&mut self) -> Option<Language> {
+        if self.pos + 2 > self.len {
+            return None;
+        }
+
+        let lang_id = u16::from(self.buf[self.pos]) | u16::from(self.buf[self.pos + 1]) << 8;
+        self.pos += 2;
+        Some(language::from_lang_id(lang_id))
+    }
+
+    fn size_hint(&self) -> (usize, Option<usize>) {
+        let remaining = (self.len - self.pos) / 2;
+        (remaining, Some(remaining))
+    }
+}
+
+impl ExactSizeIterator for Languages {}
+
+impl FusedIterator for Languages {}
+
+impl std::fmt::Debug for Languages {
+    fn fmt(&self, f: &mut std::fmt::Formatter) -> std::fmt::Result {
+        f.debug_list().entries(self.clone()).finish()
+    }
+}
+
+/// Decodes a string descriptor into `out` as UTF-8 and returns the string.
+///
+/// ## Errors
+///
+/// * `BadDescriptor` if the descriptor is malformed.
+/// * `Overflow` if `out` is too small to hold the string.
+/// * `Other` if the string is not valid UTF-16.
+pub(crate) fn decode_string_into<'b>(buf: &[u8], out: &'b mut [u8]) -> crate::Result<&'b str> {
+    let mut len = 0;
+    for c in char::decode_utf16(code_units(buf)?) {
+        let c = c.map_err(|_| Error::Other)?;
+        if out.len() - len < c.len_utf8() {
+            return Err(Error::Overflow);
+        }
+        len += c.encode_utf8(&mut out[len..]).len();
+    }
+
+    str::from_utf8(&out[..len]).map_err(|_| Error::Other)
+}
+
+/// Parses string descriptor zero, which lists the supported languages.
+pub(crate) fn parse_languages(buf: &[u8]) -> crate::Result<Vec<Language>> {
+    Ok(code_units(buf)?.map(language::from_lang_id).collect())
+}
+
+/// Parses a string descriptor.
+pub(crate) fn parse_string(buf: &[u8]) -> crate::Result<String> {
+    let utf16: Vec<u16> = code_units(buf)?.collect();
+    String::from_utf16(&utf16).map_err(|_| Error::Other)
+}
+
+#[cfg(test)]
+mod test {
+    use super::{
+        decode_string_into, parse_languages, parse_string, Languages, MAX_DESCRIPTOR_SIZE,
+    };
+    use crate::Error;
+
+    #[test]
+    fn it_iterates_languages_without_allocating() {
+        let mut buf = [0; MAX_DESCRIPTOR_SIZE];
+        buf[..6].copy_from_slice(&[6, 3, 0x09, 0x04, 0x07, 0x04]);
+
+        let languages = Languages::new(buf, 6).unwrap();
+        assert_eq!(2, languages.len());
+        assert_eq!(
+            vec![0x0409, 0x0407],
+            languages.map(|l| l.lang_id()).collect::<Vec<_>>()
+        );
+        assert_eq!(Some(Error::BadDescriptor), Languages::new(buf, 5).err());
+    }
+
+    #[test]
+    fn it_decodes_strings_into_caller_buffers() {
+        let mut out = [0; 8];
+        // "Aé€" then a surrogate pair for U+1F600.
+        let descriptor = [12, 3, b'A', 0, 0xe9, 0, 0xac, 0x20, 0x3d, 0xd8, 0x00, 0xde];
+
+        assert_eq!(
+            Err(Error::Overflow),
+            decode_string_into(&descriptor, &mut out)
+        );
+
+        let mut out = [0; 10];
+        assert_eq!(
+            Ok("Aé€\u{1f600}"),
+            decode_string_into(&descriptor, &mut out)
+        );
+        assert_eq!(Ok(""), decode_string_into(&[2, 3], &mut []));
+    }
+
+    #[test]
+    fn it_parses_languages() {
+        let languages = parse_languages(&[6, 3, 0x09, 0x04, 0x07, 0x04]).unwrap();
+
+        assert_eq!(
+            vec![0x0409, 0x0407],
+            languages.iter().map(|l| l.lang_id()).collect::<Vec<_>>()
+        );
+        assert!(parse_languages(&[2, 3]).unwrap().is_empty());
+    }
+
+    #[test]
+    fn it_parses_strings() {
+        assert_eq!(
+            "USB",
+            parse_string(&[8, 3, b'U', 0, b'S', 0, b'B', 0]).unwrap()
+        );
+        assert_eq!("", parse_string(&[2, 3]).unwrap());
+    }
+
+    #[test]
+    fn it_rejects_malformed_descriptors() {
+        assert_eq!(Err(Error::BadDescriptor), parse_string(&[]));
+        assert_eq!(Err(Error::BadDescriptor), parse_string(&[4, 3, b'U']));
+        assert_eq!(Err(Error::BadDescriptor), parse_string(&[6, 3, b'U', 0]));
+    }
+}
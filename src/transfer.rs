@@ -0,0 +1,984 @@
+use std::{
+    cell::UnsafeCell,
+    fmt::{self, Debug},
+    future::Future,
+    panic::{self, AssertUnwindSafe},
+    pin::Pin,
+    ptr::NonNull,
+    slice,
+    sync::{
+        atomic::{AtomicI32, Ordering},
+        Mutex,
+    },
+    task::{Context, Poll, Waker},
+    time::{Duration, Instant},
+};
+
+use libc::{c_int, c_uint, c_void};
+use libusb1_sys::{constants::*, *};
+
+use crate::{
+    cancellation::CancellationToken,
+    context::{millis_from_duration, wait_for_completion},
+    device_buffer::DeviceBuffer,
+    device_handle::DeviceHandle,
+    error::{self, Error},
+    transfer_stats::Instruments,
+    UsbContext,
+};
+
+/// Status of a completed asynchronous transfer.
+#[derive(Debug, Copy, Clone, Eq, PartialEq, Hash)]
+pub enum TransferStatus {
+    /// The transfer completed without error. This does not mean that the entire amount of
+    /// requested data was transferred.
+    Completed,
+
+    /// The transfer failed.
+    Error,
+
+    /// The transfer timed out.
+    TimedOut,
+
+    /// The transfer was cancelled.
+    Cancelled,
+
+    /// For bulk and interrupt endpoints the endpoint halted. For control transfers the request
+    /// was not supported by the device.
+    Stall,
+
+    /// The device was disconnected.
+    NoDevice,
+
+    /// The device sent more data than requested.
+    Overflow,
+}
+
+impl TransferStatus {
+    /// Converts the status of a transfer that moved `len` bytes into a `Result`.
+    ///
+    /// `Completed` maps to `Ok(len)` and every other status to the matching [`Error`] variant.
+    pub fn into_result(self, len: usize) -> crate::Result<usize> {
+        match self {
+            TransferStatus::Completed => Ok(len),
+            TransferStatus::Error => Err(Error::Io),
+            TransferStatus::TimedOut => Err(Error::Timeout),
+            TransferStatus::Cancelled => Err(Error::Interrupted),
+            TransferStatus::Stall => Err(Error::Pipe),
+            TransferStatus::NoDevice => Err(Error::NoDevice),
+            TransferStatus::Overflow => Err(Error::Overflow),
+        }
+    }
+}
+
+#[doc(hidden)]
+pub(crate) fn status_from_libusb(n: c_int) -> TransferStatus {
+    match n {
+        LIBUSB_TRANSFER_COMPLETED => TransferStatus::Completed,
+        LIBUSB_TRANSFER_TIMED_OUT => TransferStatus::TimedOut,
+        LIBUSB_TRANSFER_CANCELLED => TransferStatus::Cancelled,
+        LIBUSB_TRANSFER_STALL => TransferStatus::Stall,
+        LIBUSB_TRANSFER_NO_DEVICE => TransferStatus::NoDevice,
+        LIBUSB_TRANSFER_OVERFLOW => TransferStatus::Overflow,
+        LIBUSB_TRANSFER_ERROR | _ => TransferStatus::Error,
+    }
+}
+
+type Callback = Box<dyn FnMut(TransferStatus, usize) + Send + 'static>;
+
+/// State shared with the libusb completion callback through `user_data`.
+struct TransferState {
+    // Set to non-zero by the completion callback. Laid out as a `c_int` so that it can be handed
+    // to `libusb_handle_events_completed`.
+    completed: AtomicI32,
+
+    // Optional user callback, only touched by the completion callback while the transfer is in
+    // flight and by the owner while it is not.
+    callback: UnsafeCell<Option<Callback>>,
+
+    // Task to wake on completion, registered by a `TransferFuture`. The completion flag is set
+    // while this is locked, so a task checking the flag after registering can not miss a wakeup.
+    waker: Mutex<Option<Waker>>,
+
+    // Statistics and hook of the handle when the transfer was created, and the time of the last
+    // submission, which is only written by the owner while the transfer is not in flight.
+    instruments: Instruments,
+    submitted_at: UnsafeCell<Option<Instant>>,
+}
+
+/// An asynchronous transfer.
+///
+/// A `Transfer` owns a `libusb_transfer` and its data buffer, and borrows the device handle it
+/// was created for, so the handle can not be closed while transfers on it are in flight. Any
+/// number of transfers can be submitted at once to keep an endpoint busy.
+///
+/// Completion is reported while events are handled on the handle's context, either by calling
+/// [`wait`](#method.wait) or by another thread calling
+/// [`UsbContext::handle_events`](trait.UsbContext.html#method.handle_events). The result is
+/// then available from [`status`](#method.status) and [`actual_length`](#method.actual_length),
+/// and optionally delivered to a callback registered with
+/// [`set_callback`](#method.set_callback).
+///
+/// Dropping a transfer which is still in flight cancels it and blocks until libusb has released
+/// it.
+pub struct Transfer<'d, T: UsbContext> {
+    handle: &'d DeviceHandle<T>,
+    transfer: NonNull<libusb_transfer>,
+    state: NonNull<TransferState>,
+    buffer: DeviceBuffer<'d>,
+    // Offset of the data stage in `buffer`: the setup packet size for control transfers.
+    offset: usize,
+    submitted: bool,
+    token: Option<CancellationToken>,
+}
+
+unsafe impl<'d, T: UsbContext> Send for Transfer<'d, T> {}
+unsafe impl<'d, T: UsbContext> Sync for Transfer<'d, T> {}
+
+impl<'d, T: UsbContext> Drop for Transfer<'d, T> {
+    /// Cancels the transfer if it is in flight and frees it.
+    fn drop(&mut self) {
+        if self.is_pending() {
+            unsafe {
+                libusb_cancel_transfer(self.transfer.as_ptr());
+            }
+            // libusb still owns the transfer and the buffer until the callback has run.
+            while self.is_pending() {
+                let _ = wait_for_completion(
+                    self.handle.context().as_raw(),
+                    &self.state().completed,
+                    None,
+                );
+            }
+        }
+
+        // The callback may still be releasing the waker lock after setting the flag.
+        drop(self.state().waker.lock());
+
+        self.handle.cancellation_token().unregister(self.transfer);
+        if let Some(ref token) = self.token {
+            token.unregister(self.transfer);
+        }
+
+        unsafe {
+            libusb_free_transfer(self.transfer.as_ptr());
+            drop(Box::from_raw(self.state.as_ptr()));
+        }
+    }
+}
+
+impl<'d, T: UsbContext> Debug for Transfer<'d, T> {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.debug_struct("Transfer")
+            .field("endpoint", &self.endpoint())
+            .field("length", &self.length())
+            .field("pending", &self.is_pending())
+            .field("status", &self.status())
+            .finish()
+    }
+}
+
+impl<'d, T: UsbContext> Transfer<'d, T> {
+    /// Creates a bulk transfer on `endpoint`.
+    ///
+    /// For an IN endpoint, up to `buffer.len()` bytes are read into `buffer`. For an OUT
+    /// endpoint, the contents of `buffer` are written. The buffer can be a `Vec<u8>` or a
+    /// [`DeviceBuffer`](struct.DeviceBuffer.html) allocated for `handle`. The transfer is not
+    /// submitted.
+    pub fn bulk(
+        handle: &'d DeviceHandle<T>,
+        endpoint: u8,
+        buffer: impl Into<DeviceBuffer<'d>>,
+        timeout: Duration,
+    ) -> crate::Result<Self> {
+        let buffer = buffer.into();
+        let len = checked_length(buffer.len())?;
+        let mut transfer = Self::new(handle, 0, buffer, 0)?;
+        unsafe {
+            libusb_fill_bulk_transfer(
+                transfer.transfer.as_ptr(),
+                handle.as_raw(),
+                endpoint,
+                transfer.buffer.as_mut_ptr(),
+                len,
+                transfer_callback,
+                transfer.state.as_ptr() as *mut c_void,
+                millis_from_duration(timeout),
+            );
+        }
+        Ok(transfer)
+    }
+
+    /// Creates a bulk transfer on stream `stream_id` of a SuperSpeed bulk `endpoint`.
+    ///
+    /// The stream must have been allocated with
+    /// [`DeviceHandle::alloc_streams`](struct.DeviceHandle.html#method.alloc_streams); prefer
+    /// [`BulkStreams::transfer`](struct.BulkStreams.html#method.transfer), which ensures that.
+    /// The buffer is handled as for [`bulk`](#method.bulk). The transfer is not submitted.
+    ///
+    /// ## Errors
+    ///
+    /// * `InvalidParam` if `stream_id` is zero, which is not a valid stream.
+    pub fn bulk_stream(
+        handle: &'d DeviceHandle<T>,
+        endpoint: u8,
+        stream_id: u32,
+        buffer: impl Into<DeviceBuffer<'d>>,
+        timeout: Duration,
+    ) -> crate::Result<Self> {
+        if stream_id == 0 {
+            return Err(Error::InvalidParam);
+        }
+
+        let buffer = buffer.into();
+        let len = checked_length(buffer.len())?;
+        let mut transfer = Self::new(handle, 0, buffer, 0)?;
+        unsafe {
+            libusb_fill_bulk_stream_transfer(
+                transfer.transfer.as_ptr(),
+                handle.as_raw(),
+                endpoint,
+                stream_id,
+                transfer.buffer.as_mut_ptr(),
+                len,
+                transfer_callback,
+                transfer.state.as_ptr() as *mut c_void,
+                millis_from_duration(timeout),
+            );
+        }
+        Ok(transfer)
+    }
+
+    /// Returns the stream of a bulk stream transfer, or `None` for other transfers.
+    pub fn stream_id(&self) -> Option<u32> {
+        unsafe {
+            if (*self.transfer.as_ptr()).transfer_type == LIBUSB_TRANSFER_TYPE_BULK_STREAM {
+                Some(libusb_transfer_get_stream_id(self.transfer.as_ptr()))
+            } else {
+                None
+            }
+        }
+    }
+
+    /// Creates an interrupt transfer on `endpoint`.
+    ///
+    /// For an IN endpoint, up to `buffer.len()` bytes are read into `buffer`. For an OUT
+    /// endpoint, the contents of `buffer` are written. The transfer is not submitted.
+    pub fn interrupt(
+        handle: &'d DeviceHandle<T>,
+        endpoint: u8,
+        buffer: impl Into<DeviceBuffer<'d>>,
+        timeout: Duration,
+    ) -> crate::Result<Self> {
+        let buffer = buffer.into();
+        let len = checked_length(buffer.len())?;
+        let mut transfer = Self::new(handle, 0, buffer, 0)?;
+        unsafe {
+            libusb_fill_interrupt_transfer(
+                transfer.transfer.as_ptr(),
+                handle.as_raw(),
+                endpoint,
+                transfer.buffer.as_mut_ptr(),
+                len,
+                transfer_callback,
+                transfer.state.as_ptr() as *mut c_void,
+                millis_from_duration(timeout),
+            );
+        }
+        Ok(transfer)
+    }
+
+    /// Creates a control transfer on the default control endpoint.
+    ///
+    /// The parameters `request_type`, `request`, `value`, and `index` specify the fields of the
+    /// setup packet, in host-endian byte order, as for
+    /// [`DeviceHandle::read_control`](struct.DeviceHandle.html#method.read_control). If
+    /// `request_type` specifies a read, up to `data.len()` bytes are read into `data`; otherwise
+    /// the contents of `data` are written. The transfer is not submitted.
+    pub fn control(
+        handle: &'d DeviceHandle<T>,
+        request_type: u8,
+        request: u8,
+        value: u16,
+        index: u16,
+        data: Vec<u8>,
+        timeout: Duration,
+    ) -> crate::Result<Self> {
+        if data.len() > u16::MAX as usize {
+            return Err(Error::InvalidParam);
+        }
+
+        let mut buffer = Vec::with_capacity(LIBUSB_CONTROL_SETUP_SIZE + data.len());
+        buffer.resize(LIBUSB_CONTROL_SETUP_SIZE, 0);
+        buffer.extend_from_slice(&data);
+
+        let mut transfer = Self::new(handle, 0, buffer.into(), LIBUSB_CONTROL_SETUP_SIZE)?;
+        unsafe {
+            libusb_fill_control_setup(
+                transfer.buffer.as_mut_ptr(),
+                request_type,
+                request,
+                value,
+                index,
+                data.len() as u16,
+            );
+            libusb_fill_control_transfer(
+                transfer.transfer.as_ptr(),
+                handle.as_raw(),
+                transfer.buffer.as_mut_ptr(),
+                transfer_callback,
+                transfer.state.as_ptr() as *mut c_void,
+                millis_from_duration(timeout),
+            );
+        }
+        Ok(transfer)
+    }
+
+    /// Creates an isochronous transfer on `endpoint` made of `num_packets` packets.
+    ///
+    /// `buffer` is split into `num_packets` packets of `buffer.len() / num_packets` bytes each,
+    /// which should not exceed the endpoint's
+    /// [`max_iso_packet_size`](struct.Device.html#method.max_iso_packet_size). After completion
+    /// the result of every packet is available from [`iso_packets`](#method.iso_packets). The
+    /// transfer is not submitted.
+    ///
+    /// ## Errors
+    ///
+    /// * `InvalidParam` if `num_packets` is zero or larger than `buffer.len()`.
+    pub fn isochronous(
+        handle: &'d DeviceHandle<T>,
+        endpoint: u8,
+        buffer: impl Into<DeviceBuffer<'d>>,
+        num_packets: usize,
+        timeout: Duration,
+    ) -> crate::Result<Self> {
+        let buffer = buffer.into();
+        if num_packets == 0 || num_packets > buffer.len() || num_packets > c_int::MAX as usize {
+            return Err(Error::InvalidParam);
+        }
+        let len = checked_length(buffer.len())?;
+        let packet_len = buffer.len() / num_packets;
+
+        let mut transfer = Self::new(handle, num_packets as c_int, buffer, 0)?;
+        unsafe {
+            libusb_fill_iso_transfer(
+                transfer.transfer.as_ptr(),
+                handle.as_raw(),
+                endpoint,
+                transfer.buffer.as_mut_ptr(),
+                len,
+                num_packets as c_int,
+                transfer_callback,
+                transfer.state.as_ptr() as *mut c_void,
+                millis_from_duration(timeout),
+            );
+            libusb_set_iso_packet_lengths(transfer.transfer.as_ptr(), packet_len as c_uint);
+        }
+        Ok(transfer)
+    }
+
+    fn new(
+        handle: &'d DeviceHandle<T>,
+        iso_packets: c_int,
+        buffer: DeviceBuffer<'d>,
+        offset: usize,
+    ) -> crate::Result<Self> {
+        let transfer =
+            NonNull::new(unsafe { libusb_alloc_transfer(iso_packets) }).ok_or(Error::NoMem)?;
+        let state = Box::new(TransferState {
+            completed: AtomicI32::new(0),
+            callback: UnsafeCell::new(None),
+            waker: Mutex::new(None),
+            instruments: handle.instruments(),
+            submitted_at: UnsafeCell::new(None),
+        });
+
+        Ok(Transfer {
+            handle,
+            transfer,
+            state: unsafe { NonNull::new_unchecked(Box::into_raw(state)) },
+            buffer,
+            offset,
+            submitted: false,
+            token: None,
+        })
+    }
+
+    /// Get the raw libusb_transfer pointer, for advanced use in unsafe code.
+    pub fn as_raw(&self) -> *mut libusb_transfer {
+        self.transfer.as_ptr()
+    }
+
+    /// Returns the device handle this transfer was created for.
+    pub fn handle(&self) -> &'d DeviceHandle<T> {
+        self.handle
+    }
+
+    /// Returns the address of the endpoint this transfer is for.
+    pub fn endpoint(&self) -> u8 {
+        unsafe { (*self.transfer.as_ptr()).endpoint }
+    }
+
+    /// Returns the number of bytes requested, excluding any control setup packet.
+    pub fn length(&self) -> usize {
+        unsafe { (*self.transfer.as_ptr()).length as usize - self.offset }
+    }
+
+    /// Sets the number of bytes of the buffer to transfer on the next submission.
+    ///
+    /// ## Errors
+    ///
+    /// * `InvalidParam` if `len` is larger than the buffer or this is a control transfer, whose
+    ///   length is given by its setup packet.
+    ///
+    /// # Panics
+    ///
+    /// Panics if the transfer is in flight.
+    pub fn set_length(&mut self, len: usize) -> crate::Result<()> {
+        assert!(!self.is_pending(), "transfer is in flight");
+        if self.offset != 0 || len > self.buffer.len() {
+            return Err(Error::InvalidParam);
+        }
+        unsafe { (*self.transfer.as_ptr()).length = len as c_int };
+        Ok(())
+    }
+
+    /// Returns true if the transfer has been submitted and has not completed yet.
+    pub fn is_pending(&self) -> bool {
+        self.submitted && self.state().completed.load(Ordering::Acquire) == 0
+    }
+
+    /// Returns true if the transfer has been submitted and has completed.
+    pub fn is_completed(&self) -> bool {
+        self.submitted && self.state().completed.load(Ordering::Acquire) != 0
+    }
+
+    /// Returns the status of the last completed submission, or `None` if the transfer is in
+    /// flight or was never submitted.
+    pub fn status(&self) -> Option<TransferStatus> {
+        if self.is_completed() {
+            Some(status_from_libusb(unsafe {
+                (*self.transfer.as_ptr()).status
+            }))
+        } else {
+            None
+        }
+    }
+
+    /// Returns the number of bytes actually transferred by the last completed submission,
+    /// excluding any control setup packet.
+    ///
+    /// For isochronous transfers this is the sum over all packets.
+    pub fn actual_length(&self) -> usize {
+        if !self.is_completed() {
+            0
+        } else if self.num_iso_packets() > 0 {
+            self.iso_descriptors()
+                .iter()
+                .map(|desc| desc.actual_length as usize)
+                .sum()
+        } else {
+            unsafe { (*self.transfer.as_ptr()).actual_length as usize }
+        }
+    }
+
+    /// Returns the packets of an isochronous transfer, each with its own status and data.
+    ///
+    /// Packet data is borrowed from the transfer buffer, so no data is copied. For transfers of
+    /// other types the iterator is empty.
+    ///
+    /// # Panics
+    ///
+    /// Panics if the transfer is in flight.
+    pub fn iso_packets(&self) -> IsoPackets<'_> {
+        assert!(!self.is_pending(), "transfer is in flight");
+        IsoPackets {
+            descriptors: self.iso_descriptors().iter(),
+            buffer: &self.buffer[..],
+            offset: 0,
+        }
+    }
+
+    fn num_iso_packets(&self) -> usize {
+        unsafe { (*self.transfer.as_ptr()).num_iso_packets as usize }
+    }
+
+    fn iso_descriptors(&self) -> &[libusb_iso_packet_descriptor] {
+        unsafe {
+            slice::from_raw_parts(
+                (*self.transfer.as_ptr()).iso_packet_desc.as_ptr(),
+                self.num_iso_packets(),
+            )
+        }
+    }
+
+    /// Returns the result of the last completed submission, or `None` if the transfer is in
+    /// flight or was never submitted.
+    ///
+    /// On success this is the number of bytes transferred.
+    pub fn result(&self) -> Option<crate::Result<usize>> {
+        self.status()
+            .map(|status| status.into_result(self.actual_length()))
+    }
+
+    /// Returns the data buffer, excluding any control setup packet.
+    ///
+    /// After an IN transfer has completed, the first [`actual_length`](#method.actual_length)
+    /// bytes hold the data received from the device.
+    ///
+    /// # Panics
+    ///
+    /// Panics if the transfer is in flight.
+    pub fn buffer(&self) -> &[u8] {
+        assert!(!self.is_pending(), "transfer is in flight");
+        &self.buffer[self.offset..]
+    }
+
+    /// Returns the data buffer mutably, excluding any control setup packet.
+    ///
+    /// # Panics
+    ///
+    /// Panics if the transfer is in flight.
+    pub fn buffer_mut(&mut self) -> &mut [u8] {
+        assert!(!self.is_pending(), "transfer is in flight");
+        &mut self.buffer[self.offset..]
+    }
+
+    /// Consumes the transfer and returns its data buffer, excluding any control setup packet.
+    ///
+    /// A transfer in flight is cancelled first.
+    pub fn into_buffer(mut self) -> Vec<u8> {
+        self.reap();
+        let buffer = std::mem::replace(&mut self.buffer, DeviceBuffer::from(Vec::new()));
+        let mut buffer = buffer.into_vec();
+        buffer.drain(..self.offset);
+        buffer
+    }
+
+    /// Sets a callback that is invoked with the status and actual length of every completed
+    /// submission.
+    ///
+    /// The callback runs on whichever thread is handling events for the context, so it should
+    /// return quickly. It must not borrow anything: a transfer that is leaked while in flight
+    /// still completes, and would then call into data that is gone.
+    ///
+    /// # Panics
+    ///
+    /// Panics if the transfer is in flight.
+    pub fn set_callback<F>(&mut self, callback: F)
+    where
+        F: FnMut(TransferStatus, usize) + Send + 'static,
+    {
+        assert!(!self.is_pending(), "transfer is in flight");
+        unsafe { *self.state().callback.get() = Some(Box::new(callback)) };
+    }
+
+    /// Submits the transfer.
+    ///
+    /// A completed transfer can be submitted again, which reuses its buffer.
+    ///
+    /// ## Errors
+    ///
+    /// * `Busy` if the transfer is already in flight.
+    /// * `NoDevice` if the device has been disconnected.
+    /// * `NotSupported` if the transfer flags are not supported by the operating system.
+    /// * `InvalidParam` if the transfer size is larger than the operating system and/or hardware
+    ///   can support.
+    /// * `Interrupted` if the transfer's or the handle's cancellation token is cancelled.
+    pub fn submit(&mut self) -> crate::Result<()> {
+        if self.is_pending() {
+            return Err(Error::Busy);
+        }
+
+        self.state().completed.store(0, Ordering::Relaxed);
+        // Reported before submitting, since the completion may be reported on another thread as
+        // soon as the transfer is in flight.
+        let instruments = &self.state().instruments;
+        let started = if instruments.is_enabled() {
+            let transfer = unsafe { &*self.transfer.as_ptr() };
+            instruments.submitted(instrumented_endpoint(transfer), self.length());
+            let now = Instant::now();
+            unsafe { *self.state().submitted_at.get() = Some(now) };
+            Some(now)
+        } else {
+            None
+        };
+        self.submitted = true;
+
+        let transfer = self.transfer;
+        let submit = || match unsafe { libusb_submit_transfer(transfer.as_ptr()) } {
+            0 => Ok(()),
+            err => Err(error::from_libusb(err)),
+        };
+        let token = &self.token;
+        let result = self
+            .handle
+            .cancellation_token()
+            .submit(transfer, || match token {
+                Some(token) => token.submit(transfer, submit),
+                None => submit(),
+            });
+
+        if let Err(err) = result {
+            self.submitted = false;
+            if let Some(started) = started {
+                // The completion callback never runs for a transfer that was not submitted.
+                unsafe { *self.state().submitted_at.get() = None };
+                let transfer = unsafe { &*self.transfer.as_ptr() };
+                self.state().instruments.completed(
+                    instrumented_endpoint(transfer),
+                    &Err(err),
+                    started.elapsed(),
+                );
+            }
+        }
+        result
+    }
+
+    /// Attaches `token` to the transfer, so that cancelling it cancels the transfer if it is in
+    /// flight and prevents it from being submitted. `None` detaches the current token.
+    ///
+    /// This is in addition to the token of the handle, see
+    /// [`DeviceHandle::cancel_transfers`](struct.DeviceHandle.html#method.cancel_transfers).
+    ///
+    /// # Panics
+    ///
+    /// Panics if the transfer is in flight.
+    pub fn set_cancellation_token(&mut self, token: Option<CancellationToken>) {
+        assert!(!self.is_pending(), "transfer is in flight");
+        if let Some(old) = self.token.take() {
+            old.unregister(self.transfer);
+        }
+        self.token = token;
+    }
+
+    /// Asynchronously cancels the transfer.
+    ///
+    /// The transfer completes with [`TransferStatus::Cancelled`] once libusb has processed the
+    /// cancellation, unless it completed for another reason first.
+    ///
+    /// ## Errors
+    ///
+    /// * `NotFound` if the transfer is not in flight.
+    pub fn cancel(&self) -> crate::Result<()> {
+        if !self.is_pending() {
+            return Err(Error::NotFound);
+        }
+        try_unsafe!(libusb_cancel_transfer(self.transfer.as_ptr()));
+        Ok(())
+    }
+
+    /// Handles events on the handle's context until the transfer completes, then returns its
+    /// result.
+    ///
+    /// If `timeout` is given and expires first, `Err(Timeout)` is returned and the transfer stays
+    /// in flight. Completions of other transfers on the same context are dispatched along the way.
+    ///
+    /// ## Errors
+    ///
+    /// * `NotFound` if the transfer was never submitted.
+    /// * `Timeout` if `timeout` expired before the transfer completed.
+    /// * Any error corresponding to the [`TransferStatus`] of the completed transfer.
+    pub fn wait(&mut self, timeout: Option<Duration>) -> crate::Result<usize> {
+        self.wait_deadline(timeout.map(|t| Instant::now() + t))
+    }
+
+    /// Like [`wait`](#method.wait), but gives up once `deadline` has passed.
+    ///
+    /// A deadline does not move when the call is repeated, for instance in a retry loop.
+    pub fn wait_until(&mut self, deadline: Instant) -> crate::Result<usize> {
+        self.wait_deadline(Some(deadline))
+    }
+
+    fn wait_deadline(&mut self, deadline: Option<Instant>) -> crate::Result<usize> {
+        if !self.submitted {
+            return Err(Error::NotFound);
+        }
+
+        wait_for_completion(
+            self.handle.context().as_raw(),
+            &self.state().completed,
+            deadline,
+        )?;
+
+        self.result().unwrap_or(Err(Error::Other))
+    }
+
+    /// Returns a future that resolves when the submitted transfer completes.
+    ///
+    /// The future only waits to be woken by the completion callback, so events on the context
+    /// have to be handled elsewhere, for instance by an [`EventThread`](struct.EventThread.html)
+    /// or a reactor driving an [`AsyncContext`](struct.AsyncContext.html). It resolves to the
+    /// same result as [`wait`](#method.wait), or to `NotFound` if the transfer was never
+    /// submitted. Dropping the future leaves the transfer in flight.
+    pub fn wait_async(&mut self) -> TransferFuture<'_, 'd, T> {
+        TransferFuture { transfer: self }
+    }
+
+    /// Points an idle bulk or interrupt transfer at `endpoint` again, for reuse with its whole
+    /// buffer. Any callback and cancellation token are removed.
+    pub(crate) fn retarget(&mut self, transfer_type: u8, endpoint: u8, timeout: Duration) {
+        debug_assert!(!self.is_pending() && self.offset == 0 && self.num_iso_packets() == 0);
+        if let Some(token) = self.token.take() {
+            token.unregister(self.transfer);
+        }
+        unsafe {
+            let transfer = self.transfer.as_ptr();
+            (*transfer).flags = 0;
+            (*transfer).endpoint = endpoint;
+            (*transfer).transfer_type = transfer_type;
+            (*transfer).timeout = millis_from_duration(timeout);
+            (*transfer).length = self.buffer.len() as c_int;
+            *self.state().callback.get() = None;
+        }
+        self.submitted = false;
+    }
+
+    /// Cancels the transfer if it is in flight and waits until libusb has released it.
+    pub(crate) fn reap(&mut self) {
+        if self.is_pending() {
+            let _ = self.cancel();
+            while self.is_pending() {
+                let _ = self.wait(None);
+            }
+        }
+    }
+
+    fn state(&self) -> &TransferState {
+        unsafe { self.state.as_ref() }
+    }
+}
+
+/// Future returned by [`Transfer::wait_async`](struct.Transfer.html#method.wait_async).
+pub struct TransferFuture<'t, 'd, T: UsbContext> {
+    transfer: &'t mut Transfer<'d, T>,
+}
+
+impl<'t, 'd, T: UsbContext> Future for TransferFuture<'t, 'd, T> {
+    type Output = crate::Result<usize>;
+
+    fn poll(self: Pin<&mut Self>, cx: &mut Context<'_>) -> Poll<crate::Result<usize>> {
+        let transfer = &*self.get_mut().transfer;
+        if !transfer.submitted {
+            return Poll::Ready(Err(Error::NotFound));
+        }
+
+        if transfer.is_pending() {
+            {
+                let mut waker = transfer.state().waker.lock().unwrap();
+                match *waker {
+                    Some(ref waker) if waker.will_wake(cx.waker()) => {}
+                    _ => *waker = Some(cx.waker().clone()),
+                }
+            }
+            if transfer.is_pending() {
+                return Poll::Pending;
+            }
+        }
+
+        Poll::Ready(transfer.result().unwrap_or(Err(Error::Other)))
+    }
+}
+
+impl<'t, 'd, T: UsbContext> Debug for TransferFuture<'t, 'd, T> {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.debug_struct("TransferFuture")
+            .field("transfer", &*self.transfer)
+            .finish()
+    }
+}
+
+/// Iterator over the packets of an isochronous transfer.
+pub struct IsoPackets<'a> {
+    descriptors: slice::Iter<'a, libusb_iso_packet_descriptor>,
+    buffer: &'a [u8],
+    offset: usize,
+}
+
+impl<'a> Iterator for IsoPackets<'a> {
+    type Item = IsoPacket<'a>;
+
+    fn next(&mut self) -> Option<IsoPacket<'a>> {
+        self.descriptors.next().map(|descriptor| {
+            let start = self.offset;
+            self.offset += descriptor.length as usize;
+            IsoPacket {
+                descriptor,
+                buffer: &self.buffer[start..self.offset],
+            }
+        })
+    }
+
+    fn size_hint(&self) -> (usize, Option<usize>) {
+        self.descriptors.size_hint()
+    }
+}
+
+/// A single packet of an isochronous transfer.
+pub struct IsoPacket<'a> {
+    descriptor: &'a libusb_iso_packet_descriptor,
+    buffer: &'a [u8],
+}
+
+impl<'a> IsoPacket<'a> {
+    /// Returns the number of bytes requested for this packet.
+    pub fn length(&self) -> usize {
+        self.descriptor.length as usize
+    }
+
+    /// Returns the number of bytes actually transferred in this packet.
+    pub fn actual_length(&self) -> usize {
+        self.descriptor.actual_length as usize
+    }
+
+    /// Returns the status of this packet.
+    pub fn status(&self) -> TransferStatus {
+        status_from_libusb(self.descriptor.status)
+    }
+
+    /// Returns the data transferred in this packet.
+    pub fn data(&self) -> &'a [u8] {
+        &self.buffer[..std::cmp::min(self.actual_length(), self.buffer.len())]
+    }
+}
+
+impl<'a> Debug for IsoPacket<'a> {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.debug_struct("IsoPacket")
+            .field("length", &self.length())
+            .field("actual_length", &self.actual_length())
+            .field("status", &self.status())
+            .finish()
+    }
+}
+
+fn checked_length(len: usize) -> crate::Result<c_int> {
+    if len > c_int::MAX as usize {
+        Err(Error::InvalidParam)
+    } else {
+        Ok(len as c_int)
+    }
+}
+
+extern "system" fn transfer_callback(transfer: *mut libusb_transfer) {
+    unsafe {
+        let state = &*((*transfer).user_data as *const TransferState);
+
+        if let Some(callback) = (*state.callback.get()).as_mut() {
+            let status = status_from_libusb((*transfer).status);
+            let len = (*transfer).actual_length as usize;
+            let _ = panic::catch_unwind(AssertUnwindSafe(|| callback(status, len)));
+        }
+
+        if let Some(submitted_at) = *state.submitted_at.get() {
+            report_completion(&state.instruments, &*transfer, submitted_at.elapsed());
+        }
+
+        // The owner may free the transfer as soon as this is observed and the waker lock is
+        // released, so nothing else may be touched afterwards.
+        let waker = {
+            let mut waker = state.waker.lock().unwrap_or_else(|err| err.into_inner());
+            state.completed.store(1, Ordering::Release);
+            waker.take()
+        };
+
+        if let Some(waker) = waker {
+            waker.wake();
+        }
+    }
+}
+
+/// Returns the endpoint `transfer` is reported on. Control transfers are reported by direction,
+/// taken from the setup packet.
+fn instrumented_endpoint(transfer: &libusb_transfer) -> u8 {
+    if transfer.transfer_type == LIBUSB_TRANSFER_TYPE_CONTROL {
+        unsafe { *transfer.buffer & LIBUSB_ENDPOINT_DIR_MASK }
+    } else {
+        transfer.endpoint
+    }
+}
+
+/// Reports the outcome of a completed `transfer` to `instruments`.
+unsafe fn report_completion(
+    instruments: &Instruments,
+    transfer: &libusb_transfer,
+    latency: Duration,
+) {
+    let len = if transfer.num_iso_packets > 0 {
+        slice::from_raw_parts(
+            transfer.iso_packet_desc.as_ptr(),
+            transfer.num_iso_packets as usize,
+        )
+        .iter()
+        .map(|desc| desc.actual_length as usize)
+        .sum()
+    } else {
+        transfer.actual_length as usize
+    };
+
+    let result = status_from_libusb(transfer.status).into_result(len);
+    instruments.completed(instrumented_endpoint(transfer), &result, latency);
+}
+
+#[cfg(test)]
+mod test {
+    use super::{status_from_libusb, TransferStatus};
+    use crate::Error;
+    use libusb1_sys::constants::*;
+
+    #[test]
+    fn it_interprets_transfer_status() {
+        assert_eq!(
+            TransferStatus::Completed,
+            status_from_libusb(LIBUSB_TRANSFER_COMPLETED)
+        );
+        assert_eq!(
+            TransferStatus::Error,
+            status_from_libusb(LIBUSB_TRANSFER_ERROR)
+        );
+        assert_eq!(
+            TransferStatus::TimedOut,
+            status_from_libusb(LIBUSB_TRANSFER_TIMED_OUT)
+        );
+        assert_eq!(
+            TransferStatus::Cancelled,
+            status_from_libusb(LIBUSB_TRANSFER_CANCELLED)
+        );
+        assert_eq!(
+            TransferStatus::Stall,
+            status_from_libusb(LIBUSB_TRANSFER_STALL)
+        );
+        assert_eq!(
+            TransferStatus::NoDevice,
+            status_from_libusb(LIBUSB_TRANSFER_NO_DEVICE)
+        );
+        assert_eq!(
+            TransferStatus::Overflow,
+            status_from_libusb(LIBUSB_TRANSFER_OVERFLOW)
+        );
+        assert_eq!(TransferStatus::Error, status_from_libusb(42));
+    }
+
+    #[test]
+    fn it_converts_status_into_result() {
+        assert_eq!(Ok(42), TransferStatus::Completed.into_result(42));
+        assert_eq!(
+            Err(Error::Timeout),
+            TransferStatus::TimedOut.into_result(42)
+        );
+        assert_eq!(Err(Error::Pipe), TransferStatus::Stall.into_result(0));
+        assert_eq!(
+            Err(Error::Interrupted),
+            TransferStatus::Cancelled.into_result(0)
+        );
+        assert_eq!(
+            Err(Error::NoDevice),
+            TransferStatus::NoDevice.into_result(0)
+        );
+        assert_eq!(
+            Err(Error::Overflow),
+            TransferStatus::Overflow.into_result(0)
+        );
+        assert_eq!(Err(Error::Io), TransferStatus::Error.into_result(0));
+    }
+}
@@ -0,0 +1,223 @@
+use std::{
+    fmt::{self, Debug},
+    mem::ManuallyDrop,
+    ops::{Deref, DerefMut},
+    sync::Mutex,
+    time::Duration,
+};
+
+use libusb1_sys::constants::*;
+
+use crate::{device_handle::DeviceHandle, transfer::Transfer, UsbContext};
+
+/// Allocation counters of a [`TransferPool`].
+#[derive(Debug, Copy, Clone, Default, Eq, PartialEq)]
+pub struct PoolStats {
+    allocated: usize,
+    in_use: usize,
+    high_water: usize,
+    reused: u64,
+}
+
+impl PoolStats {
+    /// Returns the number of transfers allocated by the pool so far.
+    pub fn allocated(&self) -> usize {
+        self.allocated
+    }
+
+    /// Returns the number of transfers currently handed out.
+    pub fn in_use(&self) -> usize {
+        self.in_use
+    }
+
+    /// Returns the largest number of transfers that were handed out at the same time.
+    pub fn high_water(&self) -> usize {
+        self.high_water
+    }
+
+    /// Returns how many times a transfer was served without allocating.
+    pub fn reused(&self) -> u64 {
+        self.reused
+    }
+}
+
+struct PoolInner<'d, T: UsbContext> {
+    free: Vec<Transfer<'d, T>>,
+    stats: PoolStats,
+}
+
+/// A pool of reusable bulk and interrupt transfers for one device handle.
+///
+/// Every transfer in the pool owns a buffer of the same size, allocated with
+/// [`DeviceHandle::alloc_buffer`](struct.DeviceHandle.html#method.alloc_buffer), so it is device
+/// memory where supported and page aligned heap memory otherwise. Transfers handed out by the
+/// pool return to it when dropped, so at a steady rate no `libusb_transfer` or buffer is
+/// allocated per submission.
+pub struct TransferPool<'d, T: UsbContext> {
+    handle: &'d DeviceHandle<T>,
+    buffer_size: usize,
+    inner: Mutex<PoolInner<'d, T>>,
+}
+
+impl<'d, T: UsbContext> TransferPool<'d, T> {
+    /// Creates an empty pool of transfers with `buffer_size` byte buffers.
+    pub fn new(handle: &'d DeviceHandle<T>, buffer_size: usize) -> Self {
+        TransferPool {
+            handle,
+            buffer_size,
+            inner: Mutex::new(PoolInner {
+                free: Vec::new(),
+                stats: PoolStats::default(),
+            }),
+        }
+    }
+
+    /// Creates a pool of transfers with `buffer_size` byte buffers and allocates `count` of them
+    /// up front.
+    pub fn with_capacity(
+        handle: &'d DeviceHandle<T>,
+        buffer_size: usize,
+        count: usize,
+    ) -> crate::Result<Self> {
+        let pool = Self::new(handle, buffer_size);
+        {
+            let mut inner = pool.inner.lock().unwrap();
+            for _ in 0..count {
+                let transfer = pool.allocate()?;
+                inner.free.push(transfer);
+                inner.stats.allocated += 1;
+            }
+        }
+        Ok(pool)
+    }
+
+    /// Returns the size of the buffer of every transfer in the pool.
+    pub fn buffer_size(&self) -> usize {
+        self.buffer_size
+    }
+
+    /// Returns the allocation counters of the pool.
+    pub fn stats(&self) -> PoolStats {
+        self.inner.lock().unwrap().stats
+    }
+
+    /// Takes a bulk transfer on `endpoint` from the pool, allocating one if the pool is empty.
+    ///
+    /// The transfer covers the whole buffer and is not submitted.
+    pub fn bulk(
+        &self,
+        endpoint: u8,
+        timeout: Duration,
+    ) -> crate::Result<PooledTransfer<'_, 'd, T>> {
+        self.take(LIBUSB_TRANSFER_TYPE_BULK, endpoint, timeout)
+    }
+
+    /// Takes an interrupt transfer on `endpoint` from the pool, allocating one if the pool is
+    /// empty.
+    ///
+    /// The transfer covers the whole buffer and is not submitted.
+    pub fn interrupt(
+        &self,
+        endpoint: u8,
+        timeout: Duration,
+    ) -> crate::Result<PooledTransfer<'_, 'd, T>> {
+        self.take(LIBUSB_TRANSFER_TYPE_INTERRUPT, endpoint, timeout)
+    }
+
+    fn take(
+        &self,
+        transfer_type: u8,
+        endpoint: u8,
+        timeout: Duration,
+    ) -> crate::Result<PooledTransfer<'_, 'd, T>> {
+        let reused = {
+            let mut inner = self.inner.lock().unwrap();
+            let transfer = inner.free.pop();
+            if transfer.is_some() {
+                inner.stats.reused += 1;
+                inner.stats.in_use += 1;
+                inner.stats.high_water = inner.stats.high_water.max(inner.stats.in_use);
+            }
+            transfer
+        };
+
+        let mut transfer = match reused {
+            Some(transfer) => transfer,
+            None => {
+                let transfer = self.allocate()?;
+                let mut inner = self.inner.lock().unwrap();
+                inner.stats.allocated += 1;
+                inner.stats.in_use += 1;
+                inner.stats.high_water = inner.stats.high_water.max(inner.stats.in_use);
+                transfer
+            }
+        };
+        transfer.retarget(transfer_type, endpoint, timeout);
+
+        Ok(PooledTransfer {
+            pool: self,
+            transfer: ManuallyDrop::new(transfer),
+        })
+    }
+
+    fn allocate(&self) -> crate::Result<Transfer<'d, T>> {
+        Transfer::bulk(
+            self.handle,
+            0,
+            self.handle.alloc_buffer(self.buffer_size)?,
+            Duration::from_secs(0),
+        )
+    }
+
+    fn put(&self, transfer: Transfer<'d, T>) {
+        let mut inner = self.inner.lock().unwrap();
+        inner.stats.in_use -= 1;
+        inner.free.push(transfer);
+    }
+}
+
+impl<'d, T: UsbContext> Debug for TransferPool<'d, T> {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.debug_struct("TransferPool")
+            .field("buffer_size", &self.buffer_size)
+            .field("stats", &self.stats())
+            .finish()
+    }
+}
+
+/// A transfer borrowed from a [`TransferPool`].
+///
+/// It dereferences to the underlying [`Transfer`](struct.Transfer.html). When dropped, a transfer
+/// still in flight is cancelled, and the transfer is returned to the pool.
+pub struct PooledTransfer<'p, 'd, T: UsbContext> {
+    pool: &'p TransferPool<'d, T>,
+    transfer: ManuallyDrop<Transfer<'d, T>>,
+}
+
+impl<'p, 'd, T: UsbContext> Drop for PooledTransfer<'p, 'd, T> {
+    fn drop(&mut self) {
+        let mut transfer = unsafe { ManuallyDrop::take(&mut self.transfer) };
+        transfer.reap();
+        self.pool.put(transfer);
+    }
+}
+
+impl<'p, 'd, T: UsbContext> Deref for PooledTransfer<'p, 'd, T> {
+    type Target = Transfer<'d, T>;
+
+    fn deref(&self) -> &Transfer<'d, T> {
+        &self.transfer
+    }
+}
+
+impl<'p, 'd, T: UsbContext> DerefMut for PooledTransfer<'p, 'd, T> {
+    fn deref_mut(&mut self) -> &mut Transfer<'d, T> {
+        &mut self.transfer
+    }
+}
+
+impl<'p, 'd, T: UsbContext> Debug for PooledTransfer<'p, 'd, T> {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        Debug::fmt(&*self.transfer, f)
+    }
+}
@@ -0,0 +1,555 @@
+use std::{
+    fmt::{self, Debug},
+    ptr,
+    sync::{
+        atomic::{AtomicPtr, AtomicU64, Ordering},
+        Arc,
+    },
+    time::Duration,
+};
+
+use crate::error::Error;
+
+/// Number of linear sub-buckets per power of two. Bucket boundaries are exact up to 16µs, and
+/// within 1/16 of the value above.
+const SUB_BUCKET_BITS: u32 = 4;
+const SUB_BUCKETS: usize = 1 << SUB_BUCKET_BITS;
+
+/// Latencies are recorded in microseconds up to 2^36µs, about 19 hours; longer ones are clamped.
+const MAX_EXPONENT: u32 = 36;
+const MAX_MICROS: u64 = (1 << MAX_EXPONENT) - 1;
+const BUCKETS: usize = SUB_BUCKETS * (MAX_EXPONENT - SUB_BUCKET_BITS + 1) as usize;
+
+/// Number of distinct endpoint addresses: 16 endpoint numbers in two directions.
+const ENDPOINTS: usize = 32;
+
+/// Returns the histogram bucket holding `micros`.
+fn bucket_index(micros: u64) -> usize {
+    let micros = micros.min(MAX_MICROS);
+    if micros < SUB_BUCKETS as u64 {
+        return micros as usize;
+    }
+
+    let exponent = 63 - micros.leading_zeros();
+    let shift = exponent - SUB_BUCKET_BITS;
+    let sub_bucket = (micros >> shift) as usize - SUB_BUCKETS;
+    SUB_BUCKETS * (shift as usize + 1) + sub_bucket
+}
+
+/// Returns the smallest value held by bucket `index`.
+fn bucket_lower_bound(index: usize) -> u64 {
+    if index < SUB_BUCKETS {
+        return index as u64;
+    }
+
+    let shift = index / SUB_BUCKETS - 1;
+    let sub_bucket = index % SUB_BUCKETS;
+    ((SUB_BUCKETS + sub_bucket) as u64) << shift
+}
+
+/// Returns the largest value held by bucket `index`.
+fn bucket_upper_bound(index: usize) -> u64 {
+    if index + 1 < BUCKETS {
+        bucket_lower_bound(index + 1) - 1
+    } else {
+        MAX_MICROS
+    }
+}
+
+/// A histogram of transfer latencies with logarithmic buckets.
+///
+/// Like an HDR histogram, buckets double in width with every power of two and are split into 16
+/// linear sub-buckets, so every recorded latency is known to within about 6% while the whole
+/// range from 1µs to hours fits in a few kilobytes. Recording never locks.
+pub struct LatencyHistogram {
+    buckets: Box<[AtomicU64]>,
+    sum: AtomicU64,
+    max: AtomicU64,
+}
+
+impl LatencyHistogram {
+    fn new() -> Self {
+        LatencyHistogram {
+            buckets: (0..BUCKETS).map(|_| AtomicU64::new(0)).collect(),
+            sum: AtomicU64::new(0),
+            max: AtomicU64::new(0),
+        }
+    }
+
+    fn record(&self, latency: Duration) {
+        let micros = latency.as_micros().min(u128::from(MAX_MICROS)) as u64;
+        self.buckets[bucket_index(micros)].fetch_add(1, Ordering::Relaxed);
+        self.sum.fetch_add(micros, Ordering::Relaxed);
+        self.max.fetch_max(micros, Ordering::Relaxed);
+    }
+
+    fn reset(&self) {
+        for bucket in self.buckets.iter() {
+            bucket.store(0, Ordering::Relaxed);
+        }
+        self.sum.store(0, Ordering::Relaxed);
+        self.max.store(0, Ordering::Relaxed);
+    }
+
+    /// Returns the number of recorded latencies.
+    pub fn count(&self) -> u64 {
+        self.buckets
+            .iter()
+            .map(|bucket| bucket.load(Ordering::Relaxed))
+            .sum()
+    }
+
+    /// Returns the mean recorded latency, or zero if none was recorded.
+    pub fn mean(&self) -> Duration {
+        match self.count() {
+            0 => Duration::from_micros(0),
+            count => Duration::from_micros(self.sum.load(Ordering::Relaxed) / count),
+        }
+    }
+
+    /// Returns the largest recorded latency.
+    pub fn max(&self) -> Duration {
+        Duration::from_micros(self.max.load(Ordering::Relaxed))
+    }
+
+    /// Returns the latency below which the fraction `quantile` of recorded latencies lie, for
+    /// instance 0.99 for the 99th percentile.
+    ///
+    /// The result is the upper bound of the bucket holding that latency. Zero is returned if no
+    /// latency was recorded.
+    pub fn value_at_quantile(&self, quantile: f64) -> Duration {
+        let count = self.count();
+        if count == 0 {
+            return Duration::from_micros(0);
+        }
+
+        let rank = ((quantile.clamp(0.0, 1.0) * count as f64).ceil() as u64).max(1);
+        let mut seen = 0;
+        for (index, bucket) in self.buckets.iter().enumerate() {
+            seen += bucket.load(Ordering::Relaxed);
+            if seen >= rank {
+                let micros = bucket_upper_bound(index).min(self.max.load(Ordering::Relaxed));
+                return Duration::from_micros(micros);
+            }
+        }
+        self.max()
+    }
+
+    /// Returns the non-empty buckets as the largest latency each holds and its count, in
+    /// increasing order of latency.
+    pub fn buckets(&self) -> impl Iterator<Item = (Duration, u64)> + '_ {
+        self.buckets
+            .iter()
+            .enumerate()
+            .filter_map(|(index, bucket)| match bucket.load(Ordering::Relaxed) {
+                0 => None,
+                count => Some((Duration::from_micros(bucket_upper_bound(index)), count)),
+            })
+    }
+}
+
+impl Debug for LatencyHistogram {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.debug_struct("LatencyHistogram")
+            .field("count", &self.count())
+            .field("mean", &self.mean())
+            .field("p50", &self.value_at_quantile(0.5))
+            .field("p99", &self.value_at_quantile(0.99))
+            .field("max", &self.max())
+            .finish()
+    }
+}
+
+/// Transfer counters of one endpoint.
+pub struct EndpointStats {
+    transfers: AtomicU64,
+    bytes: AtomicU64,
+    timeouts: AtomicU64,
+    stalls: AtomicU64,
+    overflows: AtomicU64,
+    cancelled: AtomicU64,
+    errors: AtomicU64,
+    latency: LatencyHistogram,
+}
+
+impl EndpointStats {
+    fn new() -> Self {
+        EndpointStats {
+            transfers: AtomicU64::new(0),
+            bytes: AtomicU64::new(0),
+            timeouts: AtomicU64::new(0),
+            stalls: AtomicU64::new(0),
+            overflows: AtomicU64::new(0),
+            cancelled: AtomicU64::new(0),
+            errors: AtomicU64::new(0),
+            latency: LatencyHistogram::new(),
+        }
+    }
+
+    fn record(&self, result: &crate::Result<usize>, latency: Duration) {
+        let counter = match *result {
+            Ok(len) => {
+                self.bytes.fetch_add(len as u64, Ordering::Relaxed);
+                &self.transfers
+            }
+            Err(Error::Timeout) => &self.timeouts,
+            Err(Error::Pipe) => &self.stalls,
+            Err(Error::Overflow) => &self.overflows,
+            Err(Error::Interrupted) => &self.cancelled,
+            Err(_) => &self.errors,
+        };
+        counter.fetch_add(1, Ordering::Relaxed);
+        self.latency.record(latency);
+    }
+
+    fn reset(&self) {
+        for counter in &[
+            &self.transfers,
+            &self.bytes,
+            &self.timeouts,
+            &self.stalls,
+            &self.overflows,
+            &self.cancelled,
+            &self.errors,
+        ] {
+            counter.store(0, Ordering::Relaxed);
+        }
+        self.latency.reset();
+    }
+
+    /// Returns the number of transfers that completed successfully.
+    pub fn transfers(&self) -> u64 {
+        self.transfers.load(Ordering::Relaxed)
+    }
+
+    /// Returns the number of bytes moved by successful transfers.
+    pub fn bytes(&self) -> u64 {
+        self.bytes.load(Ordering::Relaxed)
+    }
+
+    /// Returns the number of transfers that timed out. Synchronous bulk transfers which moved
+    /// some data before timing out count as successful, as they return `Ok`.
+    pub fn timeouts(&self) -> u64 {
+        self.timeouts.load(Ordering::Relaxed)
+    }
+
+    /// Returns the number of transfers that failed because the endpoint halted, or because the
+    /// device did not support a control request.
+    pub fn stalls(&self) -> u64 {
+        self.stalls.load(Ordering::Relaxed)
+    }
+
+    /// Returns the number of transfers for which the device sent more data than requested.
+    pub fn overflows(&self) -> u64 {
+        self.overflows.load(Ordering::Relaxed)
+    }
+
+    /// Returns the number of transfers that were cancelled or interrupted.
+    pub fn cancelled(&self) -> u64 {
+        self.cancelled.load(Ordering::Relaxed)
+    }
+
+    /// Returns the number of transfers that failed for any other reason.
+    pub fn errors(&self) -> u64 {
+        self.errors.load(Ordering::Relaxed)
+    }
+
+    /// Returns the histogram of latencies from submission to completion, over all outcomes.
+    pub fn latency(&self) -> &LatencyHistogram {
+        &self.latency
+    }
+}
+
+impl Debug for EndpointStats {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.debug_struct("EndpointStats")
+            .field("transfers", &self.transfers())
+            .field("bytes", &self.bytes())
+            .field("timeouts", &self.timeouts())
+            .field("stalls", &self.stalls())
+            .field("overflows", &self.overflows())
+            .field("cancelled", &self.cancelled())
+            .field("errors", &self.errors())
+            .field("latency", &self.latency)
+            .finish()
+    }
+}
+
+/// Per endpoint transfer statistics of a device handle.
+///
+/// Statistics are collected once enabled with
+/// [`DeviceHandle::enable_stats`](struct.DeviceHandle.html#method.enable_stats), for the
+/// synchronous transfer methods of the handle and for [`Transfer`](struct.Transfer.html)s created
+/// afterwards. All counters are atomic, so they can be read from another thread, for instance to
+/// export them to a metrics system, while transfers are running. Control transfers are counted
+/// under endpoint `0x00` or `0x80`, depending on their direction.
+pub struct TransferStats {
+    // Allocated on first use, indexed by `endpoint_index`.
+    endpoints: [AtomicPtr<EndpointStats>; ENDPOINTS],
+}
+
+unsafe impl Send for TransferStats {}
+unsafe impl Sync for TransferStats {}
+
+impl Drop for TransferStats {
+    fn drop(&mut self) {
+        for endpoint in self.endpoints.iter_mut() {
+            let stats = *endpoint.get_mut();
+            if !stats.is_null() {
+                unsafe { drop(Box::from_raw(stats)) };
+            }
+        }
+    }
+}
+
+/// Returns the slot of the endpoint with address `endpoint`.
+fn endpoint_index(endpoint: u8) -> usize {
+    (endpoint & 0x0f) as usize | ((endpoint & 0x80) >> 3) as usize
+}
+
+/// Returns the endpoint address of slot `index`.
+fn endpoint_address(index: usize) -> u8 {
+    (index & 0x0f) as u8 | ((index & 0x10) << 3) as u8
+}
+
+impl TransferStats {
+    pub(crate) fn new() -> Self {
+        TransferStats {
+            endpoints: Default::default(),
+        }
+    }
+
+    /// Returns the statistics of the endpoint with address `endpoint`, if any transfer on it was
+    /// recorded.
+    pub fn endpoint(&self, endpoint: u8) -> Option<&EndpointStats> {
+        let stats = self.endpoints[endpoint_index(endpoint)].load(Ordering::Acquire);
+        unsafe { stats.as_ref() }
+    }
+
+    /// Returns the address and statistics of every endpoint with recorded transfers.
+    pub fn endpoints(&self) -> impl Iterator<Item = (u8, &EndpointStats)> {
+        (0..ENDPOINTS).filter_map(move |index| {
+            let stats = self.endpoints[index].load(Ordering::Acquire);
+            unsafe { stats.as_ref() }.map(|stats| (endpoint_address(index), stats))
+        })
+    }
+
+    /// Resets all counters and histograms to zero.
+    ///
+    /// Transfers completing concurrently may be counted either before or after the reset.
+    pub fn reset(&self) {
+        for (_, stats) in self.endpoints() {
+            stats.reset();
+        }
+    }
+
+    /// Records a transfer on `endpoint` that finished with `result` after `latency`.
+    pub(crate) fn record(&self, endpoint: u8, result: &crate::Result<usize>, latency: Duration) {
+        self.endpoint_or_insert(endpoint).record(result, latency);
+    }
+
+    fn endpoint_or_insert(&self, endpoint: u8) -> &EndpointStats {
+        let slot = &self.endpoints[endpoint_index(endpoint)];
+        let stats = slot.load(Ordering::Acquire);
+        if let Some(stats) = unsafe { stats.as_ref() } {
+            return stats;
+        }
+
+        let new = Box::into_raw(Box::new(EndpointStats::new()));
+        match slot.compare_exchange(ptr::null_mut(), new, Ordering::AcqRel, Ordering::Acquire) {
+            Ok(_) => unsafe { &*new },
+            Err(existing) => unsafe {
+                drop(Box::from_raw(new));
+                &*existing
+            },
+        }
+    }
+}
+
+impl Debug for TransferStats {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        let mut map = f.debug_map();
+        for (endpoint, stats) in self.endpoints() {
+            map.entry(&format_args!("{:#04x}", endpoint), stats);
+        }
+        map.finish()
+    }
+}
+
+/// Hooks called around every transfer on a device handle, for instance to open and close
+/// tracing spans or to correlate USB stalls with latency spikes elsewhere in an application.
+///
+/// A hook is installed with
+/// [`DeviceHandle::set_transfer_hook`](struct.DeviceHandle.html#method.set_transfer_hook).
+/// Control transfers are reported on endpoint `0x00` or `0x80`, depending on their direction.
+/// The hooks of asynchronous transfers run on the thread handling events when they complete,
+/// so they should return quickly.
+pub trait TransferHook: Send + Sync {
+    /// Called right before a transfer of `len` bytes on `endpoint` is submitted.
+    fn submitted(&self, endpoint: u8, len: usize) {
+        let _ = (endpoint, len);
+    }
+
+    /// Called when a transfer on `endpoint` finished with `result`, `latency` after it was
+    /// submitted.
+    fn completed(&self, endpoint: u8, result: &crate::Result<usize>, latency: Duration);
+}
+
+/// The statistics and hook of a device handle, shared with its transfers.
+#[derive(Clone, Default)]
+pub(crate) struct Instruments {
+    pub(crate) stats: Option<Arc<TransferStats>>,
+    pub(crate) hook: Option<Arc<dyn TransferHook>>,
+}
+
+impl Instruments {
+    /// Returns true if transfers have to be timed.
+    pub(crate) fn is_enabled(&self) -> bool {
+        self.stats.is_some() || self.hook.is_some()
+    }
+
+    pub(crate) fn submitted(&self, endpoint: u8, len: usize) {
+        if let Some(ref hook) = self.hook {
+            hook.submitted(endpoint, len);
+        }
+    }
+
+    pub(crate) fn completed(&self, endpoint: u8, result: &crate::Result<usize>, latency: Duration) {
+        if let Some(ref stats) = self.stats {
+            stats.record(endpoint, result, latency);
+        }
+        if let Some(ref hook) = self.hook {
+            hook.completed(endpoint, result, latency);
+        }
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    #[test]
+    fn it_buckets_small_latencies_exactly() {
+        for micros in 0..SUB_BUCKETS as u64 {
+            let index = bucket_index(micros);
+            assert_eq!(micros, bucket_lower_bound(index));
+            assert_eq!(micros, bucket_upper_bound(index));
+        }
+    }
+
+    #[test]
+    fn it_buckets_large_latencies_within_precision() {
+        for &micros in &[16, 17, 31, 32, 100, 1000, 12345, 1_000_000, MAX_MICROS] {
+            let index = bucket_index(micros);
+            let lower = bucket_lower_bound(index);
+            let upper = bucket_upper_bound(index);
+
+            assert!(index < BUCKETS);
+            assert!(
+                lower <= micros && micros <= upper,
+                "{} in {}..={}",
+                micros,
+                lower,
+                upper
+            );
+            assert!(upper - lower <= micros / SUB_BUCKETS as u64);
+        }
+        assert_eq!(BUCKETS - 1, bucket_index(u64::MAX));
+    }
+
+    #[test]
+    fn it_computes_quantiles() {
+        let histogram = LatencyHistogram::new();
+        for micros in 1..=100 {
+            histogram.record(Duration::from_micros(micros));
+        }
+
+        assert_eq!(100, histogram.count());
+        assert_eq!(Duration::from_micros(50), histogram.mean());
+        assert_eq!(Duration::from_micros(100), histogram.max());
+        assert_eq!(Duration::from_micros(1), histogram.value_at_quantile(0.0));
+
+        let median = histogram.value_at_quantile(0.5).as_micros();
+        assert!((50..=53).contains(&median), "median {}", median);
+        assert_eq!(Duration::from_micros(100), histogram.value_at_quantile(1.0));
+        assert_eq!(
+            100,
+            histogram.buckets().map(|(_, count)| count).sum::<u64>()
+        );
+    }
+
+    #[test]
+    fn it_classifies_transfer_results() {
+        let stats = TransferStats::new();
+        let latency = Duration::from_micros(125);
+        stats.record(0x81, &Ok(512), latency);
+        stats.record(0x81, &Ok(64), latency);
+        stats.record(0x81, &Err(Error::Timeout), latency);
+        stats.record(0x81, &Err(Error::Pipe), latency);
+        stats.record(0x81, &Err(Error::Overflow), latency);
+        stats.record(0x81, &Err(Error::NoDevice), latency);
+        stats.record(0x02, &Err(Error::Interrupted), latency);
+
+        let ep = stats.endpoint(0x81).unwrap();
+        assert_eq!(2, ep.transfers());
+        assert_eq!(576, ep.bytes());
+        assert_eq!(1, ep.timeouts());
+        assert_eq!(1, ep.stalls());
+        assert_eq!(1, ep.overflows());
+        assert_eq!(1, ep.errors());
+        assert_eq!(6, ep.latency().count());
+        assert_eq!(1, stats.endpoint(0x02).unwrap().cancelled());
+        assert!(stats.endpoint(0x01).is_none());
+
+        let endpoints = stats.endpoints().map(|(ep, _)| ep).collect::<Vec<_>>();
+        assert_eq!(vec![0x02, 0x81], endpoints);
+
+        stats.reset();
+        assert_eq!(0, stats.endpoint(0x81).unwrap().bytes());
+        assert_eq!(0, stats.endpoint(0x81).unwrap().latency().count());
+    }
+
+    #[test]
+    fn it_reports_to_stats_and_hook() {
+        use std::sync::Mutex;
+
+        #[derive(Default)]
+        struct Recorder(Mutex<Vec<(u8, usize, bool)>>);
+
+        impl TransferHook for Recorder {
+            fn submitted(&self, endpoint: u8, len: usize) {
+                self.0.lock().unwrap().push((endpoint, len, false));
+            }
+
+            fn completed(&self, endpoint: u8, result: &crate::Result<usize>, _: Duration) {
+                let len = *result.as_ref().unwrap_or(&0);
+                self.0.lock().unwrap().push((endpoint, len, true));
+            }
+        }
+
+        let mut instruments = Instruments::default();
+        assert!(!instruments.is_enabled());
+
+        let recorder = Arc::new(Recorder::default());
+        instruments.hook = Some(recorder.clone());
+        instruments.stats = Some(Arc::new(TransferStats::new()));
+        assert!(instruments.is_enabled());
+
+        instruments.submitted(0x81, 64);
+        instruments.completed(0x81, &Ok(12), Duration::from_micros(10));
+
+        assert_eq!(
+            vec![(0x81, 64, false), (0x81, 12, true)],
+            *recorder.0.lock().unwrap()
+        );
+        let stats = instruments.stats.unwrap();
+        assert_eq!(12, stats.endpoint(0x81).unwrap().bytes());
+    }
+
+    #[test]
+    fn it_maps_endpoint_addresses_to_slots() {
+        for &endpoint in &[0x00, 0x0f, 0x80, 0x8f, 0x01, 0x81] {
+            assert_eq!(endpoint, endpoint_address(endpoint_index(endpoint)));
+        }
+    }
+}
@@ -0,0 +1,478 @@
+use std::{
+    io::{IoSlice, IoSliceMut},
+    marker::PhantomData,
+    ptr::NonNull,
+    sync::atomic::{AtomicI32, Ordering},
+    time::Duration,
+};
+
+use libc::{c_int, c_uchar, c_void};
+use libusb1_sys::{constants::*, *};
+
+use crate::{
+    context::{millis_from_duration, wait_for_completion},
+    error::{self, Error},
+};
+
+/// A contiguous piece of a vectored transfer.
+#[derive(Debug, Eq, PartialEq)]
+enum Segment {
+    /// `len` bytes starting `offset` bytes into slice `slice`, transferred in place.
+    InPlace {
+        slice: usize,
+        offset: usize,
+        len: usize,
+    },
+
+    /// `len` bytes starting `start` bytes into the concatenation of the slices, which span
+    /// several of them and are gathered into scratch memory.
+    Gathered { start: usize, len: usize },
+}
+
+impl Segment {
+    fn len(&self) -> usize {
+        match *self {
+            Segment::InPlace { len, .. } | Segment::Gathered { len, .. } => len,
+        }
+    }
+}
+
+/// Splits the concatenation of slices of the given `lengths` into segments that can be
+/// transferred one after the other without changing what goes over the wire.
+///
+/// Every segment but the last is a multiple of `max_packet_size` long, so none of them ends in a
+/// short packet that the concatenated data would not have. Data is only gathered around slice
+/// boundaries that do not fall on a packet boundary, less than two packets per slice.
+fn plan<I>(lengths: I, max_packet_size: usize) -> Vec<Segment>
+where
+    I: IntoIterator<Item = usize>,
+{
+    let mut segments = Vec::new();
+    let mut position = 0;
+    // Data waiting to be gathered, as a range of the concatenation.
+    let mut start = 0;
+    let mut gathered = 0;
+
+    for (slice, len) in lengths.into_iter().enumerate() {
+        // Complete the packet started by earlier slices.
+        let offset = match gathered % max_packet_size {
+            0 => 0,
+            partial => (max_packet_size - partial).min(len),
+        };
+        gathered += offset;
+
+        let aligned = (len - offset) / max_packet_size * max_packet_size;
+        if aligned > 0 {
+            if gathered > 0 {
+                segments.push(Segment::Gathered {
+                    start,
+                    len: gathered,
+                });
+                gathered = 0;
+            }
+            segments.push(Segment::InPlace {
+                slice,
+                offset,
+                len: aligned,
+            });
+        }
+        if gathered == 0 {
+            start = position + offset + aligned;
+        }
+        gathered += len - offset - aligned;
+        position += len;
+    }
+
+    if gathered > 0 {
+        segments.push(Segment::Gathered {
+            start,
+            len: gathered,
+        });
+    }
+    segments
+}
+
+/// Copies `data.len()` bytes starting `offset` bytes into the concatenation of `bufs` to `data`.
+fn gather(bufs: &[IoSlice<'_>], mut offset: usize, mut data: &mut [u8]) {
+    for buf in bufs {
+        if data.is_empty() {
+            break;
+        }
+        if offset >= buf.len() {
+            offset -= buf.len();
+            continue;
+        }
+
+        let n = (buf.len() - offset).min(data.len());
+        let (head, tail) = data.split_at_mut(n);
+        head.copy_from_slice(&buf[offset..offset + n]);
+        data = tail;
+        offset = 0;
+    }
+}
+
+/// Bulk transfers over caller memory, which are cancelled and reaped when dropped.
+struct RawTransfers<'a> {
+    context: *mut libusb_context,
+    transfers: Vec<NonNull<libusb_transfer>>,
+    // Completion flags, set by `transfer_callback` through `user_data`.
+    completed: Box<[AtomicI32]>,
+    submitted: usize,
+    _data: PhantomData<&'a [u8]>,
+}
+
+impl<'a> Drop for RawTransfers<'a> {
+    fn drop(&mut self) {
+        for i in 0..self.submitted {
+            if self.completed[i].load(Ordering::Acquire) == 0 {
+                unsafe { libusb_cancel_transfer(self.transfers[i].as_ptr()) };
+            }
+        }
+        for i in 0..self.submitted {
+            while wait_for_completion(self.context, &self.completed[i], None).is_err() {}
+        }
+        for transfer in self.transfers.iter() {
+            unsafe { libusb_free_transfer(transfer.as_ptr()) };
+        }
+    }
+}
+
+impl<'a> RawTransfers<'a> {
+    fn new(context: *mut libusb_context, count: usize) -> crate::Result<Self> {
+        let mut transfers = RawTransfers {
+            context,
+            transfers: Vec::with_capacity(count),
+            completed: (0..count).map(|_| AtomicI32::new(0)).collect(),
+            submitted: 0,
+            _data: PhantomData,
+        };
+        for _ in 0..count {
+            let transfer = NonNull::new(unsafe { libusb_alloc_transfer(0) }).ok_or(Error::NoMem)?;
+            transfers.transfers.push(transfer);
+        }
+        Ok(transfers)
+    }
+
+    /// Fills transfer `i` to move `len` bytes at `data` and submits it.
+    ///
+    /// # Safety
+    ///
+    /// The memory must stay valid for `'a`.
+    unsafe fn submit(
+        &mut self,
+        i: usize,
+        handle: *mut libusb_device_handle,
+        endpoint: u8,
+        data: *mut u8,
+        len: usize,
+        flags: u8,
+        timeout: Duration,
+    ) -> crate::Result<()> {
+        let transfer = self.transfers[i].as_ptr();
+        libusb_fill_bulk_transfer(
+            transfer,
+            handle,
+            endpoint,
+            data as *mut c_uchar,
+            len as c_int,
+            transfer_callback,
+            &self.completed[i] as *const AtomicI32 as *mut c_void,
+            millis_from_duration(timeout),
+        );
+        (*transfer).flags = flags;
+
+        match libusb_submit_transfer(transfer) {
+            0 => {
+                self.submitted += 1;
+                Ok(())
+            }
+            err => Err(error::from_libusb(err)),
+        }
+    }
+
+    /// Waits for all submitted transfers in order, returning the bytes moved before the first
+    /// failure, or the failure if nothing was moved.
+    fn wait(&mut self) -> crate::Result<usize> {
+        let mut moved = 0;
+        for i in 0..self.submitted {
+            wait_for_completion(self.context, &self.completed[i], None)?;
+
+            let transfer = unsafe { &*self.transfers[i].as_ptr() };
+            moved += transfer.actual_length as usize;
+            if transfer.status != LIBUSB_TRANSFER_COMPLETED {
+                let err = crate::transfer::status_from_libusb(transfer.status)
+                    .into_result(0)
+                    .unwrap_err();
+                return if moved > 0 { Ok(moved) } else { Err(err) };
+            }
+        }
+        Ok(moved)
+    }
+}
+
+extern "system" fn transfer_callback(transfer: *mut libusb_transfer) {
+    unsafe {
+        let completed = &*((*transfer).user_data as *const AtomicI32);
+        completed.store(1, Ordering::Release);
+    }
+}
+
+/// Writes the concatenation of `bufs` to a bulk OUT endpoint, submitting its segments back to
+/// back.
+pub(crate) fn write_bulk(
+    context: *mut libusb_context,
+    handle: *mut libusb_device_handle,
+    endpoint: u8,
+    max_packet_size: usize,
+    bufs: &[IoSlice<'_>],
+    zero_packet: bool,
+    timeout: Duration,
+) -> crate::Result<usize> {
+    let mut segments = plan(bufs.iter().map(|buf| buf.len()), max_packet_size.max(1));
+    if segments.is_empty() {
+        segments.push(Segment::Gathered { start: 0, len: 0 });
+    }
+
+    let mut scratch = segments
+        .iter()
+        .map(|segment| match *segment {
+            Segment::InPlace { .. } => Vec::new(),
+            Segment::Gathered { start, len } => {
+                let mut data = vec![0; len];
+                gather(bufs, start, &mut data);
+                data
+            }
+        })
+        .collect::<Vec<_>>();
+
+    // Declared after the data, so that it is dropped, reaping the transfers, first.
+    let mut transfers = RawTransfers::new(context, segments.len())?;
+    let last = segments.len() - 1;
+    for (i, segment) in segments.iter().enumerate() {
+        let data = match *segment {
+            Segment::InPlace { slice, offset, .. } => bufs[slice][offset..].as_ptr() as *mut u8,
+            Segment::Gathered { .. } => scratch[i].as_mut_ptr(),
+        };
+        let flags = if zero_packet && i == last {
+            LIBUSB_TRANSFER_ADD_ZERO_PACKET
+        } else {
+            0
+        };
+
+        let result =
+            unsafe { transfers.submit(i, handle, endpoint, data, segment.len(), flags, timeout) };
+        if let Err(err) = result {
+            if i == 0 {
+                return Err(err);
+            }
+            // Report what the segments already submitted move.
+            break;
+        }
+    }
+
+    transfers.wait()
+}
+
+/// Reads from a bulk IN endpoint into `bufs` in order, until a short packet ends the transfer.
+///
+/// Segments are read one at a time: had the next one been submitted already, it would receive
+/// data following a short packet, which belongs to the next transfer.
+pub(crate) fn read_bulk(
+    handle: *mut libusb_device_handle,
+    endpoint: u8,
+    max_packet_size: usize,
+    bufs: &mut [IoSliceMut<'_>],
+    timeout: Duration,
+) -> crate::Result<usize> {
+    let segments = plan(bufs.iter().map(|buf| buf.len()), max_packet_size.max(1));
+
+    let mut read = 0;
+    for segment in segments {
+        let len = segment.len();
+        let result = match segment {
+            Segment::InPlace { slice, offset, .. } => unsafe {
+                let data = bufs[slice][offset..].as_mut_ptr();
+                bulk_transfer(handle, endpoint, data, len, timeout)
+            },
+            Segment::Gathered { start, .. } => {
+                let mut scratch = vec![0; len];
+                let result =
+                    unsafe { bulk_transfer(handle, endpoint, scratch.as_mut_ptr(), len, timeout) };
+                if let Ok(n) = result {
+                    scatter(bufs, start, &scratch[..n]);
+                }
+                result
+            }
+        };
+
+        match result {
+            Ok(n) => {
+                read += n;
+                if n < len {
+                    break;
+                }
+            }
+            Err(_) if read > 0 => break,
+            Err(err) => return Err(err),
+        }
+    }
+    Ok(read)
+}
+
+/// Performs one synchronous bulk transfer, keeping data moved before a timeout.
+unsafe fn bulk_transfer(
+    handle: *mut libusb_device_handle,
+    endpoint: u8,
+    data: *mut u8,
+    len: usize,
+    timeout: Duration,
+) -> crate::Result<usize> {
+    let mut transferred: c_int = 0;
+    match libusb_bulk_transfer(
+        handle,
+        endpoint,
+        data as *mut c_uchar,
+        len as c_int,
+        &mut transferred,
+        millis_from_duration(timeout),
+    ) {
+        0 => Ok(transferred as usize),
+        err if (err == LIBUSB_ERROR_INTERRUPTED || err == LIBUSB_ERROR_TIMEOUT)
+            && transferred > 0 =>
+        {
+            Ok(transferred as usize)
+        }
+        err => Err(error::from_libusb(err)),
+    }
+}
+
+/// Copies `data` into `bufs`, starting `offset` bytes into their concatenation.
+fn scatter(bufs: &mut [IoSliceMut<'_>], mut offset: usize, mut data: &[u8]) {
+    for buf in bufs.iter_mut() {
+        if data.is_empty() {
+            break;
+        }
+        if offset >= buf.len() {
+            offset -= buf.len();
+            continue;
+        }
+
+        let n = (buf.len() - offset).min(data.len());
+        buf[offset..offset + n].copy_from_slice(&data[..n]);
+        data = &data[n..];
+        offset = 0;
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::{gather, plan, scatter, Segment};
+    use std::io::{IoSlice, IoSliceMut};
+
+    fn lengths(segments: &[Segment]) -> Vec<usize> {
+        segments.iter().map(|segment| segment.len()).collect()
+    }
+
+    /// Reassembles the data the segments transfer.
+    fn concat(slices: &[&[u8]], segments: &[Segment]) -> Vec<u8> {
+        let bufs = slices.iter().map(|s| IoSlice::new(s)).collect::<Vec<_>>();
+        let mut data = Vec::new();
+        for segment in segments {
+            match *segment {
+                Segment::InPlace { slice, offset, len } => {
+                    data.extend_from_slice(&slices[slice][offset..offset + len])
+                }
+                Segment::Gathered { start, len } => {
+                    let mut gathered = vec![0; len];
+                    gather(&bufs, start, &mut gathered);
+                    data.extend_from_slice(&gathered);
+                }
+            }
+        }
+        data
+    }
+
+    #[test]
+    fn it_transfers_aligned_slices_in_place() {
+        assert_eq!(
+            vec![
+                Segment::InPlace {
+                    slice: 0,
+                    offset: 0,
+                    len: 512
+                },
+                Segment::InPlace {
+                    slice: 1,
+                    offset: 0,
+                    len: 1024
+                },
+            ],
+            plan(vec![512, 1024], 512)
+        );
+    }
+
+    #[test]
+    fn it_gathers_small_slices_into_one_packet() {
+        assert_eq!(
+            vec![Segment::Gathered { start: 0, len: 6 }],
+            plan(vec![2, 1, 3], 512)
+        );
+    }
+
+    #[test]
+    fn it_only_gathers_around_unaligned_boundaries() {
+        let header = [0xaa; 7];
+        let payload = (0..2000).map(|i| i as u8).collect::<Vec<_>>();
+        let segments = plan(vec![header.len(), payload.len()], 512);
+
+        // The header and the start of the payload fill one packet, the bulk of the payload goes
+        // in place and its tail ends the transfer.
+        assert_eq!(vec![512, 1024, 471], lengths(&segments));
+        assert_eq!(
+            Segment::InPlace {
+                slice: 1,
+                offset: 505,
+                len: 1024
+            },
+            segments[1]
+        );
+
+        let mut expected = header.to_vec();
+        expected.extend_from_slice(&payload);
+        assert_eq!(expected, concat(&[&header, &payload], &segments));
+    }
+
+    #[test]
+    fn it_aligns_every_segment_but_the_last() {
+        let slices: Vec<Vec<u8>> = [3, 64, 100, 0, 700, 61, 1, 128]
+            .iter()
+            .enumerate()
+            .map(|(i, &len)| vec![i as u8; len])
+            .collect();
+        let refs = slices.iter().map(|s| &s[..]).collect::<Vec<_>>();
+        let segments = plan(refs.iter().map(|s| s.len()), 64);
+
+        let lengths = lengths(&segments);
+        assert!(lengths[..lengths.len() - 1].iter().all(|len| len % 64 == 0));
+        assert_eq!(slices.concat(), concat(&refs, &segments));
+    }
+
+    #[test]
+    fn it_plans_nothing_for_empty_input() {
+        assert!(plan(vec![], 64).is_empty());
+        assert!(plan(vec![0, 0], 64).is_empty());
+    }
+
+    #[test]
+    fn it_scatters_across_slices() {
+        let mut a = [0u8; 3];
+        let mut b = [0u8; 4];
+        {
+            let mut bufs = [IoSliceMut::new(&mut a), IoSliceMut::new(&mut b)];
+            scatter(&mut bufs, 2, &[1, 2, 3]);
+        }
+
+        assert_eq!([0, 0, 1], a);
+        assert_eq!([2, 3, 0, 0], b);
+    }
+}